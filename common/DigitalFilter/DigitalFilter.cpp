@@ -49,7 +49,16 @@ float DigitalFilter::GetSmoothingFactor() const
  */
 int DigitalFilter::analogReadSmoothedWithEMA(const int pin)
 {
-    int rawAnalogValue = analogRead(pin);
+    return smoothWithEMA(analogRead(pin));
+}
+
+/**
+ * @brief Smooth an already sampled analog value using EMA
+ * @param rawAnalogValue The sampled analog value, eg. from an ADC scan
+ * @return The smoothed analog value
+ */
+int DigitalFilter::smoothWithEMA(const int rawAnalogValue)
+{
     mSmoothedAnalogValue = mSmoothingFactor * rawAnalogValue + (1 - mSmoothingFactor) * mSmoothedAnalogValue;
     return static_cast<int>(mSmoothedAnalogValue);
 }
@@ -19,6 +19,9 @@
  * https://www.luisllamas.es/en/arduino-exponential-low-pass/
  */
 
+#ifndef DIGITAL_FILTER_H
+#define DIGITAL_FILTER_H
+
 class DigitalFilter
 {
     private:
@@ -40,9 +43,12 @@ class DigitalFilter
         
         // --------------------------------- Core Methods ---------------------------------
         int analogReadSmoothedWithEMA(const int pin);
+        int smoothWithEMA(const int rawAnalogValue);
 
 
         DigitalFilter() = delete;                       ///< Default constructor disabled
         DigitalFilter(const DigitalFilter &) = delete;     ///< Copy constructor disabled
         void operator=(const DigitalFilter &) = delete; ///< Assignment operator disabled
-};
\ No newline at end of file
+};
+
+#endif // DIGITAL_FILTER_H
\ No newline at end of file
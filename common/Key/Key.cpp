@@ -5,6 +5,17 @@
 
 #include "Key.h"
 
+//
+// Build with -D KEY_DEBUG to trace the note, state and velocity of every key
+// on every scan. At 115200 baud the trace blocks each pass for milliseconds,
+// so it is off by default
+//
+#ifdef KEY_DEBUG
+#define KEY_TRACE(value) Serial.print(value)
+#else
+#define KEY_TRACE(value)
+#endif
+
 /**
  * @brief Constructor
  * @param notePin The ADC pin that reads the velocity of this key's note/pitch
@@ -68,6 +79,16 @@ void Key::SetThreshold(uint8_t threshold)
     mThreshold = threshold;
 }
 
+/**
+ * @brief Set the smoothing factor of the EMA filter applied to this key's ADC readings
+ * @param smoothingFactor The smoothing factor to set (0 - 1 | 1 disables smoothing)
+ */
+void Key::SetSmoothingFactor(float smoothingFactor)
+{
+    mSmoothingFactor = smoothingFactor;
+    mDigitalFilter->SetSmoothingFactor(smoothingFactor);
+}
+
 /**
  * @brief Return the ADC pin that reads the note velocity of this key
  */
@@ -132,7 +153,7 @@ bool Key::IsReadyForMIDI()
  */
 void Key::Update()
 {
-    int value = analogRead(mNotePin);
+    int value = mDigitalFilter->analogReadSmoothedWithEMA(mNotePin);
     // Serial.println(value);
     value = map(value, 0, mMaxAdcValue, 0, 127);
     
@@ -140,13 +161,13 @@ void Key::Update()
     bool damperIsOn = !digitalRead(mDamperPin); // damper is connected to hall effect sensor that uses active low logic. Therefore LOW -> Damper On ...
 
     // Serial.println(velocity);
-    Serial.print(" | Note: "); Serial.print(mNote); 
+    KEY_TRACE(" | Note: "); KEY_TRACE(mNote); 
 
 
     switch(mState)
     {
         case Idle:
-            Serial.print(" | State: Idle");
+            KEY_TRACE(" | State: Idle");
             //
             // While idle, if the registered velocity overshoots the threshold required 
             // to turn on the note of this key, and the damper is off ("lifted"), update 
@@ -161,7 +182,7 @@ void Key::Update()
 
                 mState = NoteOn;
 
-                Serial.print(" | Velocity: "); Serial.print(velocity);
+                KEY_TRACE(" | Velocity: "); KEY_TRACE(velocity);
             }
             //
             // Otherwise, remain in this Idle state
@@ -173,7 +194,7 @@ void Key::Update()
             break;
 
         case NoteOn:
-            Serial.print(" | State: NoteOn");
+            KEY_TRACE(" | State: NoteOn");
             //
             // While the note of this key is on, if the damper turns on, signifying that the
             // bottom of the key has returned to its rest state, update variables, inputs, & 
@@ -187,7 +208,7 @@ void Key::Update()
                 mReadyForMIDI = true;
 
                 mState = NoteOff;
-                Serial.print(" | Velocity: "); Serial.print(velocity);
+                KEY_TRACE(" | Velocity: "); KEY_TRACE(velocity);
             }
             //
             // Otherwise, if a note is currently on, but the key is pressed again, and the 
@@ -208,7 +229,7 @@ void Key::Update()
                 mReadyForMIDI = true;
 
                 mState = PartialPressNoteOn;
-                Serial.print(" | Velocity: "); Serial.print(velocity);
+                KEY_TRACE(" | Velocity: "); KEY_TRACE(velocity);
             }
             //
             // Else, finally, remain in this NOTE ON state. Why? The user might stil
@@ -221,8 +242,8 @@ void Key::Update()
             break;
 
         case PartialPressNoteOn:
-            Serial.print(" | State: PartialPressNoteOn");
-            Serial.print(" | Velocity: "); Serial.print(mVelocity);
+            KEY_TRACE(" | State: PartialPressNoteOn");
+            KEY_TRACE(" | Velocity: "); KEY_TRACE(mVelocity);
             //
             // Entering this state implies that although the bottom of the key did not return
             // to its rest position - which would have caused the damper to turn on and mute 
@@ -241,8 +262,8 @@ void Key::Update()
             break;
         
         case NoteOff:
-            Serial.print("State: NoteOff");
-            Serial.print(" | Velocity: "); Serial.print(mVelocity);
+            KEY_TRACE("State: NoteOff");
+            KEY_TRACE(" | Velocity: "); KEY_TRACE(mVelocity);
             //
             // From the NoteOff state transition directly to the Idle state
             //
@@ -259,6 +280,6 @@ void Key::Update()
             mState = Idle;
             break;
     }
-    Serial.print(" | Damper: "); Serial.print(damperIsOn);
-    Serial.println();
+    KEY_TRACE(" | Damper: "); KEY_TRACE(damperIsOn);
+    KEY_TRACE("\n");
 }
\ No newline at end of file
@@ -41,8 +41,9 @@ private:
     /// The time taken for the piezo disc of this key to debounce in milliseconds
     const unsigned long mDebounceTime = 1000;
 
-    /// Smoothing factor to digitally filter analog data using Exponential Moving Average (EMA) LPF
-    const float mSmoothingFactor = 0.4;
+    /// Smoothing factor to digitally filter analog data using Exponential Moving Average (EMA) LPF.
+    /// 1.0 passes samples through unfiltered until the master tunes it over the link
+    float mSmoothingFactor = 1.0;
 
     DigitalFilter* mDigitalFilter = nullptr;
 
@@ -63,6 +64,7 @@ public:
     void SetStatus(uint8_t status);
     void SetVelocity(uint8_t velocity);
     void SetThreshold(uint8_t thresholdOn);
+    void SetSmoothingFactor(float smoothingFactor);
 
     // ----------------------------------- Getters ---------------------------------
     int GetNotePin();
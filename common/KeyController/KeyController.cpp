@@ -0,0 +1,791 @@
+/**
+ * @file KeyController.cpp
+ * @author Mate Narh
+ */
+ 
+#include "KeyController.h"
+#include <esp_heap_caps.h>
+
+//
+// Two transactions is the least that keeps one frame pre-loaded while the
+// master clocks out the other
+//
+static constexpr size_t MIN_QUEUE_SIZE = 2;
+
+static constexpr unsigned long TEST_PATTERN_PERIOD_US = 250000; ///< Time each synthetic note is held on or off
+static constexpr uint8_t TEST_PATTERN_VELOCITY = 100;           ///< Velocity of the synthetic notes
+
+static constexpr unsigned long MUX_SETTLE_US = 5;  ///< Time for a multiplexer output to settle after switching channels
+
+static constexpr unsigned long UART_KEEPALIVE_US = 10000;  ///< Longest gap between two frames pushed over UART
+static constexpr size_t UART_DRIVER_BUFFER_SIZE = 1024;    ///< Size of the UART driver's receive/transmit ring buffers
+static constexpr int UART_EVENT_QUEUE_SIZE = 16;           ///< Number of UART driver events that can wait
+
+/**
+ * @brief Constructor
+ * @param keyCount Number of keys to control
+ * @param keyPins Array of GPIO pins for the keys of this controller
+ * @param damperPins Array of GPIO pins for the dampers of the keys belonging to this controller
+ * @param threshold The trigger point above which the note for a key turns on
+ * @param startNote The start note of this controllers key range. eg. Middle C
+ * @param resolution The resolution for analog reading the ACP pins of the keys for this controller
+ */
+KeyController::KeyController(const size_t keyCount, const int *keyPins, const int *damperPins, const int threshold, uint8_t startNote, const int resolution)
+{
+    //
+    // Initialize array of pointers to Keys
+    //
+    mKeyCount = keyCount;
+    mStartNote = startNote;
+    mKeys = new Key *[keyCount];
+
+    //
+    // Determine the maximum ADC value at which keys will be analogue read 
+    // Bit math for: MAX ADC VALUE = 2^resolution - 1 
+    //
+    int maxAdcValue = (1 << resolution) - 1; 
+
+    for (int i = 0; i < keyCount; i++)
+    {
+        // Set up the note for this key by adding the offset to the reference note
+        uint8_t note = static_cast<uint8_t>(startNote + i);
+
+        //
+        // Create a pointer to this key and store it in the array for all keys
+        //
+        mKeys[i] = new Key(keyPins[i], damperPins[i], note, maxAdcValue, threshold);
+    }
+    Serial.println("Done setting up key controller ...");
+}
+
+/**
+ * @brief Destructor
+ */
+KeyController::~KeyController()
+{
+    delete[] mKeys; // Free the memory allocated to key pointers    
+
+    if (mTransactions != nullptr)
+    {
+        spi_slave_free(mHost);
+
+        for (size_t i = 0; i < mQueueSize; i++)
+        {
+            heap_caps_free(mTransferBuffers[i]);
+            heap_caps_free(mReceiveBuffers[i]);
+        }
+        delete[] mTransferBuffers;
+        delete[] mReceiveBuffers;
+        delete[] mSlots;
+        delete[] mTransactions;
+    }
+}
+
+/**
+ * @brief Initialize SPI communication for this constroller
+ *
+ * Every transaction gets its own transfer and receive buffer, and all of them are
+ * pre-loaded with a frame and queued with the SPI driver up front. The master
+ * therefore always finds at least one complete frame waiting, even while this
+ * controller is busy scanning its keys
+ * @param spiBus The SPI bus to communicate over: FSPI/HSPI
+ * @param spiMode The spi mode for communicating with master
+ * @param bufferSize The size of the buffer used in communicating with master
+ * @param queueSize The number of transactions kept queued for the master (at least 2)
+ */
+void KeyController::initializeSpi(const uint8_t spiBus, const uint8_t spiMode, const size_t bufferSize, const size_t queueSize)
+{
+    mHost = (spiBus == FSPI) ? SPI2_HOST : SPI3_HOST;
+
+    //
+    // DMA moves whole words, so round the buffers up to a multiple of 4 bytes
+    //
+    mBufferSize = (bufferSize + 3) & ~static_cast<size_t>(3);
+    mQueueSize = max(queueSize, MIN_QUEUE_SIZE);
+
+    //
+    // Initialize the transfer and receive buffers backing each queued transaction
+    //
+    mTransactions = new spi_slave_transaction_t [mQueueSize];
+    mTransferBuffers = new uint8_t* [mQueueSize];
+    mReceiveBuffers = new uint8_t* [mQueueSize];
+    mSlots = new TransactionSlot [mQueueSize];
+
+    for (size_t i = 0; i < mQueueSize; i++)
+    {
+        mTransferBuffers[i] = static_cast<uint8_t*>(heap_caps_malloc(mBufferSize, MALLOC_CAP_DMA));
+        mReceiveBuffers[i] = static_cast<uint8_t*>(heap_caps_malloc(mBufferSize, MALLOC_CAP_DMA));
+        mSlots[i].free = true;
+        mSlots[i].completedAt = 0;
+        mSlots[i].hasEvents = false;
+
+        memset(&mTransactions[i], 0, sizeof(spi_slave_transaction_t));
+        mTransactions[i].length = mBufferSize * 8;
+        mTransactions[i].tx_buffer = mTransferBuffers[i];
+        mTransactions[i].rx_buffer = mReceiveBuffers[i];
+        mTransactions[i].user = &mSlots[i];
+    }
+
+    //
+    // Begin SPI based on given SPI bus 
+    //
+    spi_bus_config_t bus {};
+    bus.mosi_io_num = (spiBus == FSPI) ? FSPI_MOSI : HSPI_MOSI;
+    bus.miso_io_num = (spiBus == FSPI) ? FSPI_MISO : HSPI_MISO;
+    bus.sclk_io_num = (spiBus == FSPI) ? FSPI_SCLK : HSPI_SCLK;
+    bus.quadwp_io_num = -1;
+    bus.quadhd_io_num = -1;
+    bus.max_transfer_sz = mBufferSize;
+
+    spi_slave_interface_config_t interface {};
+    interface.spics_io_num = (spiBus == FSPI) ? FSPI_SS : HSPI_SS;
+    interface.queue_size = mQueueSize;
+    interface.mode = spiMode;
+    interface.post_trans_cb = onTransactionComplete;
+
+    //
+    // Keep CS high while the master is not driving it, so that a floating line
+    // does not start a transaction
+    //
+    pinMode(interface.spics_io_num, INPUT_PULLUP);
+
+    if (spi_slave_initialize(mHost, &bus, &interface, SPI_DMA_CH_AUTO) != ESP_OK)
+    {
+        Serial.println("SPI slave initialization failed");
+        return;
+    }
+
+    queueFreeTransactions();
+}
+
+/**
+ * @brief Run this key controller to automatically update key data and communicate with master
+ *
+ * Nothing in here waits on the master: completed transactions are collected,
+ * the keys are scanned, and every transfer buffer the master is done with is
+ * refilled with the latest complete frame and queued again
+ */
+void KeyController::run()
+{
+    //
+    // Without a link, this controller runs on the MCU that sends the MIDI
+    // messages, which takes the events with popEvent()
+    //
+    bool uartLink = mUartPort != UART_NUM_MAX;
+    bool spiLink = mTransactions != nullptr;
+
+    if (uartLink)
+    {
+        receiveUartCommands();
+    }
+    else if (spiLink)
+    {
+        collectCompletedTransactions();
+    }
+
+    //
+    // While the master trains the link, skip scanning so that the pattern is
+    // re-queued as quickly as the master polls for it. Otherwise scan at the rate
+    // set by the master
+    //
+    unsigned long now = micros();
+
+    if (!mTraining && now - mLastScanTime >= mScanPeriod)
+    {
+        mLastScanTime = now;
+
+        if (mTestPattern)
+        {
+            playTestPattern();
+        }
+        else
+        {
+            scanKeys();
+            mScanDuration = micros() - now;
+        }
+    }
+
+    if (uartLink)
+    {
+        sendUartFrames();
+    }
+    else if (spiLink)
+    {
+        queueFreeTransactions();
+        updateDataReady();
+    }
+}
+
+/**
+ * @brief Take the oldest key event waiting, when the keys are scanned without a link
+ * @param event Set to the oldest key event, if any
+ * @return True if an event was taken and false if none is waiting
+ */
+bool KeyController::popEvent(KeyEvent& event)
+{
+    if (mEventCount == 0)
+    {
+        return false;
+    }
+
+    event = mEvents[mEventHead];
+    mEventHead = (mEventHead + 1) % EVENT_QUEUE_SIZE;
+    mEventCount--;
+
+    return true;
+}
+
+/**
+ * @brief Raise a GPIO line whenever key events wait for the master
+ *
+ * Lets the master poll this controller on the rising edge instead of on every
+ * pass of its loop. Only used with the SPI link, since the UART link pushes
+ * frames on its own
+ * @param pin The GPIO pin wired to the master's data-ready input
+ */
+void KeyController::setDataReadyPin(const int pin)
+{
+    mDataReadyPin = pin;
+    mDataReady = false;
+
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, LOW);
+}
+
+/**
+ * @brief Read the keys through an analog multiplexer (eg. CD74HC4067)
+ *
+ * The key pins given to the constructor are then the multiplexer outputs wired
+ * to ADC pins, and each key is selected by driving its channel on the select
+ * lines before it is read. The arrays must outlive this controller
+ * @param selectPins The GPIO pins driving the select lines, least significant first
+ * @param selectCount The number of select lines
+ * @param channels The multiplexer channel of each key
+ */
+void KeyController::setMultiplexer(const int* selectPins, const size_t selectCount, const int* channels)
+{
+    mMuxSelectPins = selectPins;
+    mMuxSelectCount = selectCount;
+    mMuxChannels = channels;
+
+    for (size_t bit = 0; bit < selectCount; bit++)
+    {
+        pinMode(selectPins[bit], OUTPUT);
+    }
+}
+
+/**
+ * @brief Scan every key of this controller and record its updates in the frame
+ */
+void KeyController::scanKeys()
+{
+    for (int i = 0; i < mKeyCount; i++)
+    {
+        Key* key = mKeys[i];
+
+        //
+        // Route the key through the multiplexer, if any, and let the output settle
+        // before it is read
+        //
+        if (mMuxSelectCount > 0)
+        {
+            for (size_t bit = 0; bit < mMuxSelectCount; bit++)
+            {
+                digitalWrite(mMuxSelectPins[bit], (mMuxChannels[i] >> bit) & 1);
+            }
+            delayMicroseconds(MUX_SETTLE_US);
+        }
+
+        key->Update();
+
+        //
+        // A key is only ready for a single scan, and several scans can run between
+        // two polls, so queue its update as an event stamped with the time the key
+        // was read. The master uses the stamp, not the time of its poll, to place it
+        //
+        if (key->IsReadyForMIDI())
+        {
+            pushEvent(i, key->GetVelocity(), key->GetStatus(), micros());
+        }
+    }
+}
+
+/**
+ * @brief Play synthetic notes instead of scanning the keys
+ *
+ * Each key in turn is switched on, then off, so that the link and the MIDI path
+ * on the master can be checked without anyone at the keyboard
+ */
+void KeyController::playTestPattern()
+{
+    unsigned long now = micros();
+
+    if (now - mTestPatternTime < TEST_PATTERN_PERIOD_US)
+    {
+        return;
+    }
+    mTestPatternTime = now;
+
+    if (mTestPatternNoteOn)
+    {
+        pushEvent(mTestPatternKey, 0, NOTE_OFF, now);
+        mTestPatternKey = (mTestPatternKey + 1) % mKeyCount;
+    }
+    else
+    {
+        pushEvent(mTestPatternKey, TEST_PATTERN_VELOCITY, NOTE_ON, now);
+    }
+    mTestPatternNoteOn = !mTestPatternNoteOn;
+}
+
+/**
+ * @brief Queue a key event to be sent to the master
+ * @param keyIndex The index of the key within this controller
+ * @param velocity The velocity of the update
+ * @param status The status of the update (NOTE_ON/NOTE_OFF)
+ * @param timestamp The slave time at which the key was read, in microseconds
+ */
+void KeyController::pushEvent(const size_t keyIndex, const uint8_t velocity, const uint8_t status, const uint32_t timestamp)
+{
+    if (mEventCount == EVENT_QUEUE_SIZE)
+    {
+        mDroppedEvents++;
+        return;
+    }
+
+    KeyEvent& event = mEvents[(mEventHead + mEventCount) % EVENT_QUEUE_SIZE];
+    event.key = static_cast<uint8_t>(keyIndex);
+    event.status = status;
+    event.velocity = velocity;
+    event.timestamp = timestamp;
+
+    mEventCount++;
+}
+
+/**
+ * @brief Fill a frame with the oldest waiting key events and the frame header
+ * @param frame The frame to fill
+ * @param maxEvents The number of events the frame has room for
+ * @return The number of events placed in the frame
+ */
+size_t KeyController::buildFrame(uint8_t* frame, const size_t maxEvents)
+{
+    size_t eventCount = min(mEventCount, min(maxEvents, static_cast<size_t>(FRAME_MAX_EVENTS)));
+
+    for (size_t e = 0; e < eventCount; e++)
+    {
+        EncodeEvent(frame, e, mEvents[mEventHead]);
+        mEventHead = (mEventHead + 1) % EVENT_QUEUE_SIZE;
+    }
+    mEventCount -= eventCount;
+
+    frame[0] = FRAME_READY;
+    frame[FRAME_SEQUENCE_INDEX] = mSequence++;
+    frame[FRAME_ACK_INDEX] = mLastCommandId;
+    frame[FRAME_EVENT_COUNT_INDEX] = eventCount;
+    WriteUint32(frame + FRAME_SYNC_MASTER_INDEX, mSyncMasterTime);
+    WriteUint32(frame + FRAME_SYNC_SLAVE_INDEX, mSyncSlaveTime);
+
+    return eventCount;
+}
+
+/**
+ * @brief Describe this controller to the master
+ * @return The descriptor the master sizes its buffers and decoders from
+ */
+SlaveDescriptor KeyController::describe() const
+{
+    bool uartLink = mUartPort != UART_NUM_MAX;
+
+    SlaveDescriptor descriptor;
+    descriptor.version = PROTOCOL_VERSION;
+    descriptor.keyCount = static_cast<uint8_t>(mKeyCount);
+    descriptor.startNote = mStartNote;
+    descriptor.sensorType = SENSOR_PIEZO_HALL_DAMPER;
+    descriptor.frameSize = uartLink ? FRAME_SIZE : mBufferSize;
+    descriptor.maxEvents = min((descriptor.frameSize - FRAME_HEADER_SIZE) / FRAME_EVENT_SIZE, FRAME_MAX_EVENTS);
+    descriptor.maxScanRate = (mScanDuration == 0) ? 0 : 1000000UL / mScanDuration;
+
+    return descriptor;
+}
+
+/**
+ * @brief Take back every transaction the master has clocked out, and apply its command
+ */
+void KeyController::collectCompletedTransactions()
+{
+    spi_slave_transaction_t* transaction = nullptr;
+
+    while (spi_slave_get_trans_result(mHost, &transaction, 0) == ESP_OK)
+    {
+        TransactionSlot* slot = static_cast<TransactionSlot*>(transaction->user);
+        const uint8_t* received = static_cast<const uint8_t*>(transaction->rx_buffer);
+
+        //
+        // Pair the master time stamped on this poll with the time the poll completed
+        // here. The pair goes back to the master in every frame until the next poll
+        //
+        uint32_t masterTime = ReadUint32(received + CMD_SYNC_INDEX);
+
+        if (masterTime != 0)
+        {
+            mSyncMasterTime = masterTime;
+            mSyncSlaveTime = slot->completedAt;
+        }
+
+        handleCommand(received);
+        slot->free = true;
+        slot->hasEvents = false;
+    }
+}
+
+/**
+ * @brief Load the waiting key events into every free transfer buffer and queue it
+ *
+ * A transfer buffer is only ever written while the SPI driver does not own it,
+ * so the master always clocks out a consistent, complete frame. Handing the
+ * buffer over to the driver is the swap: the scan keeps queuing events while
+ * the frames already handed over wait for the master. Events leave the queue
+ * once they are in a frame, and every frame is clocked out exactly once
+ */
+void KeyController::queueFreeTransactions()
+{
+    for (size_t i = 0; i < mQueueSize; i++)
+    {
+        if (!mSlots[i].free)
+        {
+            continue;
+        }
+
+        uint8_t* frame = mTransferBuffers[i];
+
+        if (mTraining)
+        {
+            FillTrainingPattern(frame, mBufferSize);
+        }
+        else if (mDescribing)
+        {
+            memset(frame, 0, mBufferSize);
+            EncodeDescriptor(frame, describe());
+        }
+        else
+        {
+            memset(frame, 0, mBufferSize);
+            mSlots[i].hasEvents = buildFrame(frame, (mBufferSize - FRAME_HEADER_SIZE) / FRAME_EVENT_SIZE) > 0;
+        }
+        memset(mReceiveBuffers[i], CMD_NONE, mBufferSize);
+
+        if (spi_slave_queue_trans(mHost, &mTransactions[i], 0) == ESP_OK)
+        {
+            mSlots[i].free = false;
+        }
+    }
+}
+
+/**
+ * @brief Drive the data-ready line to tell the master whether a poll would carry key events
+ *
+ * The line stays high until every frame holding events has been clocked out
+ * and the event queue is empty, so a master that missed the rising edge
+ * still sees the level on its next pass
+ */
+void KeyController::updateDataReady()
+{
+    if (mDataReadyPin < 0)
+    {
+        return;
+    }
+
+    bool ready = mEventCount > 0;
+
+    for (size_t i = 0; i < mQueueSize && !ready; i++)
+    {
+        ready = !mSlots[i].free && mSlots[i].hasEvents;
+    }
+
+    if (ready != mDataReady)
+    {
+        mDataReady = ready;
+        digitalWrite(mDataReadyPin, ready ? HIGH : LOW);
+    }
+}
+
+/**
+ * @brief Record the time at which the master finished clocking out a transaction
+ *
+ * Runs from the SPI driver's interrupt, so it only takes a timestamp
+ * @param transaction The transaction that just completed
+ */
+void IRAM_ATTR KeyController::onTransactionComplete(spi_slave_transaction_t* transaction)
+{
+    static_cast<TransactionSlot*>(transaction->user)->completedAt = micros();
+}
+
+/**
+ * @brief Apply a link command received from the master
+ *
+ * Commands are applied between two key scans, so a new threshold, filter or
+ * scan rate takes effect on a frame boundary without the scan ever pausing
+ * @param command The receive buffer holding the link command
+ */
+void KeyController::handleCommand(const uint8_t* command)
+{
+    //
+    // Training commands carry no ID and are safe to apply more than once
+    //
+    switch (command[0])
+    {
+        case CMD_TRAIN_BEGIN:
+            //
+            // Training starts every master session, and a new session numbers its
+            // commands from scratch
+            //
+            mTraining = true;
+            mDescribing = false;
+            mLastCommandId = 0;
+            return;
+
+        case CMD_TRAIN_END:
+            mTraining = false;
+            mDescribing = false;
+            return;
+
+        case CMD_DESCRIBE:
+            //
+            // Over UART no training takes place, and the description is the first
+            // thing a master asks for, so it starts the session instead
+            //
+            mDescribing = true;
+            mLastCommandId = 0;
+            return;
+
+        case CMD_NONE:
+            return;
+
+        default:
+            break;
+    }
+
+    //
+    // The master resends a command until it is acknowledged, so skip repeats
+    //
+    uint8_t id = command[CMD_ID_INDEX];
+
+    if (id == mLastCommandId)
+    {
+        return;
+    }
+
+    applyCommand(command[0], command[CMD_TARGET_INDEX], DecodeCommandValue(command));
+    mLastCommandId = id;
+}
+
+/**
+ * @brief Apply a link command to this controller
+ *
+ * Called for every new command from the master, and directly by the firmware
+ * when the keys are scanned on the same MCU that sends the MIDI messages
+ * @param command The link command to apply (see Protocol.h)
+ * @param target The key the command applies to, or CMD_ALL_KEYS
+ * @param value The argument of the command
+ */
+void KeyController::applyCommand(const uint8_t command, const uint8_t target, const uint32_t value)
+{
+    switch (command)
+    {
+        case CMD_SET_THRESHOLD:
+            applyToKeys(target, [](Key* key, uint32_t value) { key->SetThreshold(value > 127 ? 127 : value); }, value);
+            break;
+
+        case CMD_SET_FILTER:
+            applyToKeys(target, [](Key* key, uint32_t value) { key->SetSmoothingFactor(value > 65536 ? 1.0f : value / 65536.0f); }, value);
+            break;
+
+        case CMD_SET_SCAN_RATE:
+            mScanPeriod = (value == 0) ? 0 : 1000000UL / value;
+            break;
+
+        case CMD_TEST_PATTERN:
+            //
+            // Never leave a synthetic note sounding when the pattern stops
+            //
+            if (!value && mTestPattern && mTestPatternNoteOn)
+            {
+                pushEvent(mTestPatternKey, 0, NOTE_OFF, micros());
+            }
+            mTestPattern = value;
+            mTestPatternKey = 0;
+            mTestPatternNoteOn = false;
+            break;
+
+        case CMD_TIME_SYNC:
+            //
+            // Drop the pair in hand so that the master restarts from fresh samples
+            //
+            mSyncMasterTime = 0;
+            mSyncSlaveTime = 0;
+            break;
+
+        default:
+            Serial.print("Unknown link command: "); Serial.println(command, HEX);
+            break;
+    }
+}
+
+/**
+ * @brief Apply a link command argument to one key or to every key of this controller
+ * @param target The index of the key to apply to, or CMD_ALL_KEYS
+ * @param apply The function applying the argument to a key
+ * @param value The argument of the link command
+ */
+void KeyController::applyToKeys(const uint8_t target, void (*apply)(Key* key, uint32_t value), const uint32_t value)
+{
+    for (size_t i = 0; i < mKeyCount; i++)
+    {
+        if (target == CMD_ALL_KEYS || target == i)
+        {
+            apply(mKeys[i], value);
+        }
+    }
+}
+
+
+/**
+ * @brief Initialize the UART link to push frames to the master, instead of being polled over SPI
+ *
+ * Frames only carry the events actually waiting, and go out as soon as a scan
+ * produces them. The driver posts an event once the line has been idle for a
+ * couple of symbols after a command frame from the master
+ * @param port The UART connected to the master
+ * @param txPin The pin the frames are pushed on
+ * @param rxPin The pin the master's command frames arrive on
+ * @param baud The baud rate of the link
+ */
+void KeyController::initializeUart(const uart_port_t port, const int txPin, const int rxPin, const uint32_t baud)
+{
+    mUartPort = port;
+
+    uart_config_t config = {};
+    config.baud_rate = static_cast<int>(baud);
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    config.source_clk = UART_SCLK_DEFAULT;
+
+    uart_driver_install(port, UART_DRIVER_BUFFER_SIZE, UART_DRIVER_BUFFER_SIZE, UART_EVENT_QUEUE_SIZE, &mUartQueue, 0);
+    uart_param_config(port, &config);
+    uart_set_pin(port, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    uart_set_rx_timeout(port, 2);
+
+    Serial.print("UART link setup complete | Baud: "); Serial.println(baud);
+}
+
+/**
+ * @brief Apply the command frames the master pushed over UART since the last call
+ *
+ * The time at which the driver's event is picked up here stands in for the time
+ * the frame arrived. It can only be late, which the master's clock sync allows for
+ */
+void KeyController::receiveUartCommands()
+{
+    uart_event_t event;
+
+    while (xQueueReceive(mUartQueue, &event, 0) == pdTRUE)
+    {
+        if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL)
+        {
+            uart_flush_input(mUartPort);
+            xQueueReset(mUartQueue);
+            mUartReceiveLength = 0;
+            return;
+        }
+
+        if (event.type != UART_DATA)
+        {
+            continue;
+        }
+
+        uint32_t receivedAt = micros();
+        size_t pending = event.size;
+
+        while (pending > 0)
+        {
+            size_t space = sizeof(mUartReceiveBuffer) - mUartReceiveLength;
+            int received = uart_read_bytes(mUartPort, mUartReceiveBuffer + mUartReceiveLength, min(pending, space), 0);
+
+            if (received <= 0)
+            {
+                break;
+            }
+            pending -= received;
+            mUartReceiveLength += received;
+
+            size_t start = 0;
+            int size = 0;
+
+            while ((size = ParseUartFrame(mUartReceiveBuffer + start, mUartReceiveLength - start, UART_COMMAND_HEADER)) != 0)
+            {
+                if (size < 0)
+                {
+                    start++;
+                    continue;
+                }
+
+                const uint8_t* command = mUartReceiveBuffer + start + 1;
+                uint32_t masterTime = ReadUint32(command + CMD_SYNC_INDEX);
+
+                if (masterTime != 0)
+                {
+                    mSyncMasterTime = masterTime;
+                    mSyncSlaveTime = receivedAt;
+                }
+
+                handleCommand(command);
+                start += size;
+            }
+
+            memmove(mUartReceiveBuffer, mUartReceiveBuffer + start, mUartReceiveLength - start);
+            mUartReceiveLength -= start;
+        }
+    }
+}
+
+/**
+ * @brief Push the waiting key events to the master over UART
+ *
+ * A frame goes out whenever events are waiting, and at least every keepalive
+ * period otherwise, so the master can tell the link is up and keeps receiving
+ * acknowledgements and clock sync pairs
+ */
+void KeyController::sendUartFrames()
+{
+    unsigned long now = micros();
+
+    if (mDescribing)
+    {
+        uint8_t descriptor[DESCRIPTOR_SIZE + UART_CRC_SIZE];
+        EncodeDescriptor(descriptor, describe());
+        descriptor[DESCRIPTOR_SIZE] = Crc8(descriptor, DESCRIPTOR_SIZE);
+
+        uart_write_bytes(mUartPort, descriptor, sizeof(descriptor));
+        mDescribing = false;
+    }
+
+    if (mEventCount == 0 && now - mLastUartFrameTime < UART_KEEPALIVE_US)
+    {
+        return;
+    }
+    mLastUartFrameTime = now;
+
+    uint8_t frame[UART_FRAME_MAX_SIZE];
+
+    do
+    {
+        size_t size = UartFrameSize(buildFrame(frame, FRAME_MAX_EVENTS));
+        frame[size - UART_CRC_SIZE] = Crc8(frame, size - UART_CRC_SIZE);
+
+        uart_write_bytes(mUartPort, frame, size);
+    }
+    while (mEventCount > 0);
+}
@@ -0,0 +1,173 @@
+/**
+ * @file KeyController.h
+ * @author Mate Narh
+ * 
+ * Class for controlling keys spanning a particular range of the
+ * MIDI Keyboard. Runs on a slave, which sends the key events to the
+ * master over SPI or UART, or on the master itself in direct-scan mode
+ * 
+ * --Tentative
+ */
+
+#ifndef KEY_CONTROLLER_H
+#define KEY_CONTROLLER_H
+
+#include <driver/spi_slave.h>
+#include <driver/uart.h>
+
+#include <Key.h>
+#include <Utility.h>
+#include <Protocol.h>
+
+class KeyController
+{
+private:
+    /// An array pointers to keys controlled by this controller
+    Key** mKeys = nullptr;        
+
+    ///< The number of keys this controller controls
+    size_t mKeyCount = 0;  
+
+    ///< The note of the first key of this controller. The others follow chromatically
+    uint8_t mStartNote = 0;
+    
+    ///< The buffer size that this controllers uses for SPI communication with its master
+    size_t mBufferSize = 0;  
+
+    ///< The queue size that this controllers uses for SPI communication with its master
+    size_t mQueueSize = 0;
+
+    ///< The SPI host (GP-SPI2/GP-SPI3) that this controller's slave driver runs on
+    spi_host_device_t mHost = SPI3_HOST;
+
+    ///< The sequence number stamped on the next frame handed to the SPI driver
+    uint8_t mSequence = 0;
+
+    ///< The transactions pre-queued with the SPI driver, one per transfer buffer
+    spi_slave_transaction_t* mTransactions = nullptr;
+
+    ///< The transfer buffers this controller uses to send polled data to master over SPI (DMA capable)
+    uint8_t** mTransferBuffers = nullptr;
+
+    ///< The receive buffers this controller uses to collect link commands from master over SPI (DMA capable)
+    uint8_t** mReceiveBuffers = nullptr;
+
+    /// Bookkeeping for a transaction queued with the SPI driver
+    struct TransactionSlot
+    {
+        bool free;                      ///< Is the transfer buffer back in this controller's hands?
+        volatile uint32_t completedAt;  ///< Slave time at which the master finished clocking it, in microseconds
+        bool hasEvents;                 ///< Does the frame in the transfer buffer carry key events?
+    };
+
+    ///< The bookkeeping for each queued transaction. Passed to the driver as the transaction's user data
+    TransactionSlot* mSlots = nullptr;
+
+    ///< The GPIO pin raised while key events wait for the master, or -1 when the master polls blindly
+    int mDataReadyPin = -1;
+
+    ///< The level currently driven on mDataReadyPin
+    bool mDataReady = false;
+
+    ///< The UART this controller pushes its frames on, or UART_NUM_MAX when the master polls over SPI
+    uart_port_t mUartPort = UART_NUM_MAX;
+
+    ///< Events posted by the UART driver (one per command frame received)
+    QueueHandle_t mUartQueue = nullptr;
+
+    ///< Bytes received over UART and not parsed yet
+    uint8_t mUartReceiveBuffer[2 * UART_COMMAND_FRAME_SIZE];
+
+    ///< Number of bytes in mUartReceiveBuffer
+    size_t mUartReceiveLength = 0;
+
+    ///< When was the last frame pushed to the master over UART?
+    unsigned long mLastUartFrameTime = 0;
+
+    static constexpr size_t EVENT_QUEUE_SIZE = 64;  ///< Number of key events that can wait for a frame
+
+    KeyEvent mEvents[EVENT_QUEUE_SIZE];  ///< Ring buffer of key events waiting to be sent to the master
+    size_t mEventHead = 0;               ///< Index of the oldest waiting key event
+    size_t mEventCount = 0;              ///< Number of waiting key events
+    unsigned long mDroppedEvents = 0;    ///< Number of key events dropped because the queue was full
+
+    ///< The last master time received for clock sync, echoed back in every frame
+    uint32_t mSyncMasterTime = 0;
+
+    ///< The slave time at which the poll carrying mSyncMasterTime completed
+    uint32_t mSyncSlaveTime = 0;
+
+    ///< Is this controller serving the clock training pattern instead of key updates?
+    bool mTraining = false;
+
+    ///< Is this controller serving its descriptor instead of key updates?
+    bool mDescribing = false;
+
+    ///< How long the last full key scan took, in microseconds
+    unsigned long mScanDuration = 0;
+
+    ///< The ID of the last link command applied. Echoed back to the master as an acknowledgement
+    uint8_t mLastCommandId = 0;
+
+    ///< Minimum time between two key scans in microseconds (0 = scan as fast as possible)
+    unsigned long mScanPeriod = 0;
+
+    ///< When did the last key scan take place?
+    unsigned long mLastScanTime = 0;
+
+    ///< Is this controller playing synthetic notes instead of scanning its keys?
+    bool mTestPattern = false;
+
+    ///< The key currently sounded by the test pattern
+    size_t mTestPatternKey = 0;
+
+    ///< Is the note of the current test pattern key on?
+    bool mTestPatternNoteOn = false;
+
+    ///< When did the test pattern last change?
+    unsigned long mTestPatternTime = 0;
+
+    ///< The GPIO pins driving the select lines of the analog multiplexer, if any
+    const int* mMuxSelectPins = nullptr;
+
+    ///< The number of multiplexer select lines (0 = keys wired straight to ADC pins)
+    size_t mMuxSelectCount = 0;
+
+    ///< The multiplexer channel of each key
+    const int* mMuxChannels = nullptr;
+
+    void scanKeys();
+    void playTestPattern();
+    void pushEvent(const size_t keyIndex, const uint8_t velocity, const uint8_t status, const uint32_t timestamp);
+    void collectCompletedTransactions();
+    void queueFreeTransactions();
+    void updateDataReady();
+    size_t buildFrame(uint8_t* frame, const size_t maxEvents);
+    SlaveDescriptor describe() const;
+    void receiveUartCommands();
+    void sendUartFrames();
+    void handleCommand(const uint8_t* command);
+    void applyToKeys(const uint8_t target, void (*apply)(Key* key, uint32_t value), const uint32_t value);
+
+    static void IRAM_ATTR onTransactionComplete(spi_slave_transaction_t* transaction);
+
+
+public:
+
+    KeyController(const size_t keyCount, const int* keyPins, const int* damperPins, const int threshold, uint8_t startNote, const int resoluiton);
+    ~KeyController();
+
+    void run();
+    void initializeSpi(const uint8_t spiBus, const uint8_t spiMode, const size_t bufferSize, const size_t queueSize);
+    void initializeUart(const uart_port_t port, const int txPin, const int rxPin, const uint32_t baud);
+    void setDataReadyPin(const int pin);
+    void setMultiplexer(const int* selectPins, const size_t selectCount, const int* channels);
+    void applyCommand(const uint8_t command, const uint8_t target, const uint32_t value);
+    bool popEvent(KeyEvent& event);
+
+    KeyController() = delete;
+    KeyController(const KeyController &) = delete;
+    void operator=(const KeyController &) = delete;
+};
+
+#endif // KEY_CONTROLLER_H
\ No newline at end of file
@@ -0,0 +1,391 @@
+/**
+ * @file MidiRouter.cpp
+ * @author Mate Narh
+ */
+
+#include "MidiRouter.h"
+
+/**
+ * @brief Get the number of transports messages are fanned out to
+ */
+size_t MidiRouter::GetTransportCount() const
+{
+    return mTransportCount;
+}
+
+/**
+ * @brief Get the name of a transport
+ * @param index The index of the transport, in the order they were added
+ */
+const char* MidiRouter::GetTransportName(const size_t index) const
+{
+    return (index < mTransportCount) ? mLanes[index].transport->GetName() : "";
+}
+
+/**
+ * @brief Get the number of messages waiting for a transport
+ * @param index The index of the transport, in the order they were added
+ */
+uint32_t MidiRouter::GetQueueDepth(const size_t index) const
+{
+    return (index < mTransportCount) ? GetDepth(mLanes[index]) : 0;
+}
+
+/**
+ * @brief Get the largest number of messages that waited for a transport at once
+ * @param index The index of the transport, in the order they were added
+ */
+uint32_t MidiRouter::GetMaxQueueDepth(const size_t index) const
+{
+    return (index < mTransportCount) ? mLanes[index].maxDepth : 0;
+}
+
+/**
+ * @brief Get the number of messages a transport lost to a full lane or to being inactive
+ * @param index The index of the transport, in the order they were added
+ */
+uint32_t MidiRouter::GetDroppedCount(const size_t index) const
+{
+    return (index < mTransportCount) ? mLanes[index].dropped : 0;
+}
+
+/**
+ * @brief Get the number of controller values for a transport replaced by a newer value before being sent
+ * @param index The index of the transport, in the order they were added
+ */
+uint32_t MidiRouter::GetMergedCount(const size_t index) const
+{
+    return (index < mTransportCount) ? mLanes[index].merged : 0;
+}
+
+/**
+ * @brief Get the average time from a message being encoded to a transport taking it, in microseconds
+ * @param index The index of the transport, in the order they were added
+ */
+unsigned long MidiRouter::GetAverageLatency(const size_t index) const
+{
+    if (index >= mTransportCount || mLanes[index].delivered == 0)
+    {
+        return 0;
+    }
+    return mLanes[index].latencyTotal / mLanes[index].delivered;
+}
+
+/**
+ * @brief Get the longest time from a message being encoded to a transport taking it, in microseconds
+ * @param index The index of the transport, in the order they were added
+ */
+unsigned long MidiRouter::GetMaxLatency(const size_t index) const
+{
+    return (index < mTransportCount) ? mLanes[index].latencyMax : 0;
+}
+
+/**
+ * @brief Add a transport that every message should be sent to
+ * @param transport The transport to add
+ * @return True if the transport was added and false if the router is full
+ */
+bool MidiRouter::AddTransport(MidiTransport* transport)
+{
+    if (transport == nullptr || mTransportCount == MAX_TRANSPORTS)
+    {
+        return false;
+    }
+    mLanes[mTransportCount++].transport = transport;
+    return true;
+}
+
+/**
+ * @brief Send a NOTE ON message to every active transport
+ * @param note The MIDI note (0 - 127)
+ * @param velocity The velocity of the note (0 - 127)
+ * @param channel The MIDI channel (1 - 16)
+ */
+void MidiRouter::NoteOn(const uint8_t note, const uint8_t velocity, const uint8_t channel)
+{
+    Route(0x90 | ((channel - 1) & 0x0F), note & 0x7F, velocity & 0x7F);
+}
+
+/**
+ * @brief Send a NOTE OFF message to every active transport
+ * @param note The MIDI note (0 - 127)
+ * @param velocity The release velocity of the note (0 - 127)
+ * @param channel The MIDI channel (1 - 16)
+ */
+void MidiRouter::NoteOff(const uint8_t note, const uint8_t velocity, const uint8_t channel)
+{
+    Route(0x80 | ((channel - 1) & 0x0F), note & 0x7F, velocity & 0x7F);
+}
+
+/**
+ * @brief Send a CONTROL CHANGE message to every active transport
+ * @param control The controller number (0 - 127)
+ * @param value The controller value (0 - 127)
+ * @param channel The MIDI channel (1 - 16)
+ */
+void MidiRouter::ControlChange(const uint8_t control, const uint8_t value, const uint8_t channel)
+{
+    Route(0xB0 | ((channel - 1) & 0x0F), control & 0x7F, value & 0x7F);
+}
+
+/**
+ * @brief Send a PITCH BEND message to every active transport
+ * @param value The bend (-8192 - 8191, 0 = center)
+ * @param channel The MIDI channel (1 - 16)
+ */
+void MidiRouter::PitchBend(const int16_t value, const uint8_t channel)
+{
+    uint16_t bend = static_cast<uint16_t>(constrain(value + 8192, 0, 16383));
+
+    Route(0xE0 | ((channel - 1) & 0x0F), bend & 0x7F, (bend >> 7) & 0x7F);
+}
+
+/**
+ * @brief Feed every transport from its lane, then let it move its messages to the wire
+ *
+ * Call once per pass of the main loop. A transport that goes inactive loses
+ * its waiting messages, so that no stale note is played when it comes back
+ */
+void MidiRouter::Service()
+{
+    for (size_t i = 0; i < mTransportCount; i++)
+    {
+        Drain(mLanes[i]);
+        mLanes[i].transport->Service();
+    }
+}
+
+/**
+ * @brief Clear the latency statistics of every transport
+ */
+void MidiRouter::ResetStatistics()
+{
+    for (size_t i = 0; i < mTransportCount; i++)
+    {
+        mLanes[i].delivered = 0;
+        mLanes[i].latencyTotal = 0;
+        mLanes[i].latencyMax = 0;
+    }
+}
+
+/**
+ * @brief Encode a channel message once and queue it for every active transport
+ * @param status The status byte of the message
+ * @param data1 The first data byte
+ * @param data2 The second data byte
+ */
+void MidiRouter::Route(const uint8_t status, const uint8_t data1, const uint8_t data2)
+{
+    MidiEvent event;
+    event.status = status;
+    event.data1 = data1;
+    event.data2 = data2;
+    event.reserved = 0;
+    event.timestamp = micros();
+
+    uint8_t type = status & 0xF0;
+
+    for (size_t i = 0; i < mTransportCount; i++)
+    {
+        Lane& lane = mLanes[i];
+
+        if (!lane.transport->IsActive())
+        {
+            continue;
+        }
+
+        if (type == 0xB0 || type == 0xE0)
+        {
+            QueueControl(lane, event);
+        }
+        else
+        {
+            QueueNote(lane, event);
+        }
+        lane.maxDepth = max(lane.maxDepth, GetDepth(lane));
+    }
+}
+
+/**
+ * @brief Append a note to the notes waiting for a transport
+ *
+ * The ring holds every key of a full keyboard, on and off, and controllers
+ * never take its room, so a note is only lost if the transport has stopped
+ * taking messages altogether
+ * @param lane The lane of the transport
+ * @param event The note
+ */
+void MidiRouter::QueueNote(Lane& lane, const MidiEvent& event)
+{
+    if (lane.tail - lane.head == NOTE_CAPACITY)
+    {
+        lane.dropped++;
+        return;
+    }
+
+    lane.notes[lane.tail % NOTE_CAPACITY] = event;
+    lane.noteSequences[lane.tail % NOTE_CAPACITY] = lane.nextSequence;
+    lane.lastNoteSequence = lane.nextSequence++;
+    lane.tail++;
+}
+
+/**
+ * @brief Set the latest value of a controller waiting for a transport
+ *
+ * A controller already waiting with no note queued behind it keeps its place
+ * and takes the new value. Otherwise the value takes a free slot, behind every
+ * message queued so far, or merges into the latest waiting value and moves
+ * behind every message with it when no slot is free
+ * @param lane The lane of the transport
+ * @param event The controller message (CC or pitch bend)
+ */
+void MidiRouter::QueueControl(Lane& lane, const MidiEvent& event)
+{
+    bool keyedOnData1 = (event.status & 0xF0) == 0xB0;
+    ControlSlot* freeSlot = nullptr;
+    ControlSlot* waiting = nullptr;
+
+    for (ControlSlot& slot : lane.controls)
+    {
+        if (!slot.pending)
+        {
+            freeSlot = (freeSlot == nullptr) ? &slot : freeSlot;
+            continue;
+        }
+
+        //
+        // A receiver clears the LSB of a 14-bit controller (CC 32 - 63) when
+        // its MSB (CC 0 - 31) arrives, so a waiting LSB is stale once a new
+        // MSB is queued, and must not be sent after it
+        //
+        if (keyedOnData1 && event.data1 < 32 && slot.event.status == event.status &&
+            slot.event.data1 == event.data1 + 32)
+        {
+            slot.pending = false;
+            lane.merged++;
+            freeSlot = (freeSlot == nullptr) ? &slot : freeSlot;
+            continue;
+        }
+
+        if (slot.event.status == event.status && (!keyedOnData1 || slot.event.data1 == event.data1) &&
+            (waiting == nullptr || static_cast<int32_t>(slot.sequence - waiting->sequence) > 0))
+        {
+            waiting = &slot;
+        }
+    }
+
+    //
+    // A note queued after the waiting value must still go out under it, so the
+    // new value only merges in place when no note came in between
+    //
+    if (waiting != nullptr && static_cast<int32_t>(waiting->sequence - lane.lastNoteSequence) > 0)
+    {
+        waiting->event.data1 = event.data1;
+        waiting->event.data2 = event.data2;
+        lane.merged++;
+        return;
+    }
+
+    if (freeSlot == nullptr)
+    {
+        if (waiting == nullptr)
+        {
+            lane.dropped++;
+            return;
+        }
+
+        //
+        // Out of slots: the old value is lost, but the new one still goes out
+        // after the notes queued before it
+        //
+        waiting->event.data1 = event.data1;
+        waiting->event.data2 = event.data2;
+        waiting->sequence = lane.nextSequence++;
+        lane.merged++;
+        return;
+    }
+
+    freeSlot->event = event;
+    freeSlot->sequence = lane.nextSequence++;
+    freeSlot->pending = true;
+}
+
+/**
+ * @brief Get the number of messages waiting in a lane
+ * @param lane The lane
+ */
+uint32_t MidiRouter::GetDepth(const Lane& lane) const
+{
+    uint32_t depth = lane.tail - lane.head;
+
+    for (const ControlSlot& slot : lane.controls)
+    {
+        depth += slot.pending;
+    }
+    return depth;
+}
+
+/**
+ * @brief Hand the waiting messages of one lane to its transport, oldest first, until it has no room left
+ * @param lane The lane to drain
+ */
+void MidiRouter::Drain(Lane& lane)
+{
+    if (!lane.transport->IsActive())
+    {
+        lane.dropped += GetDepth(lane);
+        lane.head = lane.tail;
+
+        for (ControlSlot& slot : lane.controls)
+        {
+            slot.pending = false;
+        }
+        return;
+    }
+
+    unsigned long now = micros();
+
+    while (true)
+    {
+        ControlSlot* control = nullptr;
+
+        for (ControlSlot& slot : lane.controls)
+        {
+            if (slot.pending && (control == nullptr || static_cast<int32_t>(slot.sequence - control->sequence) < 0))
+            {
+                control = &slot;
+            }
+        }
+
+        bool note = lane.head != lane.tail &&
+                    (control == nullptr ||
+                     static_cast<int32_t>(lane.noteSequences[lane.head % NOTE_CAPACITY] - control->sequence) < 0);
+
+        if (!note && control == nullptr)
+        {
+            break;
+        }
+
+        const MidiEvent& event = note ? lane.notes[lane.head % NOTE_CAPACITY] : control->event;
+
+        if (!lane.transport->Send(event))
+        {
+            break;
+        }
+
+        unsigned long latency = now - event.timestamp;
+
+        lane.latencyTotal += latency;
+        lane.latencyMax = max(lane.latencyMax, latency);
+        lane.delivered++;
+
+        if (note)
+        {
+            lane.head++;
+        }
+        else
+        {
+            control->pending = false;
+        }
+    }
+}
@@ -0,0 +1,105 @@
+/**
+ * @file MidiRouter.h
+ * @author Mate Narh
+ *
+ * Class for a master to send every MIDI message to all of its active outputs
+ * (USB, BLE, DIN/TRS). Each message is encoded once and queued on a separate
+ * lane per transport. Each lane is drained into its transport only as fast as
+ * that transport takes messages, so a slow or congested transport backs up its
+ * own lane and never the others.
+ *
+ * A lane keeps its messages in two classes, so that controllers can never push
+ * notes out. Notes wait in order on a ring sized for every key of a full
+ * keyboard, on and off. Controller messages (CC, pitch bend) only keep the
+ * latest value of each controller, in a slot per controller, so a flood of
+ * wheel messages on a slow transport merges down instead of filling the lane.
+ * The lane is drained oldest first. A new value only merges into the waiting
+ * one if no note was queued since, so a note still sees the value it was
+ * played under (eg. a note-off between a sustain pedal release and press):
+ * otherwise it takes another slot, behind the note. Only when every slot is
+ * taken does it merge anyway, and then moves behind the note too. The slots
+ * are merged in place, so messages must be routed and serviced from the same
+ * task
+ */
+
+#ifndef MIDI_ROUTER_H
+#define MIDI_ROUTER_H
+
+#include <Arduino.h>
+#include <MidiTransport.h>
+
+class MidiRouter
+{
+    private:
+
+        static constexpr size_t MAX_TRANSPORTS = 4;     ///< Number of transports messages can be fanned out to
+        static constexpr uint32_t NOTE_CAPACITY = 256;  ///< Notes that can wait for one transport (power of 2): every key of a full keyboard, on and off
+        static constexpr size_t CONTROL_SLOTS = 16;     ///< Distinct controllers that can wait for one transport at once
+
+        /// A value of one controller waiting for a transport
+        struct ControlSlot
+        {
+            MidiEvent event {};                    ///< The latest value, stamped with the time its controller started waiting
+            uint32_t sequence = 0;                 ///< Place of the controller among the messages of the lane
+            bool pending = false;                  ///< Is a value waiting?
+        };
+
+        /// The messages waiting for one transport, with their metrics
+        struct Lane
+        {
+            MidiTransport* transport = nullptr;
+
+            MidiEvent notes[NOTE_CAPACITY];        ///< Notes waiting, in order
+            uint32_t noteSequences[NOTE_CAPACITY]; ///< Place of each waiting note among the messages of the lane
+            uint32_t head = 0;                     ///< Count of notes taken by the transport
+            uint32_t tail = 0;                     ///< Count of notes queued
+
+            ControlSlot controls[CONTROL_SLOTS];   ///< Values of the waiting controllers
+            uint32_t nextSequence = 0;             ///< Place of the next message queued
+            uint32_t lastNoteSequence = UINT32_MAX; ///< Place of the last note queued (just before the first message when none)
+
+            uint32_t maxDepth = 0;                 ///< Largest number of messages that waited at once
+            uint32_t dropped = 0;                  ///< Messages lost to a full lane or an inactive transport. Notes should never be
+            uint32_t merged = 0;                   ///< Controller values replaced by a newer value before being sent
+            uint32_t delivered = 0;                ///< Messages taken by the transport since the statistics were reset
+            unsigned long latencyTotal = 0;        ///< Sum of the encode-to-take times of those messages, in microseconds
+            unsigned long latencyMax = 0;          ///< Longest encode-to-take time, in microseconds
+        };
+
+        Lane mLanes[MAX_TRANSPORTS];               ///< One queue per transport, in the order they were added
+        size_t mTransportCount = 0;                ///< Number of transports added
+
+        void Route(const uint8_t status, const uint8_t data1, const uint8_t data2);
+        void QueueNote(Lane& lane, const MidiEvent& event);
+        void QueueControl(Lane& lane, const MidiEvent& event);
+        uint32_t GetDepth(const Lane& lane) const;
+        void Drain(Lane& lane);
+
+    public:
+
+        MidiRouter() = default;
+
+        // ----------------------------------- Getters ---------------------------------
+        size_t GetTransportCount() const;
+        const char* GetTransportName(const size_t index) const;
+        uint32_t GetQueueDepth(const size_t index) const;
+        uint32_t GetMaxQueueDepth(const size_t index) const;
+        uint32_t GetDroppedCount(const size_t index) const;
+        uint32_t GetMergedCount(const size_t index) const;
+        unsigned long GetAverageLatency(const size_t index) const;
+        unsigned long GetMaxLatency(const size_t index) const;
+
+        // --------------------------------- Core Methods ------------------------------
+        bool AddTransport(MidiTransport* transport);
+        void NoteOn(const uint8_t note, const uint8_t velocity, const uint8_t channel);
+        void NoteOff(const uint8_t note, const uint8_t velocity, const uint8_t channel);
+        void ControlChange(const uint8_t control, const uint8_t value, const uint8_t channel);
+        void PitchBend(const int16_t value, const uint8_t channel);
+        void Service();
+        void ResetStatistics();
+
+        MidiRouter(const MidiRouter &) = delete;       ///< Copy constructor disabled
+        void operator=(const MidiRouter &) = delete;   ///< Assignment operator disabled
+};
+
+#endif // MIDI_ROUTER_H
@@ -0,0 +1,44 @@
+/**
+ * @file MidiTransport.h
+ * @author Mate Narh
+ *
+ * Interface shared by the MIDI outputs of the masters (USB, BLE, DIN/TRS), so
+ * that a MidiRouter can fan each message out to all of them. A message is
+ * encoded once, as a MidiEvent, and each transport only adds its own framing
+ */
+
+#ifndef MIDI_TRANSPORT_H
+#define MIDI_TRANSPORT_H
+
+#include <stdint.h>
+
+/// A MIDI channel message, encoded once for every transport
+struct MidiEvent
+{
+    uint8_t status;       ///< Status byte (0x80 - 0xEF): message type and channel
+    uint8_t data1;        ///< First data byte (note, controller, ...)
+    uint8_t data2;        ///< Second data byte (velocity, value, ...). Unused by 1-byte messages
+    uint8_t reserved;
+    uint32_t timestamp;   ///< Master time at which the message was encoded, in microseconds
+};
+
+class MidiTransport
+{
+    public:
+
+        virtual ~MidiTransport() = default;
+
+        /// Short name of the transport, for logs
+        virtual const char* GetName() const = 0;
+
+        /// Can the transport deliver messages right now (eg. is a host connected)?
+        virtual bool IsActive() const = 0;
+
+        /// Take a message. Returns false, without keeping it, if the transport has no room for it yet
+        virtual bool Send(const MidiEvent& event) = 0;
+
+        /// Move the messages taken so far towards the wire. Called once per pass of the main loop
+        virtual void Service() = 0;
+};
+
+#endif // MIDI_TRANSPORT_H
@@ -0,0 +1,161 @@
+/**
+ * @file OneEuroFilter.cpp
+ * @author Mate Narh
+ */
+
+#include "OneEuroFilter.h"
+
+static constexpr int64_t Q16_ONE = 1 << 16;              ///< 1.0 as a Q16 smoothing factor
+static constexpr int64_t TWO_PI_Q16 = 411775;            ///< 2π in Q16
+static constexpr int FRACTION_BITS = 8;                  ///< Fractional bits kept on the value and speed
+static constexpr uint32_t MAX_CUTOFF = 1000000;          ///< Highest cutoff frequency used, in millihertz (1 kHz)
+static constexpr uint32_t MAX_PERIOD = 1000000;          ///< Longest sample period used, in microseconds
+static constexpr int64_t MAX_SPEED = INT32_MAX;          ///< Largest speed estimate kept, so that it fits its 32 bits
+
+/**
+ * @brief Constructor
+ * @param minCutoff The cutoff frequency at rest, in millihertz. Lower values remove more jitter
+ * @param beta The cutoff increase per unit of speed, in microhertz per count/s. Higher values remove more lag
+ * @param derivativeCutoff The cutoff frequency of the speed estimate, in millihertz
+ */
+OneEuroFilter::OneEuroFilter(const uint32_t minCutoff, const uint32_t beta, const uint32_t derivativeCutoff)
+    : mMinCutoff(minCutoff), mBeta(beta), mDerivativeCutoff(derivativeCutoff)
+{
+}
+
+/**
+ * @brief Set the cutoff frequency at rest
+ * @param minCutoff The cutoff, in millihertz
+ */
+void OneEuroFilter::SetMinCutoff(const uint32_t minCutoff)
+{
+    mMinCutoff = minCutoff;
+}
+
+/**
+ * @brief Set how fast the cutoff frequency rises with the speed of the signal
+ * @param beta The cutoff increase, in microhertz per count/s
+ */
+void OneEuroFilter::SetBeta(const uint32_t beta)
+{
+    mBeta = beta;
+}
+
+/**
+ * @brief Set the cutoff frequency of the speed estimate
+ * @param derivativeCutoff The cutoff, in millihertz
+ */
+void OneEuroFilter::SetDerivativeCutoff(const uint32_t derivativeCutoff)
+{
+    mDerivativeCutoff = derivativeCutoff;
+}
+
+/**
+ * @brief Get the cutoff frequency at rest, in millihertz
+ */
+uint32_t OneEuroFilter::GetMinCutoff() const
+{
+    return mMinCutoff;
+}
+
+/**
+ * @brief Get the cutoff increase per unit of speed, in microhertz per count/s
+ */
+uint32_t OneEuroFilter::GetBeta() const
+{
+    return mBeta;
+}
+
+/**
+ * @brief Get the cutoff frequency of the speed estimate, in millihertz
+ */
+uint32_t OneEuroFilter::GetDerivativeCutoff() const
+{
+    return mDerivativeCutoff;
+}
+
+/**
+ * @brief Get the cutoff frequency for the current speed of the signal, in millihertz
+ */
+uint32_t OneEuroFilter::GetCutoff() const
+{
+    uint32_t speed = static_cast<uint32_t>((mSpeed < 0 ? -mSpeed : mSpeed) >> FRACTION_BITS);
+    uint64_t cutoff = mMinCutoff + static_cast<uint64_t>(mBeta) * speed / 1000;
+
+    return (cutoff > MAX_CUTOFF) ? MAX_CUTOFF : static_cast<uint32_t>(cutoff);
+}
+
+/**
+ * @brief Filter a new sample
+ * @param value The raw sample
+ * @param timestamp The time at which the sample was taken, in microseconds
+ * @return The filtered value
+ */
+int OneEuroFilter::Filter(const int value, const uint32_t timestamp)
+{
+    int32_t sample = value * (1 << FRACTION_BITS);
+
+    if (!mInitialized)
+    {
+        mInitialized = true;
+        mValue = sample;
+        mSpeed = 0;
+        mLastTimestamp = timestamp;
+        return value;
+    }
+
+    uint32_t period = timestamp - mLastTimestamp;
+
+    //
+    // Two samples at the same time carry no speed. After a long gap, the
+    // period is capped so that the filter simply catches up with the sample
+    //
+    if (period == 0)
+    {
+        return (mValue + (1 << (FRACTION_BITS - 1))) >> FRACTION_BITS;
+    }
+    if (period > MAX_PERIOD)
+    {
+        period = MAX_PERIOD;
+    }
+    mLastTimestamp = timestamp;
+
+    //
+    // Smooth the speed first, since it sets the cutoff for the value
+    //
+    int64_t speed = static_cast<int64_t>(sample - mValue) * 1000000 / period;
+
+    speed = (speed > MAX_SPEED) ? MAX_SPEED : (speed < -MAX_SPEED) ? -MAX_SPEED : speed;
+    mSpeed += static_cast<int32_t>(((speed - mSpeed) * SmoothingFactor(mDerivativeCutoff, period)) >> 16);
+
+    mValue += static_cast<int32_t>((static_cast<int64_t>(sample - mValue) * SmoothingFactor(GetCutoff(), period)) >> 16);
+
+    return (mValue + (1 << (FRACTION_BITS - 1))) >> FRACTION_BITS;
+}
+
+/**
+ * @brief Forget the filtered value, so that the next sample is taken as is
+ */
+void OneEuroFilter::Reset()
+{
+    mInitialized = false;
+    mValue = 0;
+    mSpeed = 0;
+}
+
+/**
+ * @brief Get the smoothing factor of one step of an EMA with the given cutoff
+ * @param cutoff The cutoff frequency, in millihertz
+ * @param period The time since the previous sample, in microseconds
+ * @return The smoothing factor, in Q16 (65536 = take the sample as is)
+ */
+int32_t OneEuroFilter::SmoothingFactor(const uint32_t cutoff, const uint32_t period)
+{
+    //
+    // r = 2π * fc * Te, with fc in mHz and Te in us, ie. scaled by 10^9
+    //
+    int64_t r = TWO_PI_Q16 * cutoff * period / 1000000000;
+    int64_t alpha = (r << 16) / (r + Q16_ONE);
+
+    return static_cast<int32_t>((alpha < 1) ? 1 : alpha);
+}
@@ -0,0 +1,69 @@
+/**
+ * @file OneEuroFilter.h
+ * @author Mate Narh
+ *
+ * This class implements an adaptive low-pass filter of the One-Euro type
+ * (Casiez, Roussel & Vogel, CHI 2012). It is an EMA whose cutoff frequency
+ * follows the speed of the signal:
+ *
+ *     fc = minCutoff + beta * |dx/dt|
+ *
+ * where dx/dt is itself smoothed by an EMA with a fixed cutoff. A control at
+ * rest gets a low cutoff, which removes jitter, and a control moving fast gets
+ * a high cutoff, which removes lag. The smoothing factor of each step comes
+ * from its cutoff and the time since the previous sample:
+ *
+ *     α = r / (r + 1), with r = 2π * fc * Te
+ *
+ * Everything is computed in fixed point (Q16 smoothing factors, values kept
+ * with 8 fractional bits), so the filter costs no float operations. The class
+ * only depends on the C++ standard headers, so it can be built and exercised
+ * on a host
+ */
+
+#ifndef ONE_EURO_FILTER_H
+#define ONE_EURO_FILTER_H
+
+#include <stdint.h>
+
+class OneEuroFilter
+{
+    private:
+
+        uint32_t mMinCutoff = 1000;         ///< Cutoff frequency at rest, in millihertz
+        uint32_t mBeta = 2000;              ///< Cutoff increase per unit of speed, in microhertz per count/s
+        uint32_t mDerivativeCutoff = 1000;  ///< Cutoff frequency of the speed estimate, in millihertz
+
+        bool mInitialized = false;          ///< Has a first sample been taken?
+        int32_t mValue = 0;                 ///< The filtered value, with 8 fractional bits
+        int32_t mSpeed = 0;                 ///< The filtered speed, in counts/s with 8 fractional bits
+        uint32_t mLastTimestamp = 0;        ///< Time of the previous sample, in microseconds
+
+        static int32_t SmoothingFactor(const uint32_t cutoff, const uint32_t period);
+
+    public:
+
+        OneEuroFilter(const uint32_t minCutoff, const uint32_t beta, const uint32_t derivativeCutoff);
+
+        // ----------------------------------- Setters ------------------------------------
+        void SetMinCutoff(const uint32_t minCutoff);
+        void SetBeta(const uint32_t beta);
+        void SetDerivativeCutoff(const uint32_t derivativeCutoff);
+
+        // ----------------------------------- Getters ------------------------------------
+        uint32_t GetMinCutoff() const;
+        uint32_t GetBeta() const;
+        uint32_t GetDerivativeCutoff() const;
+        uint32_t GetCutoff() const;
+
+        // --------------------------------- Core Methods ---------------------------------
+        int Filter(const int value, const uint32_t timestamp);
+        void Reset();
+
+
+        OneEuroFilter() = delete;                        ///< Default constructor disabled
+        OneEuroFilter(const OneEuroFilter &) = delete;   ///< Copy constructor disabled
+        void operator=(const OneEuroFilter &) = delete;  ///< Assignment operator disabled
+};
+
+#endif // ONE_EURO_FILTER_H
@@ -0,0 +1,412 @@
+/**
+ * @file Protocol.h
+ * @author Mate Narh
+ *
+ * Header file consolidating the constants that the master and its slaves must
+ * agree on to communicate over SPI. Both firmware projects pull this library in
+ * through `lib_extra_dirs` so that the two sides of the link can never drift apart
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ------------------------------- Frame Layout -------------------------------
+//
+// Every frame a slave clocks out to the master starts with a header byte. The
+// slave only sets it once its keys and SPI are up, which is how it announces
+// that it is ready to be polled. The sequence number that follows changes with
+// every frame the slave queues, so a frame clocked out twice is only used once.
+// The acknowledgement echoes the ID of the last link command the slave applied
+// --------------------------------------------------------------------------------------------
+// | HEADER | SEQUENCE | ACK | EVENT COUNT | SYNC MASTER TIME | SYNC SLAVE TIME | EVENTS ... |
+// --------------------------------------------------------------------------------------------
+//
+// The sync times pair the master time stamped on an earlier poll with the slave
+// time at which that poll completed, from which the master works out the offset
+// between the two clocks. Each event that follows is laid out as
+// ---------------------------------------------------------------
+// |  KEY  |  STATUS  |  VELOCITY  |  -  |  TIMESTAMP (slave, us)  |
+// ---------------------------------------------------------------
+//
+// All multi-byte fields are little endian
+//
+#define FRAME_READY               0xA7 // Header of a frame holding key updates
+#define FRAME_SEQUENCE_INDEX      1    // Position of the sequence number in a frame
+#define FRAME_ACK_INDEX           2    // Position of the last applied command ID in a frame
+#define FRAME_EVENT_COUNT_INDEX   3    // Position of the number of events in a frame
+#define FRAME_SYNC_MASTER_INDEX   4    // Position of the master time echoed for clock sync
+#define FRAME_SYNC_SLAVE_INDEX    8    // Position of the slave time paired with the echoed master time
+#define FRAME_HEADER_SIZE         12   // Number of bytes ahead of the events
+
+#define FRAME_EVENT_SIZE          8    // Number of bytes taken up by an event
+#define FRAME_MAX_EVENTS          8    // Maximum number of events carried by a frame
+
+/// Size of a frame, and of the buffers on both sides of the link (a multiple of 4 for DMA)
+#define FRAME_SIZE (FRAME_HEADER_SIZE + FRAME_MAX_EVENTS * FRAME_EVENT_SIZE)
+
+/// A key update as reported by a slave
+struct KeyEvent
+{
+    uint8_t key;         ///< Index of the key on the slave that reported it
+    uint8_t status;      ///< NOTE_ON/NOTE_OFF
+    uint8_t velocity;    ///< Velocity of the note (0 - 127)
+    uint32_t timestamp;  ///< Time at which the key was scanned, in microseconds
+};
+
+/**
+ * @brief Write a 32-bit value into a buffer, little endian
+ * @param buffer The position in the buffer to write to
+ * @param value The value to write
+ */
+static inline void WriteUint32(uint8_t* buffer, const uint32_t value)
+{
+    for (size_t i = 0; i < 4; i++)
+    {
+        buffer[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+/**
+ * @brief Read a 32-bit value from a buffer, little endian
+ * @param buffer The position in the buffer to read from
+ * @return The value read
+ */
+static inline uint32_t ReadUint32(const uint8_t* buffer)
+{
+    uint32_t value = 0;
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        value |= static_cast<uint32_t>(buffer[i]) << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * @brief Write an event into the given slot of a frame
+ * @param frame The frame to write to
+ * @param slot The slot of the event within the frame (0 - FRAME_MAX_EVENTS)
+ * @param event The event to write
+ */
+static inline void EncodeEvent(uint8_t* frame, const size_t slot, const KeyEvent& event)
+{
+    uint8_t* position = frame + FRAME_HEADER_SIZE + slot * FRAME_EVENT_SIZE;
+
+    position[0] = event.key;
+    position[1] = event.status;
+    position[2] = event.velocity;
+    position[3] = 0;
+    WriteUint32(position + 4, event.timestamp);
+}
+
+/**
+ * @brief Read the event in the given slot of a frame
+ * @param frame The frame to read from
+ * @param slot The slot of the event within the frame (0 - FRAME_MAX_EVENTS)
+ * @return The event read
+ */
+static inline KeyEvent DecodeEvent(const uint8_t* frame, const size_t slot)
+{
+    const uint8_t* position = frame + FRAME_HEADER_SIZE + slot * FRAME_EVENT_SIZE;
+
+    KeyEvent event;
+    event.key = position[0];
+    event.status = position[1];
+    event.velocity = position[2];
+    event.timestamp = ReadUint32(position + 4);
+
+    return event;
+}
+
+// ------------------------------ Link Commands -------------------------------
+//
+// The master places a command at the start of its transmit buffer (MOSI) on
+// every poll, so commands ride along with the key updates flowing the other way
+// ---------------------------------------------------------------------------------
+// |  COMMAND  |  ID  |  TARGET  |  VALUE (4 bytes)  |  -  |  MASTER TIME (4 bytes)  |
+// ---------------------------------------------------------------------------------
+//
+// The master time is stamped on every poll, just before the transfer starts,
+// and is echoed back with the slave time at which the transfer completed.
+// A slave applies a command once the transaction carrying it has completed,
+// which is always between two key scans, so its response shows up in a later
+// frame. The master keeps resending a command until a frame acknowledges its
+// ID, and the slave ignores an ID it has already applied. IDs run from 1 to 255,
+// and every master session numbers them from 1 again, so the slave forgets the
+// last ID it applied on the command that starts a session: CMD_TRAIN_BEGIN over
+// SPI and CMD_DESCRIBE over UART
+//
+#define CMD_NONE           0x00 // No command. Regular poll for key updates
+#define CMD_TRAIN_BEGIN    0xC1 // Slave serves the training pattern until told otherwise
+#define CMD_TRAIN_END      0xC2 // Slave resumes serving key updates
+#define CMD_DESCRIBE       0xC3 // Slave serves its descriptor until training begins (pushed once over UART)
+#define CMD_SET_THRESHOLD  0xD1 // Target: key index | Value: NOTE ON threshold (0 - 127)
+#define CMD_SET_FILTER     0xD2 // Target: key index | Value: EMA smoothing factor in Q16 (65536 = 1.0)
+#define CMD_SET_SCAN_RATE  0xD3 // Target: unused    | Value: key scans per second (0 = as fast as possible)
+#define CMD_TEST_PATTERN   0xD4 // Target: unused    | Value: 1 to play synthetic notes instead of scanning, 0 to stop
+#define CMD_TIME_SYNC      0xD5 // Target: unused    | Value: unused. Restarts clock synchronization
+
+#define CMD_ID_INDEX       1    // Position of the command ID in the transmit buffer
+#define CMD_TARGET_INDEX   2    // Position of the target in the transmit buffer
+#define CMD_VALUE_INDEX    3    // Position of the value in the transmit buffer
+#define CMD_SIZE           7    // Number of bytes taken up by a command
+#define CMD_SYNC_INDEX     8    // Position of the master time in the transmit buffer
+
+#define CMD_ALL_KEYS       0xFF // Target every key of the slave
+
+/**
+ * @brief Write a link command to the start of the given transmit buffer
+ * @param buffer The transmit buffer to write to (at least CMD_SIZE bytes)
+ * @param command The link command
+ * @param id The ID the slave acknowledges the command with
+ * @param target The key the command applies to, if any
+ * @param value The argument of the command
+ */
+static inline void EncodeCommand(uint8_t* buffer, const uint8_t command, const uint8_t id, const uint8_t target, const uint32_t value)
+{
+    buffer[0] = command;
+    buffer[CMD_ID_INDEX] = id;
+    buffer[CMD_TARGET_INDEX] = target;
+    WriteUint32(buffer + CMD_VALUE_INDEX, value);
+}
+
+/**
+ * @brief Read the value of the link command at the start of the given receive buffer
+ * @param buffer The receive buffer holding the command
+ * @return The argument of the command
+ */
+static inline uint32_t DecodeCommandValue(const uint8_t* buffer)
+{
+    return ReadUint32(buffer + CMD_VALUE_INDEX);
+}
+
+// ------------------------------ Slave Descriptor -----------------------------
+//
+// Asked for by the master when the link comes up, so that it never has to be
+// told how each slave was flashed. The descriptor is served in place of a frame
+// ---------------------------------------------------------------------------------------------------------
+// | HEADER | VERSION | KEY COUNT | START NOTE | SENSOR TYPE | MAX EVENTS | FRAME SIZE (2) | MAX SCAN RATE (4) |
+// ---------------------------------------------------------------------------------------------------------
+//
+// A slave that does not know CMD_DESCRIBE never serves one, and the master falls
+// back to the key count and notes it was built with
+//
+#define PROTOCOL_VERSION            1    // Version of the frame format described in this file
+
+#define FRAME_DESCRIPTOR            0xA8 // Header of a descriptor
+#define DESCRIPTOR_VERSION_INDEX    1
+#define DESCRIPTOR_KEY_COUNT_INDEX  2
+#define DESCRIPTOR_START_NOTE_INDEX 3
+#define DESCRIPTOR_SENSOR_INDEX     4
+#define DESCRIPTOR_MAX_EVENTS_INDEX 5
+#define DESCRIPTOR_FRAME_SIZE_INDEX 6
+#define DESCRIPTOR_SCAN_RATE_INDEX  8
+#define DESCRIPTOR_SIZE             12   // Number of bytes taken up by a descriptor
+
+#define SENSOR_PIEZO_HALL_DAMPER    0x01 // Piezo disc per key with a hall effect damper sensor
+
+/// The capabilities of a slave, as reported at link-up
+struct SlaveDescriptor
+{
+    uint8_t version;       ///< PROTOCOL_VERSION the slave was built with
+    uint8_t keyCount;      ///< Number of keys scanned by the slave
+    uint8_t startNote;     ///< MIDI note of the first key. The others follow chromatically
+    uint8_t sensorType;    ///< How the keys are sensed (SENSOR_*)
+    uint8_t maxEvents;     ///< Number of events that fit in one of the slave's frames
+    uint16_t frameSize;    ///< Size of the slave's frames, and of the buffers to exchange them
+    uint32_t maxScanRate;  ///< Key scans per second when free running (0 = not measured yet)
+};
+
+/**
+ * @brief Write a descriptor to the start of a buffer
+ * @param buffer The buffer to write to (at least DESCRIPTOR_SIZE bytes)
+ * @param descriptor The descriptor to write
+ */
+static inline void EncodeDescriptor(uint8_t* buffer, const SlaveDescriptor& descriptor)
+{
+    buffer[0] = FRAME_DESCRIPTOR;
+    buffer[DESCRIPTOR_VERSION_INDEX] = descriptor.version;
+    buffer[DESCRIPTOR_KEY_COUNT_INDEX] = descriptor.keyCount;
+    buffer[DESCRIPTOR_START_NOTE_INDEX] = descriptor.startNote;
+    buffer[DESCRIPTOR_SENSOR_INDEX] = descriptor.sensorType;
+    buffer[DESCRIPTOR_MAX_EVENTS_INDEX] = descriptor.maxEvents;
+    buffer[DESCRIPTOR_FRAME_SIZE_INDEX] = static_cast<uint8_t>(descriptor.frameSize);
+    buffer[DESCRIPTOR_FRAME_SIZE_INDEX + 1] = static_cast<uint8_t>(descriptor.frameSize >> 8);
+    WriteUint32(buffer + DESCRIPTOR_SCAN_RATE_INDEX, descriptor.maxScanRate);
+}
+
+/**
+ * @brief Read the descriptor at the start of a buffer
+ * @param buffer The buffer to read from, starting with FRAME_DESCRIPTOR
+ * @return The descriptor read
+ */
+static inline SlaveDescriptor DecodeDescriptor(const uint8_t* buffer)
+{
+    SlaveDescriptor descriptor;
+    descriptor.version = buffer[DESCRIPTOR_VERSION_INDEX];
+    descriptor.keyCount = buffer[DESCRIPTOR_KEY_COUNT_INDEX];
+    descriptor.startNote = buffer[DESCRIPTOR_START_NOTE_INDEX];
+    descriptor.sensorType = buffer[DESCRIPTOR_SENSOR_INDEX];
+    descriptor.maxEvents = buffer[DESCRIPTOR_MAX_EVENTS_INDEX];
+    descriptor.frameSize = buffer[DESCRIPTOR_FRAME_SIZE_INDEX] | (buffer[DESCRIPTOR_FRAME_SIZE_INDEX + 1] << 8);
+    descriptor.maxScanRate = ReadUint32(buffer + DESCRIPTOR_SCAN_RATE_INDEX);
+
+    return descriptor;
+}
+
+// ------------------------------ Clock Training ------------------------------
+
+/**
+ * @brief Get the byte expected at the given position of a training frame
+ *
+ * The pattern mixes isolated bits, runs and alternating bits so that a clock
+ * too fast for the traces between master and slave corrupts at least one byte
+ * of the frame
+ * @param index The position of the byte in the training frame
+ * @return The expected training byte at the given position
+ */
+static inline uint8_t TrainingPatternByte(const size_t index)
+{
+    static const uint8_t pattern[] {0x55, 0xAA, 0x0F, 0xF0, 0x01, 0x80, 0xFE, 0x7F};
+    return static_cast<uint8_t>(pattern[index % sizeof(pattern)] ^ (index / sizeof(pattern)));
+}
+
+/**
+ * @brief Fill the given buffer with the training pattern
+ * @param buffer The buffer to fill
+ * @param size The size of the buffer
+ */
+static inline void FillTrainingPattern(uint8_t* buffer, const size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        buffer[i] = TrainingPatternByte(i);
+    }
+}
+
+/**
+ * @brief Check whether the given buffer holds an uncorrupted training pattern
+ * @param buffer The buffer to check
+ * @param size The size of the buffer
+ * @return True if every byte of the buffer matches the training pattern and false otherwise
+ */
+static inline bool IsTrainingPattern(const uint8_t* buffer, const size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (buffer[i] != TrainingPatternByte(i))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// --------------------------------- UART Link --------------------------------
+//
+// Alternative to polling over SPI, selected with the LINK_UART build flag. Each
+// slave pushes its frames to the master over a UART as soon as it has events to
+// report, and the master pushes command frames back on the other wire. Only the
+// events actually queued are sent, so a frame is FRAME_HEADER_SIZE bytes plus
+// FRAME_EVENT_SIZE bytes per event, followed by a CRC-8. A command frame is the
+// command block of an SPI poll behind its own header, followed by a CRC-8
+// -----------------------------------------------------------------------------------------
+// |  UART_COMMAND_HEADER  |  COMMAND  |  ID  |  TARGET  |  VALUE  |  -  |  MASTER TIME  |  CRC  |
+// -----------------------------------------------------------------------------------------
+//
+// There is no chip select to delimit frames, so the receiver looks for a header,
+// works out the frame size and only accepts the frame if its CRC matches
+//
+#define UART_LINK_BAUD          5000000 // 5 Mbaud, 10 bits per byte on the wire
+#define UART_COMMAND_HEADER     0x5C    // Header of a command frame sent by the master
+#define UART_CRC_SIZE           1       // Number of bytes taken up by the CRC
+
+/// Size of a command frame sent over the UART link
+#define UART_COMMAND_FRAME_SIZE (1 + CMD_SYNC_INDEX + 4 + UART_CRC_SIZE)
+
+/// Largest frame a slave sends over the UART link
+#define UART_FRAME_MAX_SIZE     (FRAME_SIZE + UART_CRC_SIZE)
+
+/**
+ * @brief Get the size of a frame carrying the given number of events over the UART link
+ * @param eventCount The number of events in the frame
+ * @return The size of the frame, CRC included
+ */
+static inline size_t UartFrameSize(const size_t eventCount)
+{
+    return FRAME_HEADER_SIZE + eventCount * FRAME_EVENT_SIZE + UART_CRC_SIZE;
+}
+
+/**
+ * @brief Compute the CRC-8 (polynomial 0x07) of a buffer
+ * @param buffer The buffer to compute the CRC of
+ * @param size The size of the buffer
+ * @return The CRC of the buffer
+ */
+static inline uint8_t Crc8(const uint8_t* buffer, const size_t size)
+{
+    uint8_t crc = 0;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        crc ^= buffer[i];
+
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x07) : static_cast<uint8_t>(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Look for a complete frame at the start of a buffer of bytes received over the UART link
+ * @param buffer The received bytes
+ * @param length The number of received bytes
+ * @param header The header of the frames expected (FRAME_READY, FRAME_DESCRIPTOR or UART_COMMAND_HEADER)
+ * @return The size of the valid frame at the start of the buffer, 0 if more bytes are
+ *         needed to tell, or -1 if the first byte does not start a valid frame
+ */
+static inline int ParseUartFrame(const uint8_t* buffer, const size_t length, const uint8_t header)
+{
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    if (buffer[0] != header)
+    {
+        return -1;
+    }
+
+    size_t size = UART_COMMAND_FRAME_SIZE;
+
+    if (header == FRAME_DESCRIPTOR)
+    {
+        size = DESCRIPTOR_SIZE + UART_CRC_SIZE;
+    }
+    else if (header == FRAME_READY)
+    {
+        if (length <= FRAME_EVENT_COUNT_INDEX)
+        {
+            return 0;
+        }
+
+        if (buffer[FRAME_EVENT_COUNT_INDEX] > FRAME_MAX_EVENTS)
+        {
+            return -1;
+        }
+        size = UartFrameSize(buffer[FRAME_EVENT_COUNT_INDEX]);
+    }
+
+    if (length < size)
+    {
+        return 0;
+    }
+    return Crc8(buffer, size - UART_CRC_SIZE) == buffer[size - UART_CRC_SIZE] ? static_cast<int>(size) : -1;
+}
+
+#endif // PROTOCOL_H
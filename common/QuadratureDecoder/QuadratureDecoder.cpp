@@ -0,0 +1,81 @@
+/**
+ * @file QuadratureDecoder.cpp
+ * @author Mate Narh
+ */
+
+#include "QuadratureDecoder.h"
+
+static constexpr int8_t INVALID = 2;  // Both outputs changed: an edge was missed
+
+//
+// The step of every transition, indexed by (previous state << 2) | current
+// state, where a state is (A << 1) | B
+//
+static constexpr int8_t TRANSITIONS[16] = {
+//  to: 00       01       10       11          from:
+         0,      -1,      +1,      INVALID,    // 00
+        +1,       0,      INVALID, -1,         // 01
+        -1,      INVALID,  0,      +1,         // 10
+        INVALID, +1,      -1,       0          // 11
+};
+
+/**
+ * @brief Take the current state of the outputs without counting a step, eg. at startup
+ * @param a The level of output A (CLK)
+ * @param b The level of output B (DT)
+ */
+void QuadratureDecoder::SetState(const bool a, const bool b)
+{
+    mState = (a << 1) | b;
+}
+
+/**
+ * @brief Get the steps decoded since the last reset, positive clockwise
+ */
+int32_t QuadratureDecoder::GetCount() const
+{
+    return mCount;
+}
+
+/**
+ * @brief Get the number of transitions whose direction could not be told since the last reset
+ */
+uint32_t QuadratureDecoder::GetInvalidCount() const
+{
+    return mInvalidCount;
+}
+
+/**
+ * @brief Decode a new state of the outputs
+ *
+ * Call on every edge of either output (eg. from a pin change interrupt), or
+ * at least as often as the outputs can change when polling
+ * @param a The level of output A (CLK)
+ * @param b The level of output B (DT)
+ * @return The step taken: +1 clockwise, -1 counter-clockwise, 0 if none or invalid
+ */
+int8_t QuadratureDecoder::Decode(const bool a, const bool b)
+{
+    uint8_t state = (a << 1) | b;
+    int8_t step = TRANSITIONS[(mState << 2) | state];
+
+    mState = state;
+
+    if (step == INVALID)
+    {
+        mInvalidCount++;
+        return 0;
+    }
+
+    mCount += step;
+    return step;
+}
+
+/**
+ * @brief Clear the count and the invalid transitions, keeping the state of the outputs
+ */
+void QuadratureDecoder::Reset()
+{
+    mCount = 0;
+    mInvalidCount = 0;
+}
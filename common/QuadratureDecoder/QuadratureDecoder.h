@@ -0,0 +1,56 @@
+/**
+ * @file QuadratureDecoder.h
+ * @author Mate Narh
+ *
+ * This class decodes the two quadrature outputs of a rotary encoder (A = CLK,
+ * B = DT) into a signed count, one step per edge of either output (full, or
+ * 4x, quadrature). Each new state is looked up in a transition table indexed
+ * by the previous and the current state of the outputs:
+ *
+ *     Clockwise        : AB = 00 -> 10 -> 11 -> 01 -> 00   (+1 per edge)
+ *     Counter-clockwise: AB = 00 -> 01 -> 11 -> 10 -> 00   (-1 per edge)
+ *
+ * A transition where both outputs changed at once means an edge was missed.
+ * Its direction is unknown, so it is not counted but reported as invalid.
+ * Contact bounce on one output only toggles between two neighbouring states,
+ * so it cancels out instead of adding steps
+ *
+ * The decoder is the portable fallback of the rotary encoder when no hardware
+ * pulse counter is available. It only depends on the C++ standard headers, so
+ * it can be built and exercised on a host
+ */
+
+#ifndef QUADRATURE_DECODER_H
+#define QUADRATURE_DECODER_H
+
+#include <stdint.h>
+
+class QuadratureDecoder
+{
+    private:
+
+        uint8_t mState = 0;             ///< The last state of the outputs, as (A << 1) | B
+        int32_t mCount = 0;             ///< Steps decoded since the last reset, positive clockwise
+        uint32_t mInvalidCount = 0;     ///< Transitions whose direction could not be told since the last reset
+
+    public:
+
+        QuadratureDecoder() = default;
+
+        // ----------------------------------- Setters ------------------------------------
+        void SetState(const bool a, const bool b);
+
+        // ----------------------------------- Getters ------------------------------------
+        int32_t GetCount() const;
+        uint32_t GetInvalidCount() const;
+
+        // --------------------------------- Core Methods ---------------------------------
+        int8_t Decode(const bool a, const bool b);
+        void Reset();
+
+
+        QuadratureDecoder(const QuadratureDecoder &) = delete;   ///< Copy constructor disabled
+        void operator=(const QuadratureDecoder &) = delete;      ///< Assignment operator disabled
+};
+
+#endif // QUADRATURE_DECODER_H
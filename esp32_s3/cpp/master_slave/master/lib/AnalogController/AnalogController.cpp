@@ -0,0 +1,363 @@
+/**
+ * @file AnalogController.cpp
+ * @author Mate Narh
+ */
+
+#include "AnalogController.h"
+
+/**
+ * @brief Constructor
+ * @param router Where the MIDI messages of the controls are sent
+ * @param channel The MIDI channel of the messages (1 - 16)
+ * @param resolution The resolution the wheels expect their samples in, in bits
+ */
+AnalogController::AnalogController(MidiRouter& router, const uint8_t channel, const int resolution)
+    : mRouter(router), mChannel(channel), mResolution(resolution)
+{
+    for (size_t i = 0; i < MAX_CONTROLLERS; i++)
+    {
+        mChannelIndex[i] = -1;
+    }
+}
+
+/**
+ * @brief Get the number of controls in the controller table
+ */
+size_t AnalogController::GetControllerCount() const
+{
+    return mControllerCount;
+}
+
+/**
+ * @brief Get the wheel that filters and maps a control
+ * @param index The index of the control, in the order they were added
+ */
+Wheel* AnalogController::GetWheel(const size_t index) const
+{
+    return (index < mControllerCount) ? mControllers[index].wheel : nullptr;
+}
+
+/**
+ * @brief Returns whether the controls are sampled by the ADC continuous-mode scan
+ */
+bool AnalogController::IsScanning() const
+{
+    return mStarted;
+}
+
+/**
+ * @brief Get the number of samples gathered since the statistics were reset
+ */
+uint32_t AnalogController::GetSampleCount() const
+{
+    return mSamples;
+}
+
+/**
+ * @brief Get the average time of a pass of Update(), in microseconds
+ */
+unsigned long AnalogController::GetAverageUpdateTime() const
+{
+    return (mUpdates == 0) ? 0 : mUpdateTimeTotal / mUpdates;
+}
+
+/**
+ * @brief Get the longest time of a pass of Update(), in microseconds
+ */
+unsigned long AnalogController::GetMaxUpdateTime() const
+{
+    return mUpdateTimeMax;
+}
+
+/**
+ * @brief Add a row to the controller table. Must be called before Begin()
+ *
+ * The control's stored calibration is loaded here. On the first boot, it is
+ * calibrated instead, while its pin can still be read one-shot
+ * @param route The control and the MIDI message it drives
+ * @return The wheel that filters and maps the control, or nullptr if it cannot be scanned
+ */
+Wheel* AnalogController::AddController(const Route& route)
+{
+    adc_unit_t unit {};
+    adc_channel_t channel {};
+
+    if (mStarted || mControllerCount == MAX_CONTROLLERS ||
+        adc_continuous_io_to_channel(route.pin, &unit, &channel) != ESP_OK || unit != ADC_UNIT_1 ||
+        mChannelIndex[channel] >= 0)
+    {
+        Serial.print("Analog controller cannot scan pin "); Serial.println(route.pin);
+        return nullptr;
+    }
+
+    Controller& controller = mControllers[mControllerCount];
+    controller.wheel = new Wheel(route.pin, mResolution, route.rangeMin, route.rangeMax);
+    controller.wheel->SetCentered(route.centered);
+    controller.wheel->SetHighResolution(route.destination == DESTINATION_CC_14BIT);
+    controller.channel = channel;
+    controller.destination = route.destination;
+    controller.number = route.number;
+
+    mChannelIndex[channel] = mControllerCount++;
+    return controller.wheel;
+}
+
+/**
+ * @brief Smooth a control with a hardware IIR filter of the ADC instead of in software. Must be called before Begin()
+ *
+ * The filter computes out = ((k - 1) * out + in) / k on every conversion of
+ * the channel, ie. an EMA with a smoothing factor of 1/k at the scan rate of
+ * the channel. Only two channels can be filtered
+ * @param index The index of the control, in the order they were added
+ * @param coefficient k: 2, 4, 8, 16 or 64. 0 smooths the control in software again
+ * @return True if the filter will be used and false otherwise
+ */
+bool AnalogController::SetHardwareFilter(const size_t index, const uint8_t coefficient)
+{
+    size_t filterCount = 0;
+
+    for (size_t i = 0; i < mControllerCount; i++)
+    {
+        filterCount += (i != index && mControllers[i].hardwareCoefficient != 0);
+    }
+
+    if (mStarted || index >= mControllerCount || (coefficient != 0 && filterCount == MAX_HARDWARE_FILTERS))
+    {
+        return false;
+    }
+
+    switch (coefficient)
+    {
+        case 0: case 2: case 4: case 8: case 16: case 64:
+            mControllers[index].hardwareCoefficient = coefficient;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Start the ADC continuous-mode scan over the channels of every control
+ * @param sampleRate The conversions per second, shared by all the channels
+ * @return True if the scan is running and false if the controls are read one-shot
+ */
+bool AnalogController::Begin(const uint32_t sampleRate)
+{
+    if (mControllerCount == 0)
+    {
+        return false;
+    }
+
+    adc_continuous_handle_cfg_t handleConfig = {};
+    handleConfig.max_store_buf_size = CONVERSION_POOL_SIZE;
+    handleConfig.conv_frame_size = CONVERSION_FRAME_SIZE;
+
+    adc_digi_pattern_config_t pattern[MAX_CONTROLLERS] = {};
+
+    for (size_t i = 0; i < mControllerCount; i++)
+    {
+        pattern[i].atten = ADC_ATTEN_DB_12;
+        pattern[i].channel = mControllers[i].channel;
+        pattern[i].unit = ADC_UNIT_1;
+        pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    }
+
+    adc_continuous_config_t config = {};
+    config.pattern_num = mControllerCount;
+    config.adc_pattern = pattern;
+    config.sample_freq_hz = constrain(sampleRate, SOC_ADC_SAMPLE_FREQ_THRES_LOW, SOC_ADC_SAMPLE_FREQ_THRES_HIGH);
+    config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+
+    mStarted = adc_continuous_new_handle(&handleConfig, &mHandle) == ESP_OK &&
+               adc_continuous_config(mHandle, &config) == ESP_OK;
+
+    if (mStarted)
+    {
+        EnableHardwareFilters();
+        mStarted = adc_continuous_start(mHandle) == ESP_OK;
+    }
+
+    if (!mStarted)
+    {
+        Serial.println("ADC continuous scan failed to start. Reading controls one-shot");
+    }
+    return mStarted;
+}
+
+/**
+ * @brief Gather the new samples of every control, filter them and send the readings that changed
+ *
+ * Never waits for the ADC. Call once per pass of the main loop
+ */
+void AnalogController::Update()
+{
+    unsigned long start = micros();
+
+    if (mStarted)
+    {
+        DrainScan();
+    }
+    else
+    {
+        ReadOneShot();
+    }
+
+    //
+    // Filter the controls as one batch: each gets the average of its samples
+    // since the last pass, stamped with this pass's time
+    //
+    uint32_t now = micros();
+
+    for (size_t i = 0; i < mControllerCount; i++)
+    {
+        Controller& controller = mControllers[i];
+
+        if (controller.sampleCount == 0)
+        {
+            continue;
+        }
+
+        controller.wheel->Update(controller.sampleTotal / controller.sampleCount, now);
+        controller.sampleTotal = 0;
+        controller.sampleCount = 0;
+
+        Send(controller);
+    }
+
+    unsigned long elapsed = micros() - start;
+
+    mUpdateTimeTotal += elapsed;
+    mUpdateTimeMax = max(mUpdateTimeMax, elapsed);
+    mUpdates++;
+}
+
+/**
+ * @brief Clear the pass time and sample statistics
+ */
+void AnalogController::ResetStatistics()
+{
+    mUpdates = 0;
+    mSamples = 0;
+    mUpdateTimeTotal = 0;
+    mUpdateTimeMax = 0;
+}
+
+/**
+ * @brief Set up the hardware IIR filters of the controls that asked for one
+ *
+ * A control whose filter cannot be set up keeps smoothing in software
+ */
+void AnalogController::EnableHardwareFilters()
+{
+    for (size_t i = 0; i < mControllerCount; i++)
+    {
+        Controller& controller = mControllers[i];
+
+        if (controller.hardwareCoefficient == 0)
+        {
+            continue;
+        }
+
+        adc_continuous_iir_filter_config_t filterConfig = {};
+        filterConfig.unit = ADC_UNIT_1;
+        filterConfig.channel = controller.channel;
+        filterConfig.coeff = (controller.hardwareCoefficient == 2)  ? ADC_DIGI_IIR_FILTER_COEFF_2 :
+                             (controller.hardwareCoefficient == 4)  ? ADC_DIGI_IIR_FILTER_COEFF_4 :
+                             (controller.hardwareCoefficient == 8)  ? ADC_DIGI_IIR_FILTER_COEFF_8 :
+                             (controller.hardwareCoefficient == 16) ? ADC_DIGI_IIR_FILTER_COEFF_16 : ADC_DIGI_IIR_FILTER_COEFF_64;
+
+        if (adc_new_continuous_iir_filter(mHandle, &filterConfig, &controller.hardwareFilter) == ESP_OK &&
+            adc_continuous_iir_filter_enable(controller.hardwareFilter) == ESP_OK)
+        {
+            controller.wheel->SetFilterType(Wheel::FILTER_NONE);
+        }
+        else
+        {
+            Serial.print("ADC IIR filter unavailable for pin "); Serial.println(controller.wheel->GetPin());
+        }
+    }
+}
+
+/**
+ * @brief Sort the conversion results waiting in the driver's pool to their controls
+ */
+void AnalogController::DrainScan()
+{
+    const int shift = SOC_ADC_DIGI_MAX_BITWIDTH - mResolution;
+    uint32_t length = 0;
+
+    //
+    // The pool only holds CONVERSION_POOL_SIZE bytes, so this loop is bounded
+    // however long the last pass took
+    //
+    while (adc_continuous_read(mHandle, mFrame, CONVERSION_FRAME_SIZE, &length, 0) == ESP_OK)
+    {
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES)
+        {
+            const adc_digi_output_data_t* result = reinterpret_cast<const adc_digi_output_data_t*>(&mFrame[i]);
+            uint32_t channel = result->type2.channel;
+
+            if (channel >= MAX_CONTROLLERS || mChannelIndex[channel] < 0)
+            {
+                continue;
+            }
+
+            Controller& controller = mControllers[mChannelIndex[channel]];
+            controller.sampleTotal += (shift >= 0) ? (result->type2.data >> shift) : (result->type2.data << -shift);
+            controller.sampleCount++;
+            mSamples++;
+        }
+    }
+}
+
+/**
+ * @brief Read every control once with analogRead(), when the scan is not running
+ */
+void AnalogController::ReadOneShot()
+{
+    for (size_t i = 0; i < mControllerCount; i++)
+    {
+        mControllers[i].sampleTotal = analogRead(mControllers[i].wheel->GetPin());
+        mControllers[i].sampleCount = 1;
+        mSamples++;
+    }
+}
+
+/**
+ * @brief Send the MIDI message a control is routed to, if its reading changed
+ * @param controller The control
+ */
+void AnalogController::Send(const Controller& controller)
+{
+    const Wheel* wheel = controller.wheel;
+
+    switch (controller.destination)
+    {
+        case DESTINATION_PITCH_BEND:
+            if (wheel->IsReadingChanged())
+            {
+                mRouter.PitchBend(wheel->GetReading(), mChannel);
+            }
+            break;
+
+        case DESTINATION_CC_14BIT:
+            if (wheel->IsMsbChanged())
+            {
+                mRouter.ControlChange(controller.number, wheel->GetMsb(), mChannel);
+            }
+            if (wheel->IsLsbChanged())
+            {
+                mRouter.ControlChange(controller.number + 32, wheel->GetLsb(), mChannel);
+            }
+            break;
+
+        default:
+            if (wheel->IsReadingChanged())
+            {
+                mRouter.ControlChange(controller.number, static_cast<uint8_t>(wheel->GetReading()), mChannel);
+            }
+            break;
+    }
+}
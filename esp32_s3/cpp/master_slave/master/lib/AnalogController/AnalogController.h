@@ -0,0 +1,118 @@
+/**
+ * @file AnalogController.h
+ * @author Mate Narh
+ *
+ * Class for the master to run all of its continuous controls (wheels, pedals,
+ * faders) from one ADC continuous-mode scan. The ADC digital controller walks
+ * every control's channel on its own and DMAs the results into a pool, so the
+ * main loop never waits on a conversion: each pass drains the pool, averages
+ * the new samples of each channel, filters all of them in one pass and sends
+ * the MIDI message each control is routed to in the controller table.
+ *
+ * The samples are sorted to their control through a channel lookup table, so
+ * the cost of a pass depends on the scan rate, not on the number of controls.
+ * Before Begin(), or if the scan cannot start, each control is read one-shot
+ * with analogRead() instead
+ *
+ * Up to two controls can be smoothed by the IIR filters of the ADC digital
+ * controller instead of in software: their samples then arrive filtered and
+ * their wheels skip their own filter
+ */
+
+#ifndef ANALOG_CONTROLLER_H
+#define ANALOG_CONTROLLER_H
+
+#include <Arduino.h>
+#include <esp_adc/adc_continuous.h>
+#include <esp_adc/adc_filter.h>
+#include <MidiRouter.h>
+#include <Wheel.h>
+
+class AnalogController
+{
+    public:
+
+        static constexpr uint8_t DESTINATION_PITCH_BEND = 0;  ///< Send the reading as pitch bend
+        static constexpr uint8_t DESTINATION_CC = 1;          ///< Send the reading as a 7-bit CC
+        static constexpr uint8_t DESTINATION_CC_14BIT = 2;    ///< Send the reading as a 14-bit CC pair (MSB on the number, LSB on number + 32)
+
+        /// A row of the controller table: a control and the MIDI message it drives
+        struct Route
+        {
+            int pin;                 ///< The ADC1 pin of the control
+            int16_t rangeMin;        ///< The reading at one end of the control
+            int16_t rangeMax;        ///< The reading at the other end of the control
+            bool centered;           ///< Is the control sprung to a center (joystick) rather than linear (pedal, fader)?
+            uint8_t destination;     ///< DESTINATION_PITCH_BEND, DESTINATION_CC or DESTINATION_CC_14BIT
+            uint8_t number;          ///< The CC number, for CC destinations
+        };
+
+    private:
+
+        static constexpr size_t MAX_CONTROLLERS = SOC_ADC_MAX_CHANNEL_NUM;  ///< ADC1 channels that can be scanned
+        static constexpr size_t CONVERSION_FRAME_SIZE = 256;                ///< Bytes of conversion results read at once
+        static constexpr size_t CONVERSION_POOL_SIZE = 1024;                ///< Bytes of conversion results the driver can hold between passes
+        static constexpr size_t MAX_HARDWARE_FILTERS = SOC_ADC_DIGI_IIR_FILTER_NUM;  ///< IIR filters of the ADC digital controller
+
+        /// A control in the scan, with the samples gathered for it on this pass
+        struct Controller
+        {
+            Wheel* wheel = nullptr;            ///< Filters and maps the samples, and limits the rate of the readings
+            adc_channel_t channel {};          ///< The ADC1 channel of the control's pin
+            uint8_t destination = DESTINATION_CC;
+            uint8_t number = 0;
+            uint32_t sampleTotal = 0;          ///< Sum of the samples gathered on this pass
+            uint32_t sampleCount = 0;          ///< Number of samples gathered on this pass
+            uint8_t hardwareCoefficient = 0;   ///< The k of the hardware IIR filter on the channel (0 = smoothed in software)
+            adc_iir_filter_handle_t hardwareFilter = nullptr;  ///< The hardware IIR filter, once enabled
+        };
+
+        MidiRouter& mRouter;                   ///< Where the MIDI messages of the controls are sent
+        uint8_t mChannel = 1;                  ///< The MIDI channel of the messages (1 - 16)
+        int mResolution = 12;                  ///< The resolution the samples are scaled to, in bits
+
+        Controller mControllers[MAX_CONTROLLERS];   ///< The controller table, in the order the controls were added
+        size_t mControllerCount = 0;                ///< Number of controls added
+        int8_t mChannelIndex[MAX_CONTROLLERS];      ///< The controller of each ADC1 channel (-1 = not scanned)
+
+        adc_continuous_handle_t mHandle = nullptr;  ///< The ADC continuous-mode driver
+        bool mStarted = false;                      ///< Is the scan running?
+        uint8_t mFrame[CONVERSION_FRAME_SIZE];      ///< Conversion results read from the driver
+
+        // ------------------------------- Statistics ----------------------------------
+
+        uint32_t mUpdates = 0;                 ///< Passes since the statistics were reset
+        uint32_t mSamples = 0;                 ///< Samples gathered since the statistics were reset
+        unsigned long mUpdateTimeTotal = 0;    ///< Sum of the times of those passes, in microseconds
+        unsigned long mUpdateTimeMax = 0;      ///< Longest pass, in microseconds
+
+        void EnableHardwareFilters();
+        void DrainScan();
+        void ReadOneShot();
+        void Send(const Controller& controller);
+
+    public:
+
+        AnalogController(MidiRouter& router, const uint8_t channel, const int resolution);
+
+        // ----------------------------------- Getters ---------------------------------
+        size_t GetControllerCount() const;
+        Wheel* GetWheel(const size_t index) const;
+        bool IsScanning() const;
+        uint32_t GetSampleCount() const;
+        unsigned long GetAverageUpdateTime() const;
+        unsigned long GetMaxUpdateTime() const;
+
+        // --------------------------------- Core Methods ------------------------------
+        Wheel* AddController(const Route& route);
+        bool SetHardwareFilter(const size_t index, const uint8_t coefficient);
+        bool Begin(const uint32_t sampleRate);
+        void Update();
+        void ResetStatistics();
+
+        AnalogController() = delete;                           ///< Default constructor disabled
+        AnalogController(const AnalogController &) = delete;   ///< Copy constructor disabled
+        void operator=(const AnalogController &) = delete;     ///< Assignment operator disabled
+};
+
+#endif // ANALOG_CONTROLLER_H
@@ -0,0 +1,60 @@
+/**
+ * @file EventMerger.cpp
+ * @author Mate Narh
+ */
+
+#include "EventMerger.h"
+
+/**
+ * @brief Add a slave whose key events should be merged
+ * @param slave The slave to add
+ * @return True if the slave was added and false if the merger is full
+ */
+bool EventMerger::AddSlave(Slave* slave)
+{
+    if (slave == nullptr || mSlaveCount == MAX_SLAVES)
+    {
+        return false;
+    }
+    mSlaves[mSlaveCount++] = slave;
+    return true;
+}
+
+/**
+ * @brief Take the earliest key event waiting on any of the slaves
+ *
+ * Each slave queues its events in timestamp order, so the earliest event overall
+ * is at the head of one of the queues. This is a k-way merge: every call looks at
+ * the k queue heads only, so draining n events costs O(n * k) for a handful of
+ * slaves. Timestamps are compared modulo 2^32 so the order holds across wraps of
+ * micros()
+ * @param event Set to the earliest key event, if any
+ * @return The slave that reported the event, or nullptr if no event is waiting
+ */
+Slave* EventMerger::NextEvent(KeyEvent& event)
+{
+    Slave* earliest = nullptr;
+
+    for (size_t i = 0; i < mSlaveCount; i++)
+    {
+        Slave* slave = mSlaves[i];
+
+        if (slave->GetEventCount() == 0)
+        {
+            continue;
+        }
+
+        if (earliest == nullptr ||
+            static_cast<int32_t>(slave->PeekEvent().timestamp - earliest->PeekEvent().timestamp) < 0)
+        {
+            earliest = slave;
+        }
+    }
+
+    if (earliest != nullptr)
+    {
+        event = earliest->PeekEvent();
+        earliest->PopEvent();
+    }
+    return earliest;
+}
@@ -0,0 +1,37 @@
+/**
+ * @file EventMerger.h
+ * @author Mate Narh
+ *
+ * Class for the master to merge the key events queued by its slaves into a single
+ * stream ordered by timestamp, so that notes leave the master in the order they
+ * were played rather than in the order the slaves were wired and polled
+ */
+
+#ifndef EVENT_MERGER_H
+#define EVENT_MERGER_H
+
+#include <Arduino.h>
+#include <Slave.h>
+
+class EventMerger
+{
+    private:
+
+        static constexpr size_t MAX_SLAVES = 8;  ///< Number of slaves whose events can be merged
+
+        Slave* mSlaves[MAX_SLAVES] {nullptr};    ///< The slaves whose event queues are merged
+        size_t mSlaveCount = 0;                  ///< Number of slaves added to this merger
+
+    public:
+
+        EventMerger() = default;
+
+        // --------------------------------- Core Methods ------------------------------
+        bool AddSlave(Slave* slave);
+        Slave* NextEvent(KeyEvent& event);
+
+        EventMerger(const EventMerger &) = delete;     ///< Copy constructor disabled
+        void operator=(const EventMerger &) = delete;  ///< Assignment operator disabled
+};
+
+#endif // EVENT_MERGER_H
@@ -0,0 +1,141 @@
+/**
+ * @file JitterBuffer.cpp
+ * @author Mate Narh
+ */
+
+#include "JitterBuffer.h"
+
+/**
+ * @brief Constructor
+ * @param delay The playout delay added to every timestamp, in microseconds
+ */
+JitterBuffer::JitterBuffer(const uint32_t delay) : mDelay(delay)
+{
+}
+
+/**
+ * @brief Set the playout delay added to every timestamp
+ * @param delay The playout delay, in microseconds
+ */
+void JitterBuffer::SetDelay(const uint32_t delay)
+{
+    mDelay = delay;
+}
+
+/**
+ * @brief Get the playout delay added to every timestamp, in microseconds
+ */
+uint32_t JitterBuffer::GetDelay() const
+{
+    return mDelay;
+}
+
+/**
+ * @brief Get the number of key events currently held
+ */
+size_t JitterBuffer::GetOccupancy() const
+{
+    return mCount;
+}
+
+/**
+ * @brief Get the largest number of key events held at once since boot
+ */
+size_t JitterBuffer::GetMaxOccupancy() const
+{
+    return mMaxOccupancy;
+}
+
+/**
+ * @brief Get the number of key events that missed their playout time
+ *
+ * A late event is released right away, and so is the earliest event held when
+ * the buffer is full, so each one is a note whose latency was not constant. A
+ * steady count means the playout delay is too short, or the buffer too small
+ */
+uint32_t JitterBuffer::GetLateEventCount() const
+{
+    return mLateEvents;
+}
+
+/**
+ * @brief Hold a key event back until its playout time
+ *
+ * Events mostly arrive in timestamp order, so the insertion below rarely moves
+ * more than an entry or two. Timestamps are compared modulo 2^32.
+ *
+ * No event is ever discarded. When the buffer is full, the earliest of the held
+ * events and the new one is handed back to be sent right away, and counted as
+ * late, since it is the closest to its playout time
+ * @param event The key event, stamped in master time
+ * @param slave The slave that reported the key event
+ * @param now The current master time, in microseconds
+ * @param released Set to the key event released early because the buffer is full, if any
+ * @return The slave that reported the released event, or nullptr if the buffer had room
+ */
+Slave* JitterBuffer::Push(const KeyEvent& event, Slave* slave, const uint32_t now, KeyEvent& released)
+{
+    Slave* releasedSlave = nullptr;
+
+    if (mCount == CAPACITY)
+    {
+        mLateEvents++;
+
+        if (static_cast<int32_t>(event.timestamp - mEntries[0].event.timestamp) < 0)
+        {
+            released = event;
+            return slave;
+        }
+
+        released = mEntries[0].event;
+        releasedSlave = mEntries[0].slave;
+
+        mCount--;
+        for (size_t i = 0; i < mCount; i++)
+        {
+            mEntries[i] = mEntries[i + 1];
+        }
+    }
+
+    if (static_cast<int32_t>(now - (event.timestamp + mDelay)) > 0)
+    {
+        mLateEvents++;
+    }
+
+    size_t i = mCount;
+
+    while (i > 0 && static_cast<int32_t>(event.timestamp - mEntries[i - 1].event.timestamp) < 0)
+    {
+        mEntries[i] = mEntries[i - 1];
+        i--;
+    }
+    mEntries[i] = {event, slave};
+
+    mCount++;
+    mMaxOccupancy = max(mMaxOccupancy, mCount);
+    return releasedSlave;
+}
+
+/**
+ * @brief Release the earliest key event held, if its playout time has come
+ * @param event Set to the released key event, if any
+ * @param now The current master time, in microseconds
+ * @return The slave that reported the event, or nullptr if no event is due
+ */
+Slave* JitterBuffer::Pop(KeyEvent& event, const uint32_t now)
+{
+    if (mCount == 0 || static_cast<int32_t>(now - (mEntries[0].event.timestamp + mDelay)) < 0)
+    {
+        return nullptr;
+    }
+
+    event = mEntries[0].event;
+    Slave* slave = mEntries[0].slave;
+
+    mCount--;
+    for (size_t i = 0; i < mCount; i++)
+    {
+        mEntries[i] = mEntries[i + 1];
+    }
+    return slave;
+}
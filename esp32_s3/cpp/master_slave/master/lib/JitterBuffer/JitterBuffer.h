@@ -0,0 +1,59 @@
+/**
+ * @file JitterBuffer.h
+ * @author Mate Narh
+ *
+ * Class for the master to hold timestamped key events back for a fixed playout
+ * delay. Each event is released at its timestamp plus the delay, which turns the
+ * varying scan and SPI latency of the slaves into a constant offset. Useful when
+ * recording, where constant latency matters more than minimum latency
+ */
+
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <Arduino.h>
+#include <Slave.h>
+
+class JitterBuffer
+{
+    private:
+
+        static constexpr size_t CAPACITY = 64;  ///< Number of key events that can be held at once
+
+        /// A key event held back until its playout time
+        struct Entry
+        {
+            KeyEvent event;
+            Slave* slave;
+        };
+
+        Entry mEntries[CAPACITY];          ///< Held key events, sorted by timestamp
+        size_t mCount = 0;                 ///< Number of key events held
+        uint32_t mDelay = 0;               ///< Playout delay added to every timestamp, in microseconds
+
+        size_t mMaxOccupancy = 0;          ///< Largest number of key events held at once
+        uint32_t mLateEvents = 0;          ///< Number of key events released after or before their playout time
+
+    public:
+
+        JitterBuffer(const uint32_t delay);
+
+        // ----------------------------------- Setters ---------------------------------
+        void SetDelay(const uint32_t delay);
+
+        // ----------------------------------- Getters ---------------------------------
+        uint32_t GetDelay() const;
+        size_t GetOccupancy() const;
+        size_t GetMaxOccupancy() const;
+        uint32_t GetLateEventCount() const;
+
+        // --------------------------------- Core Methods ------------------------------
+        Slave* Push(const KeyEvent& event, Slave* slave, const uint32_t now, KeyEvent& released);
+        Slave* Pop(KeyEvent& event, const uint32_t now);
+
+        JitterBuffer() = delete;                        ///< Default constructor disabled
+        JitterBuffer(const JitterBuffer &) = delete;    ///< Copy constructor disabled
+        void operator=(const JitterBuffer &) = delete;  ///< Assignment operator disabled
+};
+
+#endif // JITTER_BUFFER_H
@@ -0,0 +1,185 @@
+/**
+ * @file MidiEncoder.cpp
+ * @author Mate Narh
+ */
+
+#include "MidiEncoder.h"
+
+/**
+ * @brief Constructor
+ * @param noteOffAsNoteOn Send note offs as note ons with velocity 0?
+ */
+MidiEncoder::MidiEncoder(const bool noteOffAsNoteOn) : mNoteOffAsNoteOn(noteOffAsNoteOn)
+{
+}
+
+/**
+ * @brief Choose whether note offs are sent as note ons with velocity 0
+ *
+ * Lets a run of note ons and offs share a single status byte, at the cost of
+ * the release velocity
+ * @param noteOffAsNoteOn Send note offs as note ons with velocity 0?
+ */
+void MidiEncoder::SetNoteOffAsNoteOn(const bool noteOffAsNoteOn)
+{
+    mNoteOffAsNoteOn = noteOffAsNoteOn;
+}
+
+/**
+ * @brief Get the number of encoded bytes waiting for the transport
+ */
+size_t MidiEncoder::GetCount() const
+{
+    return mCount;
+}
+
+/**
+ * @brief Get the largest number of encoded bytes that waited at once
+ */
+size_t MidiEncoder::GetMaxCount() const
+{
+    return mMaxCount;
+}
+
+/**
+ * @brief Get the number of bytes that can still be encoded
+ */
+size_t MidiEncoder::GetFree() const
+{
+    return CAPACITY - mCount;
+}
+
+/**
+ * @brief Get the average number of bytes a message took since the statistics were reset
+ */
+float MidiEncoder::GetBytesPerMessage() const
+{
+    return mMessages ? static_cast<float>(mEncodedBytes) / mMessages : 0.0f;
+}
+
+/**
+ * @brief Get the number of messages rejected because the buffer was full
+ */
+uint32_t MidiEncoder::GetDroppedMessageCount() const
+{
+    return mDroppedMessages;
+}
+
+/**
+ * @brief Encode a channel message, dropping its status byte if running status allows
+ *
+ * Program change and channel pressure carry a single data byte, so data2 is
+ * ignored for them. A message is either encoded whole or not at all
+ * @param status The status byte of the message (0x80 - 0xEF)
+ * @param data1 The first data byte
+ * @param data2 The second data byte
+ * @return True if the message was encoded and false if the buffer was full
+ */
+bool MidiEncoder::Encode(const uint8_t status, const uint8_t data1, const uint8_t data2)
+{
+    uint8_t encodedStatus = status;
+    uint8_t encodedData2 = data2;
+
+    if (mNoteOffAsNoteOn && (status & 0xF0) == 0x80)
+    {
+        encodedStatus = 0x90 | (status & 0x0F);
+        encodedData2 = 0;
+    }
+
+    uint8_t type = encodedStatus & 0xF0;
+    size_t dataBytes = (type == 0xC0 || type == 0xD0) ? 1 : 2;
+    bool running = encodedStatus == mRunningStatus;
+    size_t size = dataBytes + (running ? 0 : 1);
+
+    if (size > GetFree())
+    {
+        mDroppedMessages++;
+        return false;
+    }
+
+    if (!running)
+    {
+        Push(encodedStatus);
+        mRunningStatus = encodedStatus;
+    }
+    Push(data1 & 0x7F);
+
+    if (dataBytes == 2)
+    {
+        Push(encodedData2 & 0x7F);
+    }
+
+    mMessages++;
+    mEncodedBytes += size;
+    return true;
+}
+
+/**
+ * @brief Send the status byte of the next message, whatever the previous one was
+ *
+ * Call after the line was idle for a while, so that a receiver plugged in
+ * mid-stream picks the status up again
+ */
+void MidiEncoder::ResetRunningStatus()
+{
+    mRunningStatus = 0;
+}
+
+/**
+ * @brief Get the oldest waiting bytes that are contiguous in the buffer
+ * @param bytes Set to the oldest waiting byte
+ * @return The number of contiguous bytes, which may be less than GetCount() when the ring wraps
+ */
+size_t MidiEncoder::Peek(const uint8_t*& bytes) const
+{
+    bytes = mBytes + mHead;
+
+    size_t contiguous = CAPACITY - mHead;
+    return (mCount < contiguous) ? mCount : contiguous;
+}
+
+/**
+ * @brief Remove the oldest waiting bytes once the transport has taken them
+ * @param count The number of bytes taken
+ */
+void MidiEncoder::Consume(const size_t count)
+{
+    size_t taken = (count < mCount) ? count : mCount;
+
+    mHead = (mHead + taken) % CAPACITY;
+    mCount -= taken;
+}
+
+/**
+ * @brief Drop every waiting byte. The next message is sent with its status byte
+ */
+void MidiEncoder::Clear()
+{
+    mHead = 0;
+    mCount = 0;
+    mRunningStatus = 0;
+}
+
+/**
+ * @brief Clear the bytes per message statistics
+ */
+void MidiEncoder::ResetStatistics()
+{
+    mMessages = 0;
+    mEncodedBytes = 0;
+}
+
+/**
+ * @brief Append a byte. The caller checks that there is room
+ * @param byte The byte to append
+ */
+void MidiEncoder::Push(const uint8_t byte)
+{
+    mBytes[(mHead + mCount) % CAPACITY] = byte;
+    mCount++;
+
+    if (mCount > mMaxCount)
+    {
+        mMaxCount = mCount;
+    }
+}
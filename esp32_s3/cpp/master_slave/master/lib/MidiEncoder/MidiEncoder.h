@@ -0,0 +1,68 @@
+/**
+ * @file MidiEncoder.h
+ * @author Mate Narh
+ *
+ * Class to encode MIDI channel messages into a byte stream for a serial (5-pin
+ * DIN/TRS) MIDI output, with running status: a message with the status of the
+ * previous one is sent without its status byte. Note offs can be sent as note
+ * ons with velocity 0, so that a run of notes shares a single status byte.
+ *
+ * The encoded bytes wait in a ring buffer until the transport takes them. The
+ * class only depends on the C++ standard headers, so it can be built and
+ * exercised on a host
+ */
+
+#ifndef MIDI_ENCODER_H
+#define MIDI_ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class MidiEncoder
+{
+    private:
+
+        static constexpr size_t CAPACITY = 512;  ///< Number of encoded bytes that can wait for the transport
+
+        uint8_t mBytes[CAPACITY];          ///< Ring buffer of encoded bytes, oldest first
+        size_t mHead = 0;                  ///< Index of the oldest byte
+        size_t mCount = 0;                 ///< Number of bytes waiting
+        size_t mMaxCount = 0;              ///< Largest number of bytes that waited at once
+
+        uint8_t mRunningStatus = 0;        ///< Status byte the receiver will assume for data bytes (0 = none)
+        bool mNoteOffAsNoteOn = false;     ///< Send note offs as note ons with velocity 0?
+
+        uint32_t mMessages = 0;            ///< Messages encoded since the statistics were reset
+        uint32_t mEncodedBytes = 0;        ///< Bytes those messages took
+        uint32_t mDroppedMessages = 0;     ///< Messages rejected because the buffer was full
+
+        void Push(const uint8_t byte);
+
+    public:
+
+        MidiEncoder(const bool noteOffAsNoteOn);
+
+        // ----------------------------------- Setters ---------------------------------
+        void SetNoteOffAsNoteOn(const bool noteOffAsNoteOn);
+
+        // ----------------------------------- Getters ---------------------------------
+        size_t GetCount() const;
+        size_t GetMaxCount() const;
+        size_t GetFree() const;
+        float GetBytesPerMessage() const;
+        uint32_t GetDroppedMessageCount() const;
+
+        // --------------------------------- Core Methods ------------------------------
+        bool Encode(const uint8_t status, const uint8_t data1, const uint8_t data2);
+        void ResetRunningStatus();
+        size_t Peek(const uint8_t*& bytes) const;
+        void Consume(const size_t count);
+        void Clear();
+        void ResetStatistics();
+
+        MidiEncoder() = delete;                        ///< Default constructor disabled
+        MidiEncoder(const MidiEncoder &) = delete;     ///< Copy constructor disabled
+        void operator=(const MidiEncoder &) = delete;  ///< Assignment operator disabled
+};
+
+#endif // MIDI_ENCODER_H
@@ -6,6 +6,8 @@
 #include <Arduino.h>
 #include "RotaryEncoder.h"
 
+static constexpr uint32_t GLITCH_FILTER_NS = 10000;  // Pulses on CLK or DT shorter than this are ignored (contact bounce)
+static constexpr int COUNT_LIMIT = 32767;            // PCNT counter limit. The driver accumulates the count across it
 
 /**
  * @brief Constructor
@@ -19,10 +21,17 @@ RotaryEncoder::RotaryEncoder(const int clockPin, const int dataPin, const int sw
     mClockPin(clockPin), mDataPin(dataPin), mSwitchPin(switchPin), mCounterMax(counterMax), mCounterMin(counterMin) 
 {
     //
-    // Initialize previous clock and switch state to values at setup
+    // Initialize previous switch state to its value at setup
     //
-    mPreviousClockState = digitalRead(clockPin);
     mPreviousSwitchState = digitalRead(switchPin);
+
+    //
+    // Count the rotations in hardware if possible, in interrupts otherwise
+    //
+    if (!StartPulseCounter())
+    {
+        StartDecoder();
+    }
 }
 
 /**
@@ -30,6 +39,19 @@ RotaryEncoder::RotaryEncoder(const int clockPin, const int dataPin, const int sw
  */
 RotaryEncoder::~RotaryEncoder()
 {
+#if SOC_PCNT_SUPPORTED
+    if (mPulseCounter != nullptr)
+    {
+        pcnt_unit_stop(mPulseCounter);
+        pcnt_unit_disable(mPulseCounter);
+        pcnt_del_channel(mClockChannel);
+        pcnt_del_channel(mDataChannel);
+        pcnt_del_unit(mPulseCounter);
+        return;
+    }
+#endif
+    detachInterrupt(mClockPin);
+    detachInterrupt(mDataPin);
 }
 
 /**
@@ -56,94 +78,70 @@ void RotaryEncoder::SetCounterMin(int counterMin)
  */
 void RotaryEncoder::SetSwitchCallback(void(*callback)())
 {
-    
+    mSwitchCallback = callback;
+}
+
+/**
+ * @brief Set the number of quadrature counts per detent of this rotary encoder's knob
+ * @param countsPerStep The counts (edges of CLK and DT) per step of the counter, eg. 4 for a KY-040
+ */
+void RotaryEncoder::SetCountsPerStep(int countsPerStep)
+{
+    mCountsPerStep = max(countsPerStep, 1);
 }
 
 /**
  * @brief Update the state of this rotary encoder
  * 
- * Read the digital values of the DATA, CLOCK, and SWITCH signals for this
- * rotary encoder, and update their states accordingly. Also update the 
- * counter to increment by a unit for clockwise rotation and decrement by
- * a unit for counter-clockwise rotation
+ * Turn the quadrature count gathered since the last update into steps of the
+ * counter: up a unit per detent for clockwise rotation and down a unit per
+ * detent for counter-clockwise rotation. Also read the SWITCH signal and
+ * handle a press
  */
 void RotaryEncoder::Update()
 {
-    unsigned long currentTime = millis();
-
-    int currentClockState = digitalRead(mClockPin);
-    int currentDataState = digitalRead(mDataPin);
-    int currentSwitchState = digitalRead(mSwitchPin);
-
-    bool clockStateChanged = currentClockState != mPreviousClockState;
-
     //
     // --------------------------- Handle Rotations --------------------------
     //
-    // When a state change occurs, react only on the rising edge of the
-    // clock to avoid double counting. Recall that the state change will
-    // also be apparent with the falling edge, but only one event suffices
+    // The count is kept by the PCNT unit or by the interrupts, so however many
+    // detents went by since the last pass, all of them are counted. Counts
+    // short of a detent are kept for the next pass. The count goes up when
+    // the CLOCK signal leads the DATA signal by a phase shift of 90 degrees,
+    // implying clockwise rotation
     //
-    if (clockStateChanged && currentClockState == 1 && currentTime - mRotationTimestamp > mRotationDebounceTime)
-    {
-        //
-        // Clockwise Rotation
-        //
-        // If the current state of the DATA pin does not equal the current
-        // CLOCK state, then the CLOCK signal is leading the DATA signal by
-        // a phase shift of 90 degrees, implying clockwise rotation
-        //
-        //         ______     ______     ______        
-        // Clock:  |    |_____|    |_____|    |_____   
-        //            ______     ______     ______     
-        // Data :  ___|    |_____|    |_____|    |_____
-        //
-        if (currentClockState != digitalRead(mDataPin))
-        {
-            mCounter = constrain((mCounter + 1), mCounterMin, mCounterMax);
-            mDirection = Clockwise;
-        }   
-
-        //
-        // Counter-clockwise Rotation
-        //
-        // If the current state of the DATA pin equals the current CLOCK state
-        // then the CLOCK signal is lagging behind the DATA signal by a phase
-        // shift of 90 degrees, implying counter-clockwise rotation
-        //
-        //            ______     ______     ______     
-        // Clock:  ___|    |_____|    |_____|    |_____
-        //         ______     ______     ______        
-        // Data :  |    |_____|    |_____|    |_____   
-        //
-        else
-        {
-            mCounter = constrain((mCounter - 1), mCounterMin, mCounterMax);
-            mDirection = CounterClockwise;
-        }
+    //         ______     ______     ______        
+    // Clock:  |    |_____|    |_____|    |_____   
+    //            ______     ______     ______     
+    // Data :  ___|    |_____|    |_____|    |_____
+    //
+    int steps = (ReadCount() - mStepCount) / mCountsPerStep;
 
-        mRotationTimestamp = currentTime;        
+    if (steps != 0)
+    {
+        mStepCount += steps * mCountsPerStep;
+        mCounter = constrain((mCounter + steps), mCounterMin, mCounterMax);
+        mDirection = (steps > 0) ? Clockwise : CounterClockwise;
     }
-    //
-    // Update the previous clock state
-    //
-    mPreviousClockState = currentClockState;
 
 
     //
     // -------------------------- Handle Switch Event -----------------------
-    //
-    bool switchStateChanged = currentSwitchState != mPreviousSwitchState;
-
     //
     // The switch is connected to a GPIO pin configured as an INPUT PULLUP pin
     // Hence, it uses active LOW logic. Therefore when the switch state is LOW
     // it is ON, and when it is HIGH, it is OFF
     //
-    
-    bool switchIsOn = switchStateChanged && currentSwitchState == LOW;
+    int currentSwitchState = digitalRead(mSwitchPin);
 
-    if (switchIsOn && currentTime - mSwitchTimestamp > mSwitchDebounceTime)
+    if (currentSwitchState == mPreviousSwitchState)
+    {
+        return;
+    }
+    mPreviousSwitchState = currentSwitchState;
+
+    unsigned long currentTime = millis();
+
+    if (currentSwitchState == LOW && currentTime - mSwitchTimestamp > mSwitchDebounceTime)
     {
         //
         // If there is a switch callback handler for this rotary encoder, call it
@@ -214,5 +212,132 @@ bool RotaryEncoder::GetDirection() const
     return (mDirection == Clockwise);
 }
 
+/**
+ * @brief Returns whether the rotations of this encoder are counted by a PCNT unit
+ * @return True if a PCNT unit counts the rotations and false if they are decoded in interrupts
+ */
+bool RotaryEncoder::IsHardwareCounting() const
+{
+#if SOC_PCNT_SUPPORTED
+    return mPulseCounter != nullptr;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Get the number of transitions the interrupts could not decode (both signals changed between two edges)
+ * @return The number of invalid transitions. Always 0 while a PCNT unit counts the rotations
+ */
+uint32_t RotaryEncoder::GetInvalidCount() const
+{
+    return mDecoder.GetInvalidCount();
+}
+
+/**
+ * @brief Count the rotations of this encoder with a PCNT unit
+ *
+ * Each channel of the unit counts the edges of one signal and reads the other
+ * as its direction, which gives a count on every edge of CLK and DT:
+ *
+ *     CLK rises while DT is low, or falls while DT is high  -> clockwise
+ *     DT rises while CLK is high, or falls while CLK is low -> clockwise
+ *
+ * and the opposite for counter-clockwise
+ * @return True if the unit is counting and false otherwise
+ */
+bool RotaryEncoder::StartPulseCounter()
+{
+#if SOC_PCNT_SUPPORTED
+    pcnt_unit_config_t unitConfig = {};
+    unitConfig.low_limit = -COUNT_LIMIT;
+    unitConfig.high_limit = COUNT_LIMIT;
+    unitConfig.flags.accum_count = 1;
+
+    if (pcnt_new_unit(&unitConfig, &mPulseCounter) != ESP_OK)
+    {
+        mPulseCounter = nullptr;
+        return false;
+    }
+
+    pcnt_glitch_filter_config_t filterConfig = {};
+    filterConfig.max_glitch_ns = GLITCH_FILTER_NS;
+
+    pcnt_chan_config_t clockConfig = {};
+    clockConfig.edge_gpio_num = mClockPin;
+    clockConfig.level_gpio_num = mDataPin;
 
+    pcnt_chan_config_t dataConfig = {};
+    dataConfig.edge_gpio_num = mDataPin;
+    dataConfig.level_gpio_num = mClockPin;
+
+    bool started = 
+        pcnt_unit_set_glitch_filter(mPulseCounter, &filterConfig) == ESP_OK &&
+        pcnt_new_channel(mPulseCounter, &clockConfig, &mClockChannel) == ESP_OK &&
+        pcnt_new_channel(mPulseCounter, &dataConfig, &mDataChannel) == ESP_OK &&
+        pcnt_channel_set_edge_action(mClockChannel, PCNT_CHANNEL_EDGE_ACTION_DECREASE, PCNT_CHANNEL_EDGE_ACTION_INCREASE) == ESP_OK &&
+        pcnt_channel_set_level_action(mClockChannel, PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_INVERSE) == ESP_OK &&
+        pcnt_channel_set_edge_action(mDataChannel, PCNT_CHANNEL_EDGE_ACTION_INCREASE, PCNT_CHANNEL_EDGE_ACTION_DECREASE) == ESP_OK &&
+        pcnt_channel_set_level_action(mDataChannel, PCNT_CHANNEL_LEVEL_ACTION_KEEP, PCNT_CHANNEL_LEVEL_ACTION_INVERSE) == ESP_OK &&
+        pcnt_unit_add_watch_point(mPulseCounter, -COUNT_LIMIT) == ESP_OK &&
+        pcnt_unit_add_watch_point(mPulseCounter, COUNT_LIMIT) == ESP_OK &&
+        pcnt_unit_enable(mPulseCounter) == ESP_OK &&
+        pcnt_unit_clear_count(mPulseCounter) == ESP_OK &&
+        pcnt_unit_start(mPulseCounter) == ESP_OK;
+
+    if (!started)
+    {
+        //
+        // Give the unit back: the interrupts take over
+        //
+        pcnt_unit_disable(mPulseCounter);
+        if (mClockChannel != nullptr) pcnt_del_channel(mClockChannel);
+        if (mDataChannel != nullptr) pcnt_del_channel(mDataChannel);
+        pcnt_del_unit(mPulseCounter);
+        mPulseCounter = nullptr;
 
+        Serial.println("Rotary encoder PCNT unit failed to start. Decoding in interrupts");
+    }
+    return started;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Decode the rotations of this encoder from pin change interrupts on CLK and DT
+ */
+void RotaryEncoder::StartDecoder()
+{
+    mDecoder.SetState(digitalRead(mClockPin), digitalRead(mDataPin));
+
+    attachInterruptArg(mClockPin, OnEdge, this, CHANGE);
+    attachInterruptArg(mDataPin, OnEdge, this, CHANGE);
+}
+
+/**
+ * @brief Get the quadrature count of this encoder since it started, positive clockwise
+ */
+int RotaryEncoder::ReadCount() const
+{
+#if SOC_PCNT_SUPPORTED
+    if (mPulseCounter != nullptr)
+    {
+        int count = 0;
+        pcnt_unit_get_count(mPulseCounter, &count);
+        return count;
+    }
+#endif
+    return mDecoder.GetCount();
+}
+
+/**
+ * @brief Decode an edge of CLK or DT
+ * @param encoder The encoder whose signal changed
+ */
+void IRAM_ATTR RotaryEncoder::OnEdge(void* encoder)
+{
+    RotaryEncoder* rotaryEncoder = static_cast<RotaryEncoder*>(encoder);
+
+    rotaryEncoder->mDecoder.Decode(digitalRead(rotaryEncoder->mClockPin), digitalRead(rotaryEncoder->mDataPin));
+}
@@ -10,11 +10,26 @@
  *         SW (switch) 
  *         DT (data)   | aka OUTPUT B 
  *         CLK (clock) | aka OUTPUT A
+ *
+ * Rotations are counted on every edge of CLK and DT (full quadrature) by a
+ * PCNT unit of the ESP32-S3, behind its glitch filter, so no step is lost
+ * however long a pass of the main loop takes: Update() only reads the
+ * hardware counter and turns every 4 counts (one detent) into a step of the
+ * counter. Where no PCNT unit is available, the edges are decoded by a
+ * QuadratureDecoder from pin change interrupts instead
  */
 
 #ifndef ROTARY_ENCODER_H
 #define ROTARY_ENCODER_H
 
+#include <Arduino.h>
+#include <soc/soc_caps.h>
+#include <QuadratureDecoder.h>
+
+#if SOC_PCNT_SUPPORTED
+#include <driver/pulse_cnt.h>
+#endif
+
 class RotaryEncoder
 {
     private:
@@ -23,18 +38,26 @@ class RotaryEncoder
         const int mClockPin = 0;       ///< The clock pin for this rotary encoder
         const int mSwitchPin = 0;      ///< The switch pin for this rotary encoder
           
-        int mPreviousClockState = 0;   ///< The last state of the clock signal
         int mPreviousSwitchState = 0;  ///< The last sate of the switch signal
         
         int mCounter = 0;     ///< The value to decrement or increment in response to rotation
         int mCounterMax = 0;  ///< The counter ceiling for this rotary encoder
         int mCounterMin = 0;  ///< The counter floor for this rotary encoder
 
-        unsigned long mSwitchDebounceTime = 1;    ///< The debounce time for the switch
-        unsigned long mRotationDebounceTime = 1;  ///< The debounce time for rotations
+        int mCountsPerStep = 4;        ///< Quadrature counts (edges of CLK and DT) per detent of the knob
+        int mStepCount = 0;            ///< The quadrature count already turned into steps of the counter
 
+        unsigned long mSwitchDebounceTime = 1;    ///< The debounce time for the switch
         unsigned long mSwitchTimestamp = 0;       ///< When did the last valid switch press take place?
-        unsigned long mRotationTimestamp = 0;     ///< When did the last valid rotation take place?
+
+#if SOC_PCNT_SUPPORTED
+        pcnt_unit_handle_t mPulseCounter = nullptr;     ///< The PCNT unit counting the edges of CLK and DT
+        pcnt_channel_handle_t mClockChannel = nullptr;  ///< The PCNT channel counting the edges of CLK
+        pcnt_channel_handle_t mDataChannel = nullptr;   ///< The PCNT channel counting the edges of DT
+#endif
+
+        /// Decodes the edges of CLK and DT from pin change interrupts, if no PCNT unit is available
+        QuadratureDecoder mDecoder;
 
         /// brief The possible directions for this rotary encoder's knob to move in
         enum Direction {Clockwise, CounterClockwise};
@@ -43,6 +66,11 @@ class RotaryEncoder
 
         void (*mSwitchCallback)() = nullptr;  ///< Callback handler for when the switch of this rotary encoder is pressed
 
+        bool StartPulseCounter();
+        void StartDecoder();
+        int ReadCount() const;
+        static void IRAM_ATTR OnEdge(void* encoder);
+
     public:
         RotaryEncoder(const int clockPin, const int dataPin, const int switchPin, const int counterMax, const int counterMin);
         ~RotaryEncoder();
@@ -51,12 +79,15 @@ class RotaryEncoder
         void SetCounterMax(int counterMax);
         void SetCounterMin(int counterMin);
         void SetSwitchCallback(void(*callback)());
+        void SetCountsPerStep(int countsPerStep);
 
         // ----------------------------------- Getters ------------------------------------
         int GetCounter() const;
         int GetCounterMax() const;
         int GetCounterMin() const;
         bool GetDirection() const;
+        bool IsHardwareCounting() const;
+        uint32_t GetInvalidCount() const;
 
         // --------------------------------- Core Methods ---------------------------------
         void Update();
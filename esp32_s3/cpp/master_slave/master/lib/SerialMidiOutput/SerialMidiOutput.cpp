@@ -0,0 +1,188 @@
+/**
+ * @file SerialMidiOutput.cpp
+ * @author Mate Narh
+ */
+
+#include "SerialMidiOutput.h"
+
+static constexpr int MIDI_BAUD = 31250;                          ///< The MIDI 1.0 serial rate
+static constexpr int UART_TX_BUFFER_SIZE = 0;                    ///< No transmit ring: the bytes go straight into the UART's FIFO
+static constexpr int UART_RX_BUFFER_SIZE = 256;                  ///< Size of the UART driver's receive ring buffer (unused, but required)
+static constexpr unsigned long RUNNING_STATUS_REFRESH_MS = 300;  ///< Idle time after which the status byte is sent again
+static constexpr size_t MAX_MESSAGE_SIZE = 3;                    ///< Bytes of a channel message with its status byte
+
+/**
+ * @brief Constructor
+ * @param port The UART to send the MIDI bytes on
+ * @param txPin The pin driving the DIN/TRS socket
+ * @param noteOffAsNoteOn Send note offs as note ons with velocity 0 to stretch running status?
+ */
+SerialMidiOutput::SerialMidiOutput(const uart_port_t port, const int txPin, const bool noteOffAsNoteOn)
+    : mPort(port), mTxPin(txPin), mEncoder(noteOffAsNoteOn)
+{
+}
+
+/**
+ * @brief Choose whether note offs are sent as note ons with velocity 0
+ * @param noteOffAsNoteOn Send note offs as note ons with velocity 0?
+ */
+void SerialMidiOutput::SetNoteOffAsNoteOn(const bool noteOffAsNoteOn)
+{
+    mEncoder.SetNoteOffAsNoteOn(noteOffAsNoteOn);
+}
+
+/**
+ * @brief Get the number of encoded bytes not written to the UART yet
+ */
+size_t SerialMidiOutput::GetPendingCount() const
+{
+    return mEncoder.GetCount();
+}
+
+/**
+ * @brief Get the largest number of encoded bytes that waited for the UART at once
+ */
+size_t SerialMidiOutput::GetMaxPendingCount() const
+{
+    return mEncoder.GetMaxCount();
+}
+
+/**
+ * @brief Get the average number of bytes a message took on the wire
+ */
+float SerialMidiOutput::GetBytesPerMessage() const
+{
+    return mEncoder.GetBytesPerMessage();
+}
+
+/**
+ * @brief Get the number of messages lost because the output could not keep up
+ */
+uint32_t SerialMidiOutput::GetDroppedMessageCount() const
+{
+    return mEncoder.GetDroppedMessageCount();
+}
+
+/**
+ * @brief Set the UART up for MIDI: 31250 baud, 8 data bits, no parity, 1 stop bit
+ * @return True if the UART is ready and false otherwise
+ */
+bool SerialMidiOutput::Begin()
+{
+    uart_config_t config = {};
+    config.baud_rate = MIDI_BAUD;
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    config.source_clk = UART_SCLK_DEFAULT;
+
+    mStarted = uart_driver_install(mPort, UART_RX_BUFFER_SIZE, UART_TX_BUFFER_SIZE, 0, nullptr, 0) == ESP_OK &&
+               uart_param_config(mPort, &config) == ESP_OK &&
+               uart_set_pin(mPort, mTxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) == ESP_OK;
+
+    if (!mStarted)
+    {
+        Serial.print("MIDI UART setup failed on UART "); Serial.println(static_cast<int>(mPort));
+    }
+    return mStarted;
+}
+
+/**
+ * @brief Get the name of this transport, for logs
+ */
+const char* SerialMidiOutput::GetName() const
+{
+    return "DIN";
+}
+
+/**
+ * @brief Returns whether the UART is set up. A DIN/TRS output cannot tell whether anything is plugged in
+ */
+bool SerialMidiOutput::IsActive() const
+{
+    return mStarted;
+}
+
+/**
+ * @brief Encode a message for the UART
+ * @param event The message to send
+ * @return True if the message was encoded and false if it should be offered again later
+ */
+bool SerialMidiOutput::Send(const MidiEvent& event)
+{
+    return Queue(event.status, event.data1, event.data2);
+}
+
+/**
+ * @brief Hand the encoded bytes to the UART, as far as its hardware FIFO has room
+ *
+ * Never waits: whatever does not fit stays with the encoder for the next pass.
+ * uart_write_bytes() is not used, as it blocks on the driver's ring buffer,
+ * whose item headers take room that uart_get_tx_buffer_free_size() does not
+ * account for. Call once per pass of the main loop
+ */
+void SerialMidiOutput::Service()
+{
+    if (!mStarted)
+    {
+        return;
+    }
+
+    //
+    // The encoder's ring may wrap, so its bytes come in up to two spans. A
+    // span the FIFO only takes part of leaves it full
+    //
+    while (mEncoder.GetCount() > 0)
+    {
+        const uint8_t* bytes = nullptr;
+        size_t count = mEncoder.Peek(bytes);
+        int written = uart_tx_chars(mPort, reinterpret_cast<const char*>(bytes), count);
+
+        if (written > 0)
+        {
+            mEncoder.Consume(written);
+        }
+
+        if (written < static_cast<int>(count))
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Clear the bytes per message statistics
+ */
+void SerialMidiOutput::ResetStatistics()
+{
+    mEncoder.ResetStatistics();
+}
+
+/**
+ * @brief Encode a channel message, sending its status byte again after an idle line
+ *
+ * A message is only encoded if the longest message fits, so that a full
+ * encoder pushes back on the caller instead of counting a drop
+ * @param status The status byte of the message
+ * @param data1 The first data byte
+ * @param data2 The second data byte
+ * @return True if the message was encoded and false otherwise
+ */
+bool SerialMidiOutput::Queue(const uint8_t status, const uint8_t data1, const uint8_t data2)
+{
+    if (!mStarted || mEncoder.GetFree() < MAX_MESSAGE_SIZE)
+    {
+        return false;
+    }
+
+    unsigned long now = millis();
+
+    if (now - mLastMessageTime >= RUNNING_STATUS_REFRESH_MS)
+    {
+        mEncoder.ResetRunningStatus();
+    }
+    mLastMessageTime = now;
+
+    return mEncoder.Encode(status, data1, data2);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file SerialMidiOutput.h
+ * @author Mate Narh
+ *
+ * Class for the master to send MIDI messages out of a UART at 31250 baud, to a
+ * 5-pin DIN or TRS socket, for sound modules without a USB host. Messages are
+ * encoded with running status by a MidiEncoder, which holds the bytes, and they
+ * are written straight into the UART's hardware FIFO only as far as it has room,
+ * so sending never blocks the main loop. The FIFO (128 bytes) holds about 40 ms
+ * of MIDI, far more than a pass of the main loop
+ */
+
+#ifndef SERIAL_MIDI_OUTPUT_H
+#define SERIAL_MIDI_OUTPUT_H
+
+#include <Arduino.h>
+#include <driver/uart.h>
+#include <MidiEncoder.h>
+#include <MidiTransport.h>
+
+class SerialMidiOutput : public MidiTransport
+{
+    private:
+
+        uart_port_t mPort = UART_NUM_MAX;       ///< The UART the MIDI bytes leave on
+        int mTxPin = -1;                        ///< The pin driving the DIN/TRS socket (through its resistors)
+        bool mStarted = false;                  ///< Is the UART driver installed?
+
+        MidiEncoder mEncoder;                   ///< Encodes the messages and holds the bytes the FIFO has no room for
+        unsigned long mLastMessageTime = 0;     ///< Time at which the last message was encoded, in milliseconds
+
+        bool Queue(const uint8_t status, const uint8_t data1, const uint8_t data2);
+
+    public:
+
+        SerialMidiOutput(const uart_port_t port, const int txPin, const bool noteOffAsNoteOn);
+
+        // ----------------------------------- Setters ---------------------------------
+        void SetNoteOffAsNoteOn(const bool noteOffAsNoteOn);
+
+        // ----------------------------------- Getters ---------------------------------
+        size_t GetPendingCount() const;
+        size_t GetMaxPendingCount() const;
+        float GetBytesPerMessage() const;
+        uint32_t GetDroppedMessageCount() const;
+
+        // --------------------------------- Core Methods ------------------------------
+        bool Begin();
+        void ResetStatistics();
+
+        // ------------------------------ MIDI Transport -------------------------------
+        const char* GetName() const override;
+        bool IsActive() const override;
+        bool Send(const MidiEvent& event) override;
+        void Service() override;
+
+        SerialMidiOutput() = delete;                        ///< Default constructor disabled
+        SerialMidiOutput(const SerialMidiOutput &) = delete; ///< Copy constructor disabled
+        void operator=(const SerialMidiOutput &) = delete;  ///< Assignment operator disabled
+};
+
+#endif // SERIAL_MIDI_OUTPUT_H
@@ -3,6 +3,31 @@
  * @author Mate Narh
  */
 #include "Slave.h"
+#include <esp_heap_caps.h>
+
+//
+// The clocks that the master steps through while training the link with this
+// slave. The GP-SPI clock on the ESP32-S3 is derived from the 80 MHz APB clock,
+// so each rung is an integer division of it
+//
+static constexpr uint32_t TRAINING_CLOCKS[] {1000000, 2000000, 4000000, 5000000, 8000000, 10000000, 16000000, 20000000, 26666666, 40000000};
+static constexpr size_t TRAINING_CLOCK_COUNT = sizeof(TRAINING_CLOCKS) / sizeof(TRAINING_CLOCKS[0]);
+
+static constexpr int TRAINING_ROUNDS = 16;        ///< Consecutive clean frames required for a clock to pass
+static constexpr int TRAINING_SAFETY_MARGIN = 1;  ///< Rungs to step back from the highest passing clock
+static constexpr int TRAINING_SYNC_ATTEMPTS = 50; ///< Polls to wait for the slave to start serving the pattern
+static constexpr unsigned long TRAINING_INTERVAL_US = 500; ///< Gap between polls so the slave can re-queue
+
+static constexpr unsigned long LINK_TIMEOUT_US = 250000; ///< Time without a ready frame before the link drops
+static constexpr unsigned long LIVENESS_POLL_INTERVAL_US = 20000; ///< Time between two polls of an idle slave with a data-ready line
+
+static constexpr unsigned long UART_COMMAND_INTERVAL_US = 2000;  ///< Time between two command frames on the UART link
+static constexpr size_t UART_DRIVER_BUFFER_SIZE = 1024;          ///< Size of the UART driver's receive/transmit ring buffers
+static constexpr int UART_EVENT_QUEUE_SIZE = 16;                 ///< Number of UART driver events that can wait
+
+static constexpr int MIDI_NOTE_MAX = 127;                      ///< Highest MIDI note number
+static constexpr int SYNC_WINDOW = 16;                         ///< Offset samples combined into one clock offset update
+static constexpr unsigned long SYNC_LOG_INTERVAL_MS = 10000;   ///< Time between two clock sync log lines
 
 
 /**
@@ -18,8 +43,14 @@ Slave::Slave(const int id, const int keyCount, const uint8_t *notes) : mId(id),
  */
 Slave::~Slave()
 {
-    delete[] mNotes;
-    delete[] mReceiveBuffer;
+    delete[] mDescribedNotes;
+
+    WaitForPoll();
+    if (mDevice != nullptr)
+    {
+        spi_bus_remove_device(mDevice);
+    }
+    FreeBuffers();
 }
 
 /**
@@ -49,24 +80,6 @@ void Slave::SetNotes(const uint8_t *notes)
     mNotes = notes;
 }
 
-/**
- * @brief Set the spi transmission object for this slave
- * @param spi The spi transmission object to set (VSPI/HSPI/FSPI)
- */
-void Slave::SetSpi(SPIClass *spi)
-{
-    mSpi = spi;
-}
-
-/**
- * @brief Set the reception buffer for this slave
- * @param receiveBuffer The reception buffer to set
- */
-void Slave::SetReceiveBuffer(uint8_t *receiveBuffer)
-{
-    mReceiveBuffer = receiveBuffer;
-}
-
 /**
  * @brief Get the ID of this slave
  */
@@ -92,11 +105,11 @@ const uint8_t* Slave::GetNotes() const
 }
 
 /**
- * @brief Get the SPI transmission object for this slave
+ * @brief Get the SPI bus this slave is wired to
  */
-SPIClass *Slave::GetSpi() const
+spi_host_device_t Slave::GetHost() const
 {
-    return mSpi;
+    return mHost;
 }
 
 /**
@@ -108,38 +121,1154 @@ uint8_t* Slave::GetReceiveBuffer() const
 }
 
 /**
- * @brief Initialize SPI for this slave
- * @param spi The SPI object that this slave uses to poll updates from its peer
- * @param spiClock The SPI clock used by the master to synchronize transactions with this slave
- * @param bitOrder The bit order for this SPI communication
- * @param dataMode The data mode for this SPI communication
- * @param bufferSize The size of the reception buffer for this SPI communication
- * @param receiveBuffer The receive buffer used to collect data in this SPI communication
+ * @brief Get the SPI clock used to poll this slave
+ */
+uint32_t Slave::GetSpiClock() const
+{
+    return mSpiClock;
+}
+
+/**
+ * @brief Returns whether the link with this slave is up
+ * @return True if the slave announced itself ready and its clock is trained, and false otherwise
+ */
+bool Slave::IsLinkUp() const
+{
+    return mLinkUp;
+}
+
+/**
+ * @brief Get the time since boot at which the link with this slave came up
+ * @return The time since boot at which the link came up in microseconds, or 0 if it never did
+ */
+unsigned long Slave::GetLinkUpTime() const
+{
+    return mLinkUpTime;
+}
+
+/**
+ * @brief Returns whether the slave has described itself since the link came up
+ *
+ * Until it has, this slave uses the key count and notes it was constructed with
+ */
+bool Slave::IsDescribed() const
+{
+    return mDescribed;
+}
+
+/**
+ * @brief Get the capabilities reported by the slave at link-up. Only valid if IsDescribed()
+ */
+const SlaveDescriptor& Slave::GetDescriptor() const
+{
+    return mDescriptor;
+}
+
+/**
+ * @brief Get the number of key events waiting to be sent
+ */
+size_t Slave::GetEventCount() const
+{
+    return mEventCount;
+}
+
+/**
+ * @brief Get the number of key events lost because the queue was full
+ */
+uint32_t Slave::GetDroppedEventCount() const
+{
+    return mDroppedEvents;
+}
+
+/**
+ * @brief Returns whether the slave signalled key events on its data-ready line since it was last polled
+ *
+ * Always false for a slave without a data-ready line
+ */
+bool Slave::IsDataReady() const
+{
+    return mDataReadyPin >= 0 && (mDataReadyEdge || digitalRead(mDataReadyPin) == HIGH);
+}
+
+/**
+ * @brief Get the number of polls queued with the SPI driver since boot
+ */
+uint32_t Slave::GetPollCount() const
+{
+    return mPollCount;
+}
+
+/**
+ * @brief Get the oldest key event waiting to be sent. Only valid if GetEventCount() > 0
+ *
+ * Event timestamps are converted to master time once the clocks are synced.
+ * Until then, they hold the time at which the frame was received
+ */
+const KeyEvent& Slave::PeekEvent() const
+{
+    return mEvents[mEventHead];
+}
+
+/**
+ * @brief Remove the oldest key event waiting to be sent, if any
+ */
+void Slave::PopEvent()
+{
+    if (mEventCount == 0)
+    {
+        return;
+    }
+    mEventHead = (mEventHead + 1) % EVENT_QUEUE_SIZE;
+    mEventCount--;
+}
+
+/**
+ * @brief Returns whether the clock offset with this slave has been measured
+ */
+bool Slave::IsClockSynced() const
+{
+    return mClockSynced;
+}
+
+/**
+ * @brief Get the offset between the master's and this slave's clocks
+ * @return Master time minus slave time, in microseconds
+ */
+long Slave::GetClockOffset() const
+{
+    return mClockOffset;
+}
+
+/**
+ * @brief Get the drift of this slave's clock relative to the master's since the clocks were synced
+ * @return The drift in parts per million. Positive when the slave clock runs slow
+ */
+float Slave::GetClockDrift() const
+{
+    unsigned long elapsed = millis() - mDriftReferenceTime;
+
+    if (!mClockSynced || elapsed == 0)
+    {
+        return 0.0f;
+    }
+    return (mClockOffset - mDriftReferenceOffset) * 1000.0f / elapsed;
+}
+
+/**
+ * @brief Poll this slave on its data-ready line instead of on every pass
+ *
+ * The slave holds the line high while key events wait for the master. An idle
+ * slave is then only polled at the slow liveness interval
+ * @param pin The input wired to the slave's data-ready output, or -1 to poll on every pass
+ */
+void Slave::SetDataReadyPin(const int pin)
+{
+    if (mDataReadyPin >= 0)
+    {
+        detachInterrupt(mDataReadyPin);
+    }
+
+    mDataReadyPin = pin;
+    mDataReadyEdge = false;
+
+    if (pin < 0)
+    {
+        return;
+    }
+
+    pinMode(pin, INPUT_PULLDOWN);
+    attachInterruptArg(pin, OnDataReady, this, RISING);
+}
+
+/**
+ * @brief Attach this slave to an SPI bus
+ *
+ * Polls are DMA transactions queued with the IDF SPI master driver, with the
+ * chip select driven by the peripheral itself. The bus must already be
+ * initialized (see SlaveBus), and may be shared with other slaves, each with a
+ * chip select of its own
+ * @param host The SPI bus this slave is wired to (SPI2_HOST/SPI3_HOST)
+ * @param csPin The chip select pin of this slave
+ * @param spiClock The SPI clock to poll this slave at until the link is trained
+ * @param dataMode The data mode for this SPI communication (0 - 3)
+ * @param bufferSize The size of the frames exchanged until the slave describes itself
+ * @return True if the slave was added to the bus and false otherwise
  */
-void Slave::SetSpiParameters(SPIClass* spi, uint32_t spiClock, uint8_t bitOrder, uint8_t dataMode, const size_t bufferSize, uint8_t* receiveBuffer)
+bool Slave::SetSpiParameters(const spi_host_device_t host, const int csPin, const uint32_t spiClock, const uint8_t dataMode,
+                             const size_t bufferSize)
 {
-    mSpi = spi;
+    mHost = host;
+    mCsPin = csPin;
     mSpiClock = spiClock;
-    mSpiBitOrder = bitOrder;
-    mSpiDateMode = dataMode;
-    mBufferSize = bufferSize;
-    mReceiveBuffer =  receiveBuffer;
+    mSpiDataMode = dataMode;
+
+    //
+    // The buffers start out at the given size, and are resized to the frames of
+    // the slave once it describes itself
+    //
+    ResizeBuffers(bufferSize);
+    return AddDevice(spiClock);
+}
+
+/**
+ * @brief Reallocate the receive and transmit buffers for this slave
+ *
+ * The buffers are word aligned and DMA capable, and their size is rounded up to
+ * a multiple of 4 so that the driver never has to bounce them through a copy
+ * @param bufferSize The size of the frames exchanged with the slave
+ */
+void Slave::ResizeBuffers(const size_t bufferSize)
+{
+    WaitForPoll();
+    FreeBuffers();
+
+    mBufferSize = (bufferSize + 3) & ~static_cast<size_t>(3);
+
+    for (size_t i = 0; i < POLL_BUFFER_COUNT; i++)
+    {
+        mReceiveBuffers[i] = static_cast<uint8_t*>(heap_caps_aligned_alloc(4, mBufferSize, MALLOC_CAP_DMA));
+        mTransmitBuffers[i] = static_cast<uint8_t*>(heap_caps_aligned_alloc(4, mBufferSize, MALLOC_CAP_DMA));
+
+        memset(mReceiveBuffers[i], 0, mBufferSize);
+        memset(mTransmitBuffers[i], CMD_NONE, mBufferSize);
+
+        mTransactions[i] = {};
+        mTransactions[i].length = mBufferSize * 8;
+        mTransactions[i].tx_buffer = mTransmitBuffers[i];
+        mTransactions[i].rx_buffer = mReceiveBuffers[i];
+    }
+
+    mReceiveBuffer = mReceiveBuffers[0];
+    mTransmitBuffer = mTransmitBuffers[0];
+    mNextBuffer = 0;
+}
+
+/**
+ * @brief Free the receive and transmit buffers for this slave
+ */
+void Slave::FreeBuffers()
+{
+    for (size_t i = 0; i < POLL_BUFFER_COUNT; i++)
+    {
+        heap_caps_free(mReceiveBuffers[i]);
+        heap_caps_free(mTransmitBuffers[i]);
+
+        mReceiveBuffers[i] = nullptr;
+        mTransmitBuffers[i] = nullptr;
+    }
+
+    mReceiveBuffer = nullptr;
+    mTransmitBuffer = nullptr;
+}
+
+/**
+ * @brief Add this slave to its bus at the given clock, replacing the previous device if the clock changed
+ * @param spiClock The SPI clock to poll the slave at
+ * @return True if the device is ready at the given clock and false otherwise
+ */
+bool Slave::AddDevice(const uint32_t spiClock)
+{
+    if (mDevice != nullptr && mDeviceClock == spiClock)
+    {
+        return true;
+    }
+
+    WaitForPoll();
+
+    if (mDevice != nullptr)
+    {
+        spi_bus_remove_device(mDevice);
+        mDevice = nullptr;
+    }
+
+    spi_device_interface_config_t config = {};
+    config.mode = mSpiDataMode;
+    config.clock_speed_hz = static_cast<int>(spiClock);
+    config.spics_io_num = mCsPin;
+    config.queue_size = POLL_BUFFER_COUNT;
+
+    if (spi_bus_add_device(mHost, &config, &mDevice) != ESP_OK)
+    {
+        mDevice = nullptr;
+        Serial.print("SPI device setup failed for slave "); Serial.println(mId);
+        return false;
+    }
+
+    mDeviceClock = spiClock;
+    return true;
+}
+
+/**
+ * @brief Exchange the first pair of buffers with the slave and wait for the transfer to complete
+ *
+ * Only used at link-up, while probing, describing and training the link
+ * @param spiClock The SPI clock to poll the slave at
+ */
+void Slave::TransferBlocking(const uint32_t spiClock)
+{
+    if (!AddDevice(spiClock))
+    {
+        memset(mReceiveBuffer, 0, mBufferSize);
+        return;
+    }
+
+    WaitForPoll();
+    spi_device_polling_transmit(mDevice, &mTransactions[0]);
+}
+
+/**
+ * @brief Queue the next poll of the slave with the SPI driver, without waiting for it
+ */
+void Slave::QueuePoll()
+{
+    if (!AddDevice(mSpiClock))
+    {
+        return;
+    }
+
+    size_t index = mNextBuffer;
+    uint8_t* transmitBuffer = mTransmitBuffers[index];
+
+    //
+    // Send the oldest unacknowledged link command along with the poll
+    //
+    if (mCommandCount > 0)
+    {
+        const Command& pending = mCommands[mCommandHead];
+        EncodeCommand(transmitBuffer, pending.command, pending.id, pending.target, pending.value);
+    }
+    else
+    {
+        transmitBuffer[0] = CMD_NONE;
+    }
+
+    //
+    // Stamp the poll as late as possible so the slave can pair it with the time
+    // the transfer completed on its side. The bus is idle, so the transfer
+    // starts as soon as it is queued
+    //
+    mDataReadyEdge = false;
+    mLastPollTime = micros();
+    WriteUint32(transmitBuffer + CMD_SYNC_INDEX, mLastPollTime);
+
+    if (spi_device_queue_trans(mDevice, &mTransactions[index], 0) == ESP_OK)
+    {
+        mPollInFlight = true;
+        mNextBuffer = (index + 1) % POLL_BUFFER_COUNT;
+        mPollCount++;
+    }
+}
+
+/**
+ * @brief Decide whether the slave is worth polling on this pass
+ *
+ * Without a data-ready line the slave is polled on every pass. With one, it is
+ * polled when the line rose or is still high, while a link command waits for
+ * its acknowledgement, and otherwise at the slow liveness interval, which also
+ * keeps the link timeout and the clock sync fed while nobody plays
+ */
+bool Slave::ShouldPoll() const
+{
+    if (mDataReadyPin < 0 || mCommandCount > 0 || IsDataReady())
+    {
+        return true;
+    }
+
+    return micros() - mLastPollTime >= LIVENESS_POLL_INTERVAL_US;
+}
+
+/**
+ * @brief Flag that the slave raised its data-ready line
+ *
+ * Runs from the GPIO interrupt. SPI transactions cannot be queued from an
+ * interrupt, so the poll itself is queued on the next pass of the loop
+ * @param slave The slave whose line rose
+ */
+void IRAM_ATTR Slave::OnDataReady(void* slave)
+{
+    static_cast<Slave*>(slave)->mDataReadyEdge = true;
+}
+
+/**
+ * @brief Wait for the poll in flight, if any, and drop its frame
+ */
+void Slave::WaitForPoll()
+{
+    if (!mPollInFlight)
+    {
+        return;
+    }
+
+    spi_transaction_t* transaction = nullptr;
+    spi_device_get_trans_result(mDevice, &transaction, portMAX_DELAY);
+    mPollInFlight = false;
 }
 
 /**
  * @brief Query the slave side for MIDI updates, if any
+ *
+ * Collects the frame of the poll queued on the previous call, queues the next
+ * poll on the other pair of buffers if the slave is worth polling, then decodes the collected frame while the
+ * next one transfers. Called for every slave in turn, this keeps all buses busy
+ * at once, so a round of polls takes as long as the slowest slave rather than
+ * the sum of all of them
  */
 void Slave::querySPIPeerOnOtherSide()
 {
     //
-    // This slave receives data from its peer with the following partition
-    // -----------------------------------------------------------
-    // |   1 READINESS   |    2 VELOCITIES    |    3 STATUSES    |
-    // -----------------------------------------------------------
+    // This slave receives frames from its peer with the following partition
+    // --------------------------------------------------------------------------------------------
+    // | HEADER | SEQUENCE | ACK | EVENT COUNT | SYNC MASTER TIME | SYNC SLAVE TIME | EVENTS ... |
+    // --------------------------------------------------------------------------------------------
+    //
+    spi_transaction_t* completed = nullptr;
+
+    if (mPollInFlight)
+    {
+        spi_device_get_trans_result(mDevice, &completed, portMAX_DELAY);
+        mPollInFlight = false;
+    }
+
+    if (ShouldPoll())
+    {
+        QueuePoll();
+    }
+
+    if (completed == nullptr)
+    {
+        return;
+    }
+
+    const uint8_t* frame = static_cast<const uint8_t*>(completed->rx_buffer);
+
+    //
+    // A frame without the ready header carries no key updates, and neither does
+    // a frame whose sequence number was already seen: the slave had nothing new
+    // queued, so the previous frame was clocked out again. Both are discarded so
+    // that stale events are never replayed
+    //
+    unsigned long now = micros();
+
+    if (frame[0] != FRAME_READY)
+    {
+        //
+        // Drop the link if the slave has gone quiet (eg. it was reset) so that it
+        // is handshaked and trained again. Polls are allowed to outpace the slave,
+        // so the link is timed out rather than dropped on a count of bad frames
+        //
+        if (now - mLastFrameTime > LINK_TIMEOUT_US)
+        {
+            mLinkUp = false;
+            WaitForPoll();
+            Serial.print("SPI link lost with slave "); Serial.println(mId);
+        }
+        return;
+    }
+    ProcessFrame(frame, now);
+}
+
+/**
+ * @brief Use a frame received from the peer
+ *
+ * Pops the link command the frame acknowledges, feeds the clock sync and queues
+ * the key events carried by the frame. A frame whose sequence number was already
+ * seen is the previous frame sent again, so its events are skipped
+ * @param frame The frame, starting with the ready header
+ * @param now The master time at which the frame was received, in microseconds
+ */
+void Slave::ProcessFrame(const uint8_t* frame, const unsigned long now)
+{
+    mLastFrameTime = now;
+
+    //
+    // Over UART no command goes out before the descriptor arrives, and until the
+    // slave has been asked for it, its frames still acknowledge the IDs of the
+    // previous master session
+    //
+    bool acknowledging = (mUartPort == UART_NUM_MAX) || mDescribed;
+
+    if (acknowledging && mCommandCount > 0 && frame[FRAME_ACK_INDEX] == mCommands[mCommandHead].id)
+    {
+        if (mCommands[mCommandHead].command == CMD_TIME_SYNC)
+        {
+            ResetClockSync();
+        }
+        mCommandHead = (mCommandHead + 1) % COMMAND_QUEUE_SIZE;
+        mCommandCount--;
+    }
+
+    int sequence = frame[FRAME_SEQUENCE_INDEX];
+
+    if (sequence == mLastSequence)
+    {
+        return;
+    }
+    mLastSequence = sequence;
+
+    UpdateClockSync(ReadUint32(frame + FRAME_SYNC_MASTER_INDEX), ReadUint32(frame + FRAME_SYNC_SLAVE_INDEX));
+
+    //
+    // Place every event on the master's clock and queue it. The slave sends its
+    // events in scan order, so the queue stays ordered by timestamp
+    //
+    size_t eventCount = min(static_cast<size_t>(frame[FRAME_EVENT_COUNT_INDEX]), mMaxEvents);
+
+    for (size_t i = 0; i < eventCount; i++)
+    {
+        KeyEvent event = DecodeEvent(frame, i);
+
+        if (event.key >= mKeyCount)
+        {
+            continue;
+        }
+
+        if (mEventCount == EVENT_QUEUE_SIZE)
+        {
+            mDroppedEvents++;
+            continue;
+        }
+
+        event.timestamp = mClockSynced ? event.timestamp + mClockOffset : now;
+        mEvents[(mEventHead + mEventCount) % EVENT_QUEUE_SIZE] = event;
+        mEventCount++;
+    }
+}
+
+/**
+ * @brief Fold a clock sync sample echoed back by the slave into the clock offset
+ *
+ * A sample pairs the master time stamped on a poll with the slave time at which
+ * that poll completed. Interrupt latency on the slave only ever makes the slave
+ * stamp late, which makes a sample smaller than the true offset, so the largest
+ * sample of each window is the one that counts. Arithmetic is modulo 2^32 so the
+ * sync holds across wraps of micros()
+ * @param masterTime The master time stamped on the poll, in microseconds
+ * @param slaveTime The slave time at which the poll completed, in microseconds
+ */
+void Slave::UpdateClockSync(const uint32_t masterTime, const uint32_t slaveTime)
+{
+    if (masterTime == 0 || masterTime == mLastSyncMasterTime)
+    {
+        return;
+    }
+    mLastSyncMasterTime = masterTime;
+
+    //
+    // The master stamp was taken as the transfer started, and the slave stamp
+    // as it ended. Account for the time spent clocking the frame (10 bits per
+    // byte on a UART)
+    //
+    uint32_t transferTime = (mUartPort == UART_NUM_MAX)
+        ? static_cast<uint32_t>(static_cast<uint64_t>(mBufferSize) * 8 * 1000000 / mSpiClock)
+        : static_cast<uint32_t>(static_cast<uint64_t>(UART_COMMAND_FRAME_SIZE) * 10 * 1000000 / mUartBaud);
+    long sample = static_cast<int32_t>(masterTime + transferTime - slaveTime);
+
+    if (mWindowSamples == 0)
+    {
+        mWindowMaxOffset = sample;
+        mWindowMinOffset = sample;
+    }
+    mWindowMaxOffset = max(mWindowMaxOffset, sample);
+    mWindowMinOffset = min(mWindowMinOffset, sample);
+
+    if (++mWindowSamples < SYNC_WINDOW)
+    {
+        return;
+    }
+
+    if (!mClockSynced)
+    {
+        mClockOffset = mWindowMaxOffset;
+        mClockSynced = true;
+        mDriftReferenceTime = millis();
+        mDriftReferenceOffset = mClockOffset;
+        mLastSyncLogTime = mDriftReferenceTime;
+    }
+    else
+    {
+        mClockOffset += (mWindowMaxOffset - mClockOffset) / 4;
+    }
+    mSyncJitter = mWindowMaxOffset - mWindowMinOffset;
+    mWindowSamples = 0;
+
+    //
+    // Log the offset and drift regularly so the sync can be checked over long sessions
+    //
+    if (millis() - mLastSyncLogTime >= SYNC_LOG_INTERVAL_MS)
+    {
+        mLastSyncLogTime = millis();
+
+        Serial.print("Clock sync slave "); Serial.print(mId);
+        Serial.print(" | Offset (us): "); Serial.print(mClockOffset);
+        Serial.print(" | Drift (ppm): "); Serial.print(GetClockDrift());
+        Serial.print(" | Jitter (us): "); Serial.print(mSyncJitter);
+        Serial.println();
+    }
+}
+
+/**
+ * @brief Forget the clock offset with this slave and measure it from scratch
+ */
+void Slave::ResetClockSync()
+{
+    mClockSynced = false;
+    mClockOffset = 0;
+    mLastSyncMasterTime = 0;
+    mWindowSamples = 0;
+}
+
+/**
+ * @brief Returns whether the link with this slave is being described or trained
+ *
+ * The set-up then needs a frame on every pass, so the bus must not throttle it
+ * like the probes of an absent slave
+ */
+bool Slave::IsLinkStarting() const
+{
+    return !mLinkUp && mLinkStage != Probing;
+}
+
+/**
+ * @brief Bring the SPI link with this slave up, one blocking frame per call
+ *
+ * The slave announces readiness by setting the ready header on the frames it
+ * clocks out. As soon as one is seen, the slave is asked for its descriptor
+ * and the link is trained. Each of these steps takes many frames, so only one
+ * of them is clocked per call, and none if the last one was less than
+ * TRAINING_INTERVAL_US ago. The other slaves and the rest of the main loop
+ * are then never held up by more than one short frame. Meant to be called on
+ * every pass of the main loop until the link comes up
+ * @return True if the link with this slave is up and false otherwise
+ */
+bool Slave::Handshake()
+{
+    if (mLinkUp)
+    {
+        return true;
+    }
+
+    if (mIncompatible || mDevice == nullptr)
+    {
+        return false;
+    }
+
+    if (mLinkStage != Probing && micros() - mLastSetupFrameTime < TRAINING_INTERVAL_US)
+    {
+        return false;
+    }
+
+    switch (mLinkStage)
+    {
+        case Probing:
+        {
+            memset(mTransmitBuffer, CMD_NONE, mBufferSize);
+            TransferBlocking(mSpiClock);
+
+            //
+            // A slave left in training by a previous master session still counts as ready
+            //
+            bool ready = mReceiveBuffer[0] == FRAME_READY || IsTrainingPattern(mReceiveBuffer, mBufferSize);
+            memset(mReceiveBuffer, 0, mBufferSize);
+
+            if (ready)
+            {
+                mDescribed = false;
+                mSetupAttempts = 0;
+                mSetupStartTime = micros();
+                mLastSetupFrameTime = mSetupStartTime;
+                mLinkStage = Describing;
+            }
+            break;
+        }
+
+        case Describing:
+            DescribeStep();
+            break;
+
+        default:
+            TrainStep();
+            break;
+    }
+    return mLinkUp;
+}
+
+/**
+ * @brief Queue a link command to push down to this slave during the next polls
+ *
+ * The command rides along with every poll until a frame from the slave
+ * acknowledges it, so the scan on the slave never has to pause for it
+ * @param command The link command to send (see Protocol.h)
+ * @param target The key the command applies to, or CMD_ALL_KEYS
+ * @param value The argument of the command
+ * @return True if the command was queued and false if the queue is full
+ */
+bool Slave::SendCommand(const uint8_t command, const uint8_t target, const uint32_t value)
+{
+    if (mCommandCount == COMMAND_QUEUE_SIZE)
+    {
+        return false;
+    }
+
+    Command& queued = mCommands[(mCommandHead + mCommandCount) % COMMAND_QUEUE_SIZE];
+    queued.command = command;
+    queued.id = mNextCommandId;
+    queued.target = target;
+    queued.value = value;
+    mCommandCount++;
+
+    //
+    // ID 0 means "no command applied yet" on the slave side, so skip it
+    //
+    mNextCommandId = (mNextCommandId == 255) ? 1 : mNextCommandId + 1;
+
+    return true;
+}
+
+/**
+ * @brief Get the number of link commands still waiting to be acknowledged by this slave
+ */
+size_t Slave::GetPendingCommandCount() const
+{
+    return mCommandCount;
+}
+
+/**
+ * @brief Clock one frame of the training of the SPI link with this slave
+ *
+ * The master asks the slave to serve a known test pattern, then steps up the
+ * SPI clock one rung at a time. A rung passes only if every frame polled at
+ * that clock matches the pattern. The clock settled on is the highest passing
+ * rung less a safety margin, so boards with short traces get the full bandwidth
+ * while flaky ones still work. If the slave never serves the pattern, this slave
+ * keeps the slowest clock of the training ladder
+ */
+void Slave::TrainStep()
+{
+    switch (mLinkStage)
+    {
+        case TrainingSync:
+            //
+            // Wait for the slave to switch to the training pattern at the slowest
+            // clock. The slave only acts on the command after the transaction
+            // carrying it, so at least one poll always comes back with stale data
+            //
+            if (TransferTrainingFrame(TRAINING_CLOCKS[0], CMD_TRAIN_BEGIN))
+            {
+                mTrainingRung = 1;
+                mTrainingRound = 0;
+                mHighestPassing = 0;
+                mLinkStage = TrainingClimb;
+            }
+            else if (++mSetupAttempts == TRAINING_SYNC_ATTEMPTS)
+            {
+                mSpiClock = TRAINING_CLOCKS[0];
+                Serial.print("SPI training failed for slave "); Serial.print(mId);
+                Serial.print(" | Falling back to: "); Serial.print(mSpiClock); Serial.println(" Hz");
+                CompleteLink();
+            }
+            break;
+
+        case TrainingClimb:
+            //
+            // Climb the ladder until a rung corrupts a frame. Keep sending the begin
+            // command so that a slave which resets mid-training rejoins straight away
+            //
+            if (!TransferTrainingFrame(TRAINING_CLOCKS[mTrainingRung], CMD_TRAIN_BEGIN))
+            {
+                SettleSpiClock();
+            }
+            else if (++mTrainingRound == TRAINING_ROUNDS)
+            {
+                mHighestPassing = mTrainingRung++;
+                mTrainingRound = 0;
+
+                if (mTrainingRung == TRAINING_CLOCK_COUNT)
+                {
+                    SettleSpiClock();
+                }
+            }
+            break;
+
+        case TrainingRelease:
+            //
+            // Release the slave from training. Once a poll returns something other
+            // than the pattern, the slave is back to serving key updates
+            //
+            if (!TransferTrainingFrame(mSpiClock, CMD_TRAIN_END) || ++mSetupAttempts == TRAINING_SYNC_ATTEMPTS)
+            {
+                memset(mTransmitBuffer, CMD_NONE, mBufferSize);
+
+                Serial.print("SPI training complete for slave "); Serial.print(mId);
+                Serial.print(" | Highest passing: "); Serial.print(TRAINING_CLOCKS[mHighestPassing]);
+                Serial.print(" Hz | Settled on: "); Serial.print(mSpiClock); Serial.println(" Hz");
+
+                CompleteLink();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Settle on the highest passing rung less the safety margin, and release the slave from training
+ */
+void Slave::SettleSpiClock()
+{
+    int settled = max(static_cast<int>(mHighestPassing) - TRAINING_SAFETY_MARGIN, 0);
+
+    mSpiClock = TRAINING_CLOCKS[settled];
+    mSetupAttempts = 0;
+    mLinkStage = TrainingRelease;
+}
+
+/**
+ * @brief Mark the link with this slave up once it has been described and trained
+ */
+void Slave::CompleteLink()
+{
+    memset(mReceiveBuffer, 0, mBufferSize);
+    mLinkStage = Probing;
+
+    mLinkUp = true;
+    mLastSequence = -1;
+    ResetClockSync();
+    mLinkUpTime = micros();
+    mLastFrameTime = mLinkUpTime;
+
+    Serial.print("SPI link up with slave "); Serial.print(mId);
+    Serial.print(" | Set-up (us): "); Serial.print(mLinkUpTime - mSetupStartTime);
+    Serial.print(" | Since boot (us): "); Serial.print(mLinkUpTime);
+    Serial.println();
+
+    SendCommand(CMD_TIME_SYNC, 0, micros());
+}
+
+/**
+ * @brief Send a training command to the slave and check the frame clocked back
+ * @param spiClock The SPI clock to poll the slave at
+ * @param command The link command to send to the slave
+ * @return True if the received frame matches the training pattern and false otherwise
+ */
+bool Slave::TransferTrainingFrame(const uint32_t spiClock, const uint8_t command)
+{
+    TransferCommandFrame(spiClock, command);
+    return IsTrainingPattern(mReceiveBuffer, mBufferSize);
+}
+
+/**
+ * @brief Send a command that carries no ID to the slave, and leave the slave's frame in the receive buffer
+ * @param spiClock The SPI clock to poll the slave at
+ * @param command The link command to send to the slave
+ */
+void Slave::TransferCommandFrame(const uint32_t spiClock, const uint8_t command)
+{
+    memset(mTransmitBuffer, CMD_NONE, mBufferSize);
+    mTransmitBuffer[0] = command;
+
+    TransferBlocking(spiClock);
+
+    mLastSetupFrameTime = micros();
+}
+
+
+/**
+ * @brief Clock one frame asking the slave for its descriptor, at the slowest clock of the training ladder
+ *
+ * The slave serves its descriptor until the master starts training the link, so
+ * training only starts once it has arrived or the slave has been asked often
+ * enough. A slave built with another frame format is never trained
+ */
+void Slave::DescribeStep()
+{
+    TransferCommandFrame(TRAINING_CLOCKS[0], CMD_DESCRIBE);
+
+    if (mReceiveBuffer[0] == FRAME_DESCRIPTOR)
+    {
+        if (!ApplyDescriptor(DecodeDescriptor(mReceiveBuffer)))
+        {
+            mLinkStage = Probing;
+            return;
+        }
+    }
+    else if (++mSetupAttempts < TRAINING_SYNC_ATTEMPTS)
+    {
+        return;
+    }
+    else
+    {
+        Serial.print("No descriptor from slave "); Serial.print(mId);
+        Serial.print(" | Keeping built-in key count: "); Serial.println(mKeyCount);
+    }
+
+    mSetupAttempts = 0;
+    mLinkStage = TrainingSync;
+}
+
+/**
+ * @brief Size this slave's buffers and decoders from the descriptor its peer reported
+ * @param descriptor The descriptor reported by the slave
+ * @return False if the slave was built with another frame format, and true otherwise
+ */
+bool Slave::ApplyDescriptor(const SlaveDescriptor& descriptor)
+{
+    if (descriptor.version != PROTOCOL_VERSION)
+    {
+        mIncompatible = true;
+        Serial.print("Slave "); Serial.print(mId);
+        Serial.print(" speaks protocol version "); Serial.print(descriptor.version);
+        Serial.print(" instead of "); Serial.print(PROTOCOL_VERSION);
+        Serial.println(" | Reflash it and reset the master");
+        return false;
+    }
+
+    mDescriptor = descriptor;
+    mDescribed = true;
+
+    //
+    // Notes above 127 do not exist, and would wrap onto the lowest notes once
+    // masked to 7 bits, so a board described past the top of the MIDI range
+    // only keeps the keys that fit. Events of the other keys are skipped
+    //
+    int fittingKeys = max(0, MIDI_NOTE_MAX + 1 - static_cast<int>(descriptor.startNote));
+
+    if (descriptor.keyCount > fittingKeys)
+    {
+        mDescriptor.keyCount = static_cast<uint8_t>(fittingKeys);
+
+        Serial.print("Slave "); Serial.print(mId);
+        Serial.print(" describes notes past "); Serial.print(MIDI_NOTE_MAX);
+        Serial.print(" | Start note: "); Serial.print(descriptor.startNote);
+        Serial.print(" | Keys: "); Serial.print(descriptor.keyCount);
+        Serial.print(" | Keeping: "); Serial.println(fittingKeys);
+    }
+    mKeyCount = mDescriptor.keyCount;
+
+    delete[] mDescribedNotes;
+    mDescribedNotes = new uint8_t [mKeyCount];
+
+    for (int i = 0; i < mKeyCount; i++)
+    {
+        mDescribedNotes[i] = static_cast<uint8_t>(descriptor.startNote + i);
+    }
+    mNotes = mDescribedNotes;
+
+    //
+    // Over SPI, both sides must clock frames of the same size. Over UART, frames
+    // carry their own size and always fit the receive buffer
+    //
+    size_t frameSize = max(static_cast<size_t>(descriptor.frameSize), static_cast<size_t>(FRAME_HEADER_SIZE));
+    mMaxEvents = min(static_cast<size_t>(descriptor.maxEvents), (frameSize - FRAME_HEADER_SIZE) / FRAME_EVENT_SIZE);
+
+    if (mUartPort == UART_NUM_MAX && frameSize != mBufferSize)
+    {
+        ResizeBuffers(frameSize);
+    }
+    else if (mUartPort != UART_NUM_MAX)
+    {
+        mMaxEvents = min(mMaxEvents, static_cast<size_t>(FRAME_MAX_EVENTS));
+    }
+
+    Serial.print("Slave "); Serial.print(mId); Serial.print(" described");
+    Serial.print(" | Keys: "); Serial.print(mKeyCount);
+    Serial.print(" | Notes: "); Serial.print(descriptor.startNote);
+    Serial.print(" - "); Serial.print(descriptor.startNote + mKeyCount - 1);
+    Serial.print(" | Sensor: "); Serial.print(descriptor.sensorType);
+    Serial.print(" | Frame (bytes): "); Serial.print(descriptor.frameSize);
+    Serial.print(" | Max scan rate (Hz): "); Serial.print(descriptor.maxScanRate);
+    Serial.println();
+
+    return true;
+}
+
+/**
+ * @brief Set up the UART link this slave pushes its frames on, instead of SPI polling
+ *
+ * The driver is set to post an event on the receive timeout, ie. once the line
+ * has been idle for a couple of symbols after a frame, so each frame from the
+ * slave is handed over by a single interrupt rather than byte by byte
+ * @param port The UART connected to the slave
+ * @param txPin The pin the master sends command frames on
+ * @param rxPin The pin the slave's frames arrive on
+ * @param baud The baud rate of the link
+ */
+void Slave::SetUartParameters(const uart_port_t port, const int txPin, const int rxPin, const uint32_t baud)
+{
+    mUartPort = port;
+    mUartBaud = baud;
+    mBufferSize = UART_FRAME_MAX_SIZE;
+
+    uart_config_t config = {};
+    config.baud_rate = static_cast<int>(baud);
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    config.source_clk = UART_SCLK_DEFAULT;
+
+    uart_driver_install(port, UART_DRIVER_BUFFER_SIZE, UART_DRIVER_BUFFER_SIZE, UART_EVENT_QUEUE_SIZE, &mUartQueue, 0);
+    uart_param_config(port, &config);
+    uart_set_pin(port, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    uart_set_rx_timeout(port, 2);
+
+    Serial.print("UART link setup complete for slave "); Serial.print(mId);
+    Serial.print(" | Baud: "); Serial.println(baud);
+}
+
+/**
+ * @brief Exchange frames with this slave over the UART link
+ *
+ * Replaces Handshake() and querySPIPeerOnOtherSide() when the link is a UART.
+ * The slave pushes frames on its own, so this only collects the frames received
+ * since the last call and pushes a command frame at a fixed interval. Command
+ * frames carry the master time for clock sync, so they are sent even when no
+ * command is waiting
+ */
+void Slave::ServiceUartLink()
+{
+    if (mUartPort == UART_NUM_MAX)
+    {
+        return;
+    }
+
+    ReceiveUartFrames();
+
+    unsigned long now = micros();
+
+    if (now - mLastCommandFrameTime >= UART_COMMAND_INTERVAL_US)
+    {
+        mLastCommandFrameTime = now;
+        SendUartCommandFrame();
+    }
+
+    if (mLinkUp && now - mLastFrameTime > LINK_TIMEOUT_US)
+    {
+        mLinkUp = false;
+        Serial.print("UART link lost with slave "); Serial.println(mId);
+    }
+}
+
+/**
+ * @brief Push the oldest unacknowledged link command, or none, down to the slave over UART
+ */
+void Slave::SendUartCommandFrame()
+{
+    uint8_t frame[UART_COMMAND_FRAME_SIZE] {0};
+    uint8_t* command = frame + 1;
+
+    frame[0] = UART_COMMAND_HEADER;
+
+    //
+    // Ask for the descriptor until it arrives, ahead of any other command
     //
-    mSpi->beginTransaction(SPISettings(mSpiClock, MSBFIRST, SPI_MODE0));
-    digitalWrite(static_cast<uint8_t>(mSpi->pinSS()), LOW);
-    mSpi->transferBytes(NULL, mReceiveBuffer, mBufferSize);
-    digitalWrite(mSpi->pinSS(), HIGH);
-    mSpi->endTransaction();
+    if (mLinkUp && !mDescribed)
+    {
+        command[0] = CMD_DESCRIBE;
+    }
+    else if (mCommandCount > 0)
+    {
+        const Command& pending = mCommands[mCommandHead];
+        EncodeCommand(command, pending.command, pending.id, pending.target, pending.value);
+    }
+
+    WriteUint32(command + CMD_SYNC_INDEX, micros());
+    frame[UART_COMMAND_FRAME_SIZE - UART_CRC_SIZE] = Crc8(frame, UART_COMMAND_FRAME_SIZE - UART_CRC_SIZE);
+
+    uart_write_bytes(mUartPort, frame, UART_COMMAND_FRAME_SIZE);
+}
+
+/**
+ * @brief Parse the frames the slave pushed over UART since the last call
+ */
+void Slave::ReceiveUartFrames()
+{
+    uart_event_t event;
+
+    while (xQueueReceive(mUartQueue, &event, 0) == pdTRUE)
+    {
+        if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL)
+        {
+            //
+            // Bytes were lost, so whatever is buffered can no longer be trusted
+            //
+            uart_flush_input(mUartPort);
+            xQueueReset(mUartQueue);
+            mUartReceiveLength = 0;
+            return;
+        }
+
+        if (event.type != UART_DATA)
+        {
+            continue;
+        }
+
+        unsigned long now = micros();
+        size_t pending = event.size;
+
+        while (pending > 0)
+        {
+            size_t space = sizeof(mUartReceiveBuffer) - mUartReceiveLength;
+            int received = uart_read_bytes(mUartPort, mUartReceiveBuffer + mUartReceiveLength, min(pending, space), 0);
+
+            if (received <= 0)
+            {
+                break;
+            }
+            pending -= received;
+            mUartReceiveLength += received;
+
+            //
+            // Use every complete frame in the buffer and skip any byte that does not
+            // start one, so the parser locks back onto the frames after line noise
+            //
+            size_t start = 0;
+            int size = 0;
+
+            while (start < mUartReceiveLength)
+            {
+                uint8_t header = (mUartReceiveBuffer[start] == FRAME_DESCRIPTOR) ? FRAME_DESCRIPTOR : FRAME_READY;
+                size = ParseUartFrame(mUartReceiveBuffer + start, mUartReceiveLength - start, header);
+
+                if (size == 0)
+                {
+                    break;
+                }
+
+                if (size < 0 || mIncompatible)
+                {
+                    start += (size < 0) ? 1 : size;
+                    continue;
+                }
+
+                if (header == FRAME_DESCRIPTOR)
+                {
+                    ApplyDescriptor(DecodeDescriptor(mUartReceiveBuffer + start));
+                    start += size;
+                    continue;
+                }
+
+                if (!mLinkUp)
+                {
+                    mLinkUp = true;
+                    mDescribed = false;
+                    mLastSequence = -1;
+                    ResetClockSync();
+                    mLinkUpTime = now;
+
+                    Serial.print("UART link up with slave "); Serial.print(mId);
+                    Serial.print(" | Since boot (us): "); Serial.print(mLinkUpTime);
+                    Serial.println();
+
+                    SendCommand(CMD_TIME_SYNC, 0, now);
+                }
+
+                ProcessFrame(mUartReceiveBuffer + start, now);
+                start += size;
+            }
+
+            memmove(mUartReceiveBuffer, mUartReceiveBuffer + start, mUartReceiveLength - start);
+            mUartReceiveLength -= start;
+        }
+    }
 }
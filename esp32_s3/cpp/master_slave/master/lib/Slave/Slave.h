@@ -11,7 +11,9 @@
 #define SLAVE_H
 
 #include <Arduino.h>
-#include <SPI.h>
+#include <driver/spi_master.h>
+#include <driver/uart.h>
+#include <Protocol.h>
 
 class Slave
 {
@@ -20,15 +22,127 @@ class Slave
         int mId = 0;                       ///< ID of this slave
         int mKeyCount = 0;                 ///< Number of keys monitored by this slave
         const uint8_t* mNotes = nullptr;   ///< Notes (pitches) associated with the keys monitored by this slave
+        uint8_t* mDescribedNotes = nullptr; ///< Notes built from the slave's descriptor, owned by this object
+
+        // ---------------------------------- Descriptor -------------------------------
+
+        SlaveDescriptor mDescriptor {};    ///< The capabilities reported by the slave at link-up
+        bool mDescribed = false;           ///< Has the slave described itself since the link came up?
+        bool mIncompatible = false;        ///< Was the slave built with another PROTOCOL_VERSION?
+        size_t mMaxEvents = FRAME_MAX_EVENTS; ///< Number of events that fit in one of the slave's frames
  
         // ------------------- SPI Commmunication Objects & Variables ------------------
 
-        SPIClass* mSpi = nullptr;          ///< The SPI object that this slave object uses to communicate with the other side
-        uint32_t mSpiClock = 1000000;       ///< The clock speed for this slave's SPI object
-        uint8_t mSpiBitOrder = MSBFIRST;   ///< The bit order for this slave's SPI object
-        uint8_t mSpiDateMode = SPI_MODE0;  ///< The data mode for this slave's SPI object
-        size_t mBufferSize = 0;            ///< The size of the reception buffer for this slave
-        uint8_t* mReceiveBuffer = nullptr; ///< The buffer that this slave receives 
+        static constexpr size_t POLL_BUFFER_COUNT = 2;  ///< Frames in flight at once: one transferring, one decoding
+
+        spi_host_device_t mHost = SPI2_HOST;     ///< The SPI bus (GP-SPI2/GP-SPI3) this slave is wired to
+        spi_device_handle_t mDevice = nullptr;   ///< This slave as a device on its bus. The peripheral drives its CS
+        int mCsPin = -1;                         ///< The chip select pin of this slave
+        uint32_t mSpiClock = 1000000;            ///< The clock speed this slave is polled at
+        uint32_t mDeviceClock = 0;               ///< The clock speed the device was last added to the bus with
+        uint8_t mSpiDataMode = 0;                ///< The data mode (0 - 3) of this slave's SPI link
+        size_t mBufferSize = 0;                  ///< The size of the frames exchanged with this slave (multiple of 4)
+
+        uint8_t* mReceiveBuffers[POLL_BUFFER_COUNT] {nullptr};   ///< DMA capable buffers the slave's frames land in
+        uint8_t* mTransmitBuffers[POLL_BUFFER_COUNT] {nullptr};  ///< DMA capable buffers carrying link commands to the slave
+        spi_transaction_t mTransactions[POLL_BUFFER_COUNT] {};   ///< One DMA transaction per pair of buffers
+        size_t mNextBuffer = 0;                  ///< Index of the buffers the next poll is queued on
+        bool mPollInFlight = false;              ///< Is a poll queued with the SPI driver and not collected yet?
+
+        int mDataReadyPin = -1;                  ///< The input wired to the slave's data-ready line, or -1 to poll on every pass
+        volatile bool mDataReadyEdge = false;    ///< Has the data-ready line risen since the last poll was queued?
+        unsigned long mLastPollTime = 0;         ///< Time at which the last poll was queued, in microseconds
+        uint32_t mPollCount = 0;                 ///< Number of polls queued since boot
+
+        uint8_t* mReceiveBuffer = nullptr;       ///< The first receive buffer, used by the blocking transfers at link-up
+        uint8_t* mTransmitBuffer = nullptr;      ///< The first transmit buffer, used by the blocking transfers at link-up
+
+        // ------------------- UART Communication Objects & Variables ------------------
+
+        uart_port_t mUartPort = UART_NUM_MAX;      ///< The UART the peer pushes its frames on, or UART_NUM_MAX over SPI
+        uint32_t mUartBaud = UART_LINK_BAUD;       ///< The baud rate of the UART link
+        QueueHandle_t mUartQueue = nullptr;        ///< Events posted by the UART driver (one per received frame)
+        uint8_t mUartReceiveBuffer[2 * UART_FRAME_MAX_SIZE]; ///< Bytes received over UART and not parsed yet
+        size_t mUartReceiveLength = 0;             ///< Number of bytes in mUartReceiveBuffer
+        unsigned long mLastCommandFrameTime = 0;   ///< Time at which the last command frame was pushed to the peer
+
+        // ------------------------------- Link State ----------------------------------
+
+        bool mLinkUp = false;              ///< Has the peer announced itself ready and been trained?
+
+        /// Steps of bringing the SPI link up, one frame per call to Handshake()
+        enum LinkStage : uint8_t {Probing, Describing, TrainingSync, TrainingClimb, TrainingRelease};
+
+        LinkStage mLinkStage = Probing;    ///< The step the link set-up is at
+        int mSetupAttempts = 0;            ///< Frames spent on the current step
+        size_t mTrainingRung = 0;          ///< The rung of the training ladder being tried
+        int mTrainingRound = 0;            ///< Clean frames seen on that rung so far
+        size_t mHighestPassing = 0;        ///< Highest rung that passed so far
+        unsigned long mSetupStartTime = 0; ///< Time at which the slave answered the probe, in microseconds
+        unsigned long mLastSetupFrameTime = 0; ///< Time at which the last set-up frame was clocked, in microseconds
+        unsigned long mLastFrameTime = 0;  ///< Time at which the last frame with the ready header arrived
+        unsigned long mLinkUpTime = 0;     ///< Time since boot at which the link came up, in microseconds
+        int mLastSequence = -1;            ///< Sequence number of the last frame used, or -1 if none yet
+
+        // ------------------------------- Link Commands -------------------------------
+
+        /// A link command waiting to be acknowledged by the peer
+        struct Command
+        {
+            uint8_t command;
+            uint8_t id;
+            uint8_t target;
+            uint32_t value;
+        };
+
+        static constexpr size_t COMMAND_QUEUE_SIZE = 8;  ///< Number of link commands that can wait at once
+
+        Command mCommands[COMMAND_QUEUE_SIZE];   ///< Ring buffer of link commands waiting to be acknowledged
+        size_t mCommandHead = 0;                 ///< Index of the command currently sent on every poll
+        size_t mCommandCount = 0;                ///< Number of commands waiting
+        uint8_t mNextCommandId = 1;              ///< ID given to the next command queued (1 - 255)
+
+        // ------------------------- Key Events & Clock Sync ---------------------------
+
+        static constexpr size_t EVENT_QUEUE_SIZE = 32;  ///< Number of key events that can wait to be sent at once
+
+        KeyEvent mEvents[EVENT_QUEUE_SIZE];      ///< Ring buffer of key events waiting to be sent, stamped in master time
+        size_t mEventHead = 0;                   ///< Index of the oldest key event waiting
+        size_t mEventCount = 0;                  ///< Number of key events waiting
+        uint32_t mDroppedEvents = 0;             ///< Number of key events lost to a full queue
+
+        bool mClockSynced = false;               ///< Has a clock offset been measured for this slave yet?
+        long mClockOffset = 0;                   ///< Master time minus slave time, in microseconds
+        uint32_t mLastSyncMasterTime = 0;        ///< The last master time echoed back by the slave
+        int mWindowSamples = 0;                  ///< Number of offset samples taken in the current window
+        long mWindowMaxOffset = 0;               ///< Largest offset sampled in the current window
+        long mWindowMinOffset = 0;               ///< Smallest offset sampled in the current window
+        long mSyncJitter = 0;                    ///< Spread of the offset samples in the last window
+        unsigned long mDriftReferenceTime = 0;   ///< Time at which the clocks were first synced, in milliseconds
+        long mDriftReferenceOffset = 0;          ///< Clock offset when the clocks were first synced
+        unsigned long mLastSyncLogTime = 0;      ///< Time at which the clock sync was last logged, in milliseconds
+
+        bool TransferTrainingFrame(const uint32_t spiClock, const uint8_t command);
+        void TransferCommandFrame(const uint32_t spiClock, const uint8_t command);
+        void DescribeStep();
+        void TrainStep();
+        void SettleSpiClock();
+        void CompleteLink();
+        bool ApplyDescriptor(const SlaveDescriptor& descriptor);
+        void ResizeBuffers(const size_t bufferSize);
+        void FreeBuffers();
+        bool AddDevice(const uint32_t spiClock);
+        void TransferBlocking(const uint32_t spiClock);
+        bool ShouldPoll() const;
+        void QueuePoll();
+        void WaitForPoll();
+        void ProcessFrame(const uint8_t* frame, const unsigned long now);
+        void SendUartCommandFrame();
+        void ReceiveUartFrames();
+        void UpdateClockSync(const uint32_t masterTime, const uint32_t slaveTime);
+        void ResetClockSync();
+
+        static void IRAM_ATTR OnDataReady(void* slave);
 
     public:
 
@@ -39,19 +153,39 @@ class Slave
         void SetId(const int id);
         void SetKeyCount(int keyCount);
         void SetNotes(const uint8_t* notes);
-        void SetSpi(SPIClass* spi);
-        void SetReceiveBuffer(uint8_t* receiveBuffer);
 
         // ----------------------------------- Getters ---------------------------------
         int GetId() const;
         int GetKeyCount() const;
         const uint8_t* GetNotes() const;
-        SPIClass* GetSpi() const;
+        spi_host_device_t GetHost() const;
         uint8_t* GetReceiveBuffer() const;
+        bool IsDescribed() const;
+        const SlaveDescriptor& GetDescriptor() const;
+        uint32_t GetSpiClock() const;
+        bool IsLinkUp() const;
+        unsigned long GetLinkUpTime() const;
+        size_t GetEventCount() const;
+        uint32_t GetDroppedEventCount() const;
+        uint32_t GetPollCount() const;
+        bool IsDataReady() const;
+        bool IsClockSynced() const;
+        long GetClockOffset() const;
+        float GetClockDrift() const;
     
         // --------------------------------- Core Methods ------------------------------
-        void SetSpiParameters(SPIClass* spi, uint32_t spiClock, uint8_t bitOrder, uint8_t dataMode, const size_t bufferSize, uint8_t* receiveBuffer);
+        bool SetSpiParameters(const spi_host_device_t host, const int csPin, const uint32_t spiClock, const uint8_t dataMode,
+                              const size_t bufferSize);
+        void SetDataReadyPin(const int pin);
         void querySPIPeerOnOtherSide();
+        bool Handshake();
+        bool IsLinkStarting() const;
+        void SetUartParameters(const uart_port_t port, const int txPin, const int rxPin, const uint32_t baud);
+        void ServiceUartLink();
+        bool SendCommand(const uint8_t command, const uint8_t target, const uint32_t value);
+        size_t GetPendingCommandCount() const;
+        const KeyEvent& PeekEvent() const;
+        void PopEvent();
 
         Slave() = delete;                        ///< Default constructor disabled 
         Slave(const Slave &) = delete;           ///< Copy constructor disabled
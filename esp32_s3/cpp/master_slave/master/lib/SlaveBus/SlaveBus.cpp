@@ -0,0 +1,287 @@
+/**
+ * @file SlaveBus.cpp
+ * @author Mate Narh
+ */
+
+#include "SlaveBus.h"
+
+static constexpr int SPI_MAX_TRANSFER_SIZE = 1024;       ///< Largest frame a slave may describe, in bytes
+static constexpr size_t SPI3_MAX_SLAVES = 3;             ///< Hardware chip selects of GP-SPI3
+static constexpr unsigned long PROBE_INTERVAL_US = 10000; ///< Time between two probes of a slave whose link is down
+
+/**
+ * @brief Constructor
+ * @param host The SPI peripheral driving this bus (SPI2_HOST/SPI3_HOST)
+ */
+SlaveBus::SlaveBus(const spi_host_device_t host) : mHost(host)
+{
+    mMaxSlaves = (host == SPI3_HOST) ? SPI3_MAX_SLAVES : MAX_SLAVES;
+}
+
+/**
+ * @brief Set how the slaves to service are picked on each pass
+ * @param schedule SCHEDULE_ROUND_ROBIN or SCHEDULE_PRIORITY
+ */
+void SlaveBus::SetSchedule(const uint8_t schedule)
+{
+    mSchedule = schedule;
+}
+
+/**
+ * @brief Set the number of slaves serviced on each pass of the main loop
+ *
+ * Bounds the time one pass spends on this bus. With round robin, each slave is
+ * then serviced at least once every ceil(slaves / pollsPerPass) passes
+ * @param pollsPerPass The number of slaves to service per pass (0 = all of them)
+ */
+void SlaveBus::SetPollsPerPass(const size_t pollsPerPass)
+{
+    mPollsPerPass = pollsPerPass;
+}
+
+/**
+ * @brief Get the SPI peripheral driving this bus
+ */
+spi_host_device_t SlaveBus::GetHost() const
+{
+    return mHost;
+}
+
+/**
+ * @brief Get the number of slaves on this bus
+ */
+size_t SlaveBus::GetSlaveCount() const
+{
+    return mSlaveCount;
+}
+
+/**
+ * @brief Get one of the slaves on this bus
+ * @param index The index of the slave, in the order the slaves were added
+ * @return The slave, or nullptr if there is no slave at that index
+ */
+Slave* SlaveBus::GetSlave(const size_t index) const
+{
+    return (index < mSlaveCount) ? mEntries[index].slave : nullptr;
+}
+
+/**
+ * @brief Get the number of polls queued on this bus since boot, over all its slaves
+ */
+uint32_t SlaveBus::GetPollCount() const
+{
+    uint32_t polls = 0;
+
+    for (size_t i = 0; i < mSlaveCount; i++)
+    {
+        polls += mEntries[i].slave->GetPollCount();
+    }
+    return polls;
+}
+
+/**
+ * @brief Set the bus up with the SPI driver. Must be called before any slave is added
+ * @param sclkPin The clock pin of the bus
+ * @param misoPin The MISO pin of the bus, shared by all slaves
+ * @param mosiPin The MOSI pin of the bus, shared by all slaves
+ * @return True if the bus is ready and false otherwise
+ */
+bool SlaveBus::Initialize(const int sclkPin, const int misoPin, const int mosiPin)
+{
+    spi_bus_config_t bus = {};
+    bus.mosi_io_num = mosiPin;
+    bus.miso_io_num = misoPin;
+    bus.sclk_io_num = sclkPin;
+    bus.quadwp_io_num = -1;
+    bus.quadhd_io_num = -1;
+    bus.max_transfer_sz = SPI_MAX_TRANSFER_SIZE;
+
+    mInitialized = spi_bus_initialize(mHost, &bus, SPI_DMA_CH_AUTO) == ESP_OK;
+
+    if (!mInitialized)
+    {
+        Serial.print("SPI bus setup failed for host "); Serial.println(static_cast<int>(mHost));
+    }
+    return mInitialized;
+}
+
+/**
+ * @brief Add a slave to this bus on a chip select of its own
+ *
+ * Each slave's MISO output must be tri-stated while its chip select is high,
+ * which the ESP32 SPI slave peripheral does, so that the slaves can share MISO
+ * @param slave The slave to add
+ * @param csPin The chip select pin of the slave
+ * @param spiClock The SPI clock to poll the slave at until its link is trained
+ * @param dataMode The data mode for this SPI communication (0 - 3)
+ * @param bufferSize The size of the frames exchanged until the slave describes itself
+ * @param priority Higher is serviced first by the priority schedule when nothing is overdue
+ * @param maxPollInterval Longest time the slave may go without being serviced, in microseconds
+ * @return True if the slave was added and false otherwise
+ */
+bool SlaveBus::AddSlave(Slave* slave, const int csPin, const uint32_t spiClock, const uint8_t dataMode, const size_t bufferSize,
+                        const uint8_t priority, const unsigned long maxPollInterval)
+{
+    if (!mInitialized || slave == nullptr)
+    {
+        return false;
+    }
+
+    if (mSlaveCount == mMaxSlaves)
+    {
+        Serial.print("No chip select left on SPI host "); Serial.print(static_cast<int>(mHost));
+        Serial.print(" for slave "); Serial.println(slave->GetId());
+        return false;
+    }
+
+    if (!slave->SetSpiParameters(mHost, csPin, spiClock, dataMode, bufferSize))
+    {
+        return false;
+    }
+
+    Entry& entry = mEntries[mSlaveCount++];
+    entry.slave = slave;
+    entry.priority = priority;
+    entry.maxPollInterval = maxPollInterval;
+    entry.lastServiceTime = micros();
+    entry.lastProbeTime = 0;
+
+    return true;
+}
+
+/**
+ * @brief Service the slaves picked by the schedule for this pass of the main loop
+ *
+ * A serviced slave is probed if its link is down, and otherwise has the frame of
+ * its last poll collected and its next poll queued. The slaves of one bus share
+ * it, so their polls are clocked out one after the other, in the order they were
+ * queued here. The priority schedule queues the most urgent slave first
+ */
+void SlaveBus::Service()
+{
+    if (mSlaveCount == 0)
+    {
+        return;
+    }
+
+    unsigned long now = micros();
+    size_t budget = (mPollsPerPass == 0) ? mSlaveCount : min(mPollsPerPass, mSlaveCount);
+
+    if (mSchedule == SCHEDULE_ROUND_ROBIN)
+    {
+        for (size_t n = 0; n < budget; n++)
+        {
+            ServiceSlave(mEntries[(mNextSlave + n) % mSlaveCount], now);
+        }
+        mNextSlave = (mNextSlave + budget) % mSlaveCount;
+        return;
+    }
+
+    bool serviced[MAX_SLAVES] {false};
+
+    for (size_t n = 0; n < budget; n++)
+    {
+        int next = PickNext(serviced, now);
+
+        serviced[next] = true;
+        ServiceSlave(mEntries[next], now);
+    }
+}
+
+/**
+ * @brief Returns whether a slave has gone without service for longer than its bound
+ */
+bool SlaveBus::IsOverdue(const Entry& entry, const unsigned long now) const
+{
+    return now - entry.lastServiceTime >= entry.maxPollInterval;
+}
+
+/**
+ * @brief Pick the most urgent slave not serviced yet on this pass
+ *
+ * Overdue slaves come first, the most overdue first, which bounds the time any
+ * slave waits as long as the polls per pass cover the slaves overdue at once.
+ * Then come slaves with key events signalled or a link command waiting, then
+ * the others. Ties go to the higher priority, then to the longest wait
+ * @param serviced Which slaves were already serviced on this pass
+ * @param now The time of this pass, in microseconds
+ * @return The index of the slave to service next
+ */
+int SlaveBus::PickNext(const bool* serviced, const unsigned long now) const
+{
+    int best = -1;
+    int bestRank = 0;
+
+    for (size_t i = 0; i < mSlaveCount; i++)
+    {
+        if (serviced[i])
+        {
+            continue;
+        }
+
+        const Entry& entry = mEntries[i];
+        int rank = IsOverdue(entry, now) ? 2 :
+                   (entry.slave->IsDataReady() || entry.slave->GetPendingCommandCount() > 0) ? 1 : 0;
+
+        if (best < 0 || rank > bestRank)
+        {
+            best = i;
+            bestRank = rank;
+            continue;
+        }
+
+        if (rank < bestRank)
+        {
+            continue;
+        }
+
+        const Entry& current = mEntries[best];
+        unsigned long wait = now - entry.lastServiceTime;
+        unsigned long currentWait = now - current.lastServiceTime;
+
+        //
+        // Among overdue slaves, the one furthest past its bound goes first
+        //
+        if (rank == 2)
+        {
+            if (wait - entry.maxPollInterval > currentWait - current.maxPollInterval)
+            {
+                best = i;
+            }
+        }
+        else if (entry.priority > current.priority || (entry.priority == current.priority && wait > currentWait))
+        {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Probe a slave whose link is down, step the set-up of a link coming up, or poll a slave whose link is up
+ *
+ * Probes are blocking, so a slave that is absent is only probed every
+ * PROBE_INTERVAL_US rather than on every pass, and costs the others next to
+ * nothing. A link coming up clocks one blocking frame per pass until it has
+ * been described and trained, so the others wait at most that one frame
+ * @param entry The slave to service
+ * @param now The time of this pass, in microseconds
+ */
+void SlaveBus::ServiceSlave(Entry& entry, const unsigned long now)
+{
+    entry.lastServiceTime = now;
+
+    if (!entry.slave->IsLinkUp() && !entry.slave->IsLinkStarting())
+    {
+        if (now - entry.lastProbeTime < PROBE_INTERVAL_US)
+        {
+            return;
+        }
+        entry.lastProbeTime = now;
+    }
+
+    if (entry.slave->Handshake())
+    {
+        entry.slave->querySPIPeerOnOtherSide();
+    }
+}
@@ -0,0 +1,81 @@
+/**
+ * @file SlaveBus.h
+ * @author Mate Narh
+ *
+ * Class for the master to run several slaves on one SPI bus. Each slave gets a
+ * chip select of its own, and the bus decides which slaves are serviced on
+ * each pass of the main loop, either in turn (round robin) or by urgency
+ * (priority), so that every slave is polled within a bounded time. A slave
+ * whose link comes up is described and trained one blocking frame per pass, so
+ * even then the others only ever wait for one short frame on top of the bound
+ */
+
+#ifndef SLAVE_BUS_H
+#define SLAVE_BUS_H
+
+#include <Arduino.h>
+#include <driver/spi_master.h>
+#include <Slave.h>
+
+class SlaveBus
+{
+    public:
+
+        static constexpr uint8_t SCHEDULE_ROUND_ROBIN = 0;  ///< Service the slaves in turn
+        static constexpr uint8_t SCHEDULE_PRIORITY = 1;     ///< Service overdue, then data-ready, then high priority slaves first
+
+    private:
+
+        static constexpr size_t MAX_SLAVES = 6;  ///< Hardware chip selects of GP-SPI2. GP-SPI3 only has 3
+
+        /// A slave sharing this bus, with its scheduling state
+        struct Entry
+        {
+            Slave* slave;
+            uint8_t priority;                ///< Higher is serviced first when nothing is overdue
+            unsigned long maxPollInterval;   ///< Longest time the slave may go without being serviced, in microseconds
+            unsigned long lastServiceTime;   ///< Time at which the slave was last serviced, in microseconds
+            unsigned long lastProbeTime;     ///< Time at which the slave was last probed while its link was down
+        };
+
+        spi_host_device_t mHost = SPI2_HOST;  ///< The SPI peripheral (GP-SPI2/GP-SPI3) driving this bus
+        bool mInitialized = false;            ///< Has the bus been set up with the SPI driver?
+
+        Entry mEntries[MAX_SLAVES];           ///< The slaves sharing this bus, in the order they were added
+        size_t mSlaveCount = 0;               ///< Number of slaves on this bus
+        size_t mMaxSlaves = MAX_SLAVES;       ///< Number of chip selects the peripheral drives
+
+        uint8_t mSchedule = SCHEDULE_ROUND_ROBIN;  ///< How the slaves to service are picked on each pass
+        size_t mPollsPerPass = 0;                  ///< Slaves serviced on each pass (0 = all of them)
+        size_t mNextSlave = 0;                     ///< Index of the slave the next round robin pass starts at
+
+        bool IsOverdue(const Entry& entry, const unsigned long now) const;
+        int PickNext(const bool* serviced, const unsigned long now) const;
+        void ServiceSlave(Entry& entry, const unsigned long now);
+
+    public:
+
+        SlaveBus(const spi_host_device_t host);
+
+        // ----------------------------------- Setters ---------------------------------
+        void SetSchedule(const uint8_t schedule);
+        void SetPollsPerPass(const size_t pollsPerPass);
+
+        // ----------------------------------- Getters ---------------------------------
+        spi_host_device_t GetHost() const;
+        size_t GetSlaveCount() const;
+        Slave* GetSlave(const size_t index) const;
+        uint32_t GetPollCount() const;
+
+        // --------------------------------- Core Methods ------------------------------
+        bool Initialize(const int sclkPin, const int misoPin, const int mosiPin);
+        bool AddSlave(Slave* slave, const int csPin, const uint32_t spiClock, const uint8_t dataMode, const size_t bufferSize,
+                      const uint8_t priority = 0, const unsigned long maxPollInterval = 2000);
+        void Service();
+
+        SlaveBus() = delete;                        ///< Default constructor disabled
+        SlaveBus(const SlaveBus &) = delete;        ///< Copy constructor disabled
+        void operator=(const SlaveBus &) = delete;  ///< Assignment operator disabled
+};
+
+#endif // SLAVE_BUS_H
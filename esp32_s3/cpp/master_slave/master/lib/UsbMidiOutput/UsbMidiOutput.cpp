@@ -0,0 +1,451 @@
+/**
+ * @file UsbMidiOutput.cpp
+ * @author Mate Narh
+ */
+
+#include "UsbMidiOutput.h"
+
+#include <tusb.h>
+
+static constexpr unsigned long FLUSH_TIMEOUT_US = 1000;  ///< Longest wait for a start-of-frame before flushing anyway
+
+/// Number of USB start-of-frames seen since the SOF callback was enabled (one per millisecond)
+static volatile uint32_t sofCount = 0;
+
+/**
+ * @brief Count USB start-of-frames. Called by TinyUSB once enabled with tud_sof_cb_enable()
+ * @param frameCount The frame number sent by the host
+ */
+void tud_sof_cb(uint32_t frameCount)
+{
+    (void)frameCount;
+    sofCount = sofCount + 1;
+}
+
+/**
+ * @brief Constructor
+ * @param midi The USB-MIDI interface to write the packets to
+ */
+UsbMidiOutput::UsbMidiOutput(USBMIDI& midi) : mMidi(midi)
+{
+}
+
+/**
+ * @brief Get the number of packets waiting for the next flush
+ */
+size_t UsbMidiOutput::GetPendingCount() const
+{
+    return mNoteCount + mControlCount;
+}
+
+/**
+ * @brief Returns whether the last flush left packets the USB stack had no room for
+ */
+bool UsbMidiOutput::IsCongested() const
+{
+    return mCongested;
+}
+
+/**
+ * @brief Get an estimate of the average number of MIDI events carried by one 64-byte endpoint write
+ *
+ * The USB stack does not report its endpoint writes, so each flush is counted
+ * as the fewest writes its packets fit in. The estimate is an upper bound:
+ * the stack may split a flush over more writes
+ */
+float UsbMidiOutput::GetEstimatedEventsPerTransfer() const
+{
+    return mEstimatedTransfers ? static_cast<float>(mFlushedPackets) / mEstimatedTransfers : 0.0f;
+}
+
+/**
+ * @brief Get the average time the oldest event of a flush waited for it, in microseconds
+ */
+unsigned long UsbMidiOutput::GetAverageFlushLatency() const
+{
+    return mFlushes ? mFlushLatencyTotal / mFlushes : 0;
+}
+
+/**
+ * @brief Get the longest time an event waited for its flush, in microseconds
+ */
+unsigned long UsbMidiOutput::GetMaxFlushLatency() const
+{
+    return mFlushLatencyMax;
+}
+
+/**
+ * @brief Get the number of flushes since the statistics were reset
+ */
+uint32_t UsbMidiOutput::GetFlushCount() const
+{
+    return mFlushes;
+}
+
+/**
+ * @brief Get the largest number of notes that waited at once
+ */
+size_t UsbMidiOutput::GetNoteHighWater() const
+{
+    return mNoteHighWater;
+}
+
+/**
+ * @brief Get the number of notes lost to a full note queue
+ */
+uint32_t UsbMidiOutput::GetNoteOverflowCount() const
+{
+    return mNoteOverflows;
+}
+
+/**
+ * @brief Get the largest number of controllers that waited at once
+ */
+size_t UsbMidiOutput::GetControlHighWater() const
+{
+    return mControlHighWater;
+}
+
+/**
+ * @brief Get the number of controller values replaced by a newer value before being sent
+ */
+uint32_t UsbMidiOutput::GetControlMergeCount() const
+{
+    return mControlMerges;
+}
+
+/**
+ * @brief Get the number of controller values lost because too many controllers were waiting
+ */
+uint32_t UsbMidiOutput::GetControlDropCount() const
+{
+    return mControlDrops;
+}
+
+/**
+ * @brief Get the number of packets discarded because no host was connected
+ */
+uint32_t UsbMidiOutput::GetDisconnectedDropCount() const
+{
+    return mDisconnectedDrops;
+}
+
+/**
+ * @brief Start counting USB start-of-frames. Call after USB.begin()
+ */
+void UsbMidiOutput::Begin()
+{
+    tud_sof_cb_enable(true);
+    mLastFlushFrame = sofCount;
+}
+
+/**
+ * @brief Get the name of this transport, for logs
+ */
+const char* UsbMidiOutput::GetName() const
+{
+    return "USB";
+}
+
+/**
+ * @brief Returns whether a USB host has configured the device
+ */
+bool UsbMidiOutput::IsActive() const
+{
+    return tud_mounted();
+}
+
+/**
+ * @brief Take a message for the next flush
+ *
+ * Notes are refused while the note queue is full, so that they wait upstream
+ * instead of being lost. Controller messages are always taken: they merge
+ * into the value waiting for their controller
+ * @param event The message to send
+ * @return True if the message was taken and false if it should be offered again later
+ */
+bool UsbMidiOutput::Send(const MidiEvent& event)
+{
+    uint8_t type = event.status & 0xF0;
+
+    if (type == 0xB0 || type == 0xE0)
+    {
+        QueueControl(event.status, event.data1, event.data2, type == 0xB0);
+        return true;
+    }
+
+    if (mNoteCount == NOTE_CAPACITY)
+    {
+        return false;
+    }
+
+    QueueNote(event.status, event.data1, event.data2);
+    return true;
+}
+
+/**
+ * @brief Flush the waiting packets if a USB frame has started since the last flush
+ *
+ * Call once per pass of the main loop, after the pass has queued its messages.
+ * If the host sends no start-of-frame (eg. while suspended), the packets are
+ * flushed after FLUSH_TIMEOUT_US instead
+ */
+void UsbMidiOutput::Service()
+{
+    if (GetPendingCount() == 0)
+    {
+        return;
+    }
+
+    if (sofCount != mLastFlushFrame || micros() - mFirstQueuedTime >= FLUSH_TIMEOUT_US)
+    {
+        Flush();
+    }
+}
+
+/**
+ * @brief Hand the waiting packets to the USB stack now, in the order they were queued
+ *
+ * The packets are written back to back, so the stack fills each endpoint
+ * write with up to 16 of them. Writing stops at the first packet the stack has
+ * no room for: the rest stay queued, in order, for the next flush. If the last
+ * flush was already cut short, every waiting note is written before the
+ * controllers. Without a host, the packets are discarded, so that no stale
+ * note is played when one connects
+ */
+void UsbMidiOutput::Flush()
+{
+    mLastFlushFrame = sofCount;
+
+    if (GetPendingCount() == 0)
+    {
+        mCongested = false;
+        return;
+    }
+
+    if (!tud_mounted())
+    {
+        Discard();
+        return;
+    }
+
+    unsigned long latency = micros() - mFirstQueuedTime;
+    size_t written = WritePackets(mCongested);
+
+    mCongested = GetPendingCount() > 0;
+
+    if (written > 0)
+    {
+        mFlushedPackets += written;
+        mEstimatedTransfers += (written + PACKETS_PER_TRANSFER - 1) / PACKETS_PER_TRANSFER;
+        mFlushLatencyTotal += latency;
+        mFlushLatencyMax = max(mFlushLatencyMax, latency);
+        mFlushes++;
+    }
+}
+
+/**
+ * @brief Clear the events per transfer and flush latency statistics
+ */
+void UsbMidiOutput::ResetStatistics()
+{
+    mFlushedPackets = 0;
+    mEstimatedTransfers = 0;
+    mFlushLatencyTotal = 0;
+    mFlushLatencyMax = 0;
+    mFlushes = 0;
+}
+
+/**
+ * @brief Append a note message to the waiting notes, flushing first if the note queue is full
+ * @param status The status byte of the message
+ * @param data1 The first data byte
+ * @param data2 The second data byte
+ */
+void UsbMidiOutput::QueueNote(const uint8_t status, const uint8_t data1, const uint8_t data2)
+{
+    if (mNoteCount == NOTE_CAPACITY)
+    {
+        Flush();
+
+        if (mNoteCount == NOTE_CAPACITY)
+        {
+            mNoteOverflows++;
+            return;
+        }
+    }
+
+    if (GetPendingCount() == 0)
+    {
+        mFirstQueuedTime = micros();
+    }
+
+    //
+    // The code index number of a channel message is its status nibble (cable 0)
+    //
+    midiEventPacket_t& packet = mNotes[(mNoteHead + mNoteCount++) % NOTE_CAPACITY];
+    packet.header = status >> 4;
+    packet.byte1 = status;
+    packet.byte2 = data1;
+    packet.byte3 = data2;
+
+    mLastNoteSequence = mNextSequence++;
+    mNoteSequences[(mNoteHead + mNoteCount - 1) % NOTE_CAPACITY] = mLastNoteSequence;
+
+    mNoteHighWater = max(mNoteHighWater, mNoteCount);
+}
+
+/**
+ * @brief Set the latest value of a controller, replacing the value waiting for it, if any
+ * @param status The status byte of the message
+ * @param data1 The first data byte
+ * @param data2 The second data byte
+ * @param keyedOnData1 Is the controller identified by data1 (CC number) rather than by the status alone (pitch bend)?
+ */
+void UsbMidiOutput::QueueControl(const uint8_t status, const uint8_t data1, const uint8_t data2, const bool keyedOnData1)
+{
+    //
+    // A receiver clears the LSB of a 14-bit controller (CC 32 - 63) when its
+    // MSB (CC 0 - 31) arrives, and the sender follows the MSB with the new LSB
+    // unless it is 0. So a waiting LSB is stale once a new MSB is queued, and
+    // must not be written after it
+    //
+    if (keyedOnData1 && data1 < 32)
+    {
+        for (size_t i = 0; i < mControlCount; i++)
+        {
+            if (mControls[i].byte1 == status && mControls[i].byte2 == data1 + 32)
+            {
+                for (size_t j = i + 1; j < mControlCount; j++)
+                {
+                    mControls[j - 1] = mControls[j];
+                    mControlSequences[j - 1] = mControlSequences[j];
+                }
+                mControlCount--;
+                mControlMerges++;
+                break;
+            }
+        }
+    }
+
+    //
+    // Merge into the latest waiting value of the controller, unless a note was
+    // queued after it: the note must still see the old value (eg. a note-off
+    // under a sustain pedal). While congested, or if there is no room for
+    // another value, the newer value wins anyway
+    //
+    size_t merge = mControlCount;
+
+    for (size_t i = 0; i < mControlCount; i++)
+    {
+        const midiEventPacket_t& waiting = mControls[i];
+
+        if (waiting.byte1 == status && (!keyedOnData1 || waiting.byte2 == data1) &&
+            (merge == mControlCount || static_cast<int32_t>(mControlSequences[i] - mControlSequences[merge]) > 0))
+        {
+            merge = i;
+        }
+    }
+
+    if (merge < mControlCount &&
+        (mCongested || mControlCount == CONTROL_CAPACITY ||
+         static_cast<int32_t>(mControlSequences[merge] - mLastNoteSequence) > 0))
+    {
+        mControls[merge].byte2 = data1;
+        mControls[merge].byte3 = data2;
+        mControlSequences[merge] = mNextSequence++;
+        mControlMerges++;
+        return;
+    }
+
+    if (mControlCount == CONTROL_CAPACITY)
+    {
+        mControlDrops++;
+        return;
+    }
+
+    if (GetPendingCount() == 0)
+    {
+        mFirstQueuedTime = micros();
+    }
+
+    mControlSequences[mControlCount] = mNextSequence++;
+
+    midiEventPacket_t& packet = mControls[mControlCount++];
+    packet.header = status >> 4;
+    packet.byte1 = status;
+    packet.byte2 = data1;
+    packet.byte3 = data2;
+
+    mControlHighWater = max(mControlHighWater, mControlCount);
+}
+
+/**
+ * @brief Drop every waiting packet
+ */
+void UsbMidiOutput::Discard()
+{
+    mDisconnectedDrops += GetPendingCount();
+    mNoteHead = 0;
+    mNoteCount = 0;
+    mControlCount = 0;
+    mCongested = false;
+}
+
+/**
+ * @brief Find the waiting controller value that was queued first
+ * @return Its index, or mControlCount if no controller is waiting
+ */
+size_t UsbMidiOutput::OldestControl() const
+{
+    size_t oldest = mControlCount;
+
+    for (size_t i = 0; i < mControlCount; i++)
+    {
+        if (oldest == mControlCount || static_cast<int32_t>(mControlSequences[i] - mControlSequences[oldest]) < 0)
+        {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+/**
+ * @brief Write the waiting packets, oldest first, until the USB stack runs out of room
+ * @param notesFirst Write every waiting note before the controllers, to drain a congested endpoint
+ * @return The number of packets written
+ */
+size_t UsbMidiOutput::WritePackets(const bool notesFirst)
+{
+    size_t written = 0;
+
+    while (GetPendingCount() > 0)
+    {
+        size_t control = OldestControl();
+        bool note = mNoteCount > 0 &&
+                    (notesFirst || control == mControlCount ||
+                     static_cast<int32_t>(mNoteSequences[mNoteHead] - mControlSequences[control]) < 0);
+
+        if (note)
+        {
+            if (!mMidi.writePacket(&mNotes[mNoteHead]))
+            {
+                break;
+            }
+            mNoteHead = (mNoteHead + 1) % NOTE_CAPACITY;
+            mNoteCount--;
+        }
+        else
+        {
+            if (!mMidi.writePacket(&mControls[control]))
+            {
+                break;
+            }
+            mControlCount--;
+            memmove(mControls + control, mControls + control + 1, (mControlCount - control) * sizeof(midiEventPacket_t));
+            memmove(mControlSequences + control, mControlSequences + control + 1, (mControlCount - control) * sizeof(uint32_t));
+        }
+        written++;
+    }
+    return written;
+}
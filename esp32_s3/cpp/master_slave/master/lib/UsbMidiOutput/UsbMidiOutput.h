@@ -0,0 +1,112 @@
+/**
+ * @file UsbMidiOutput.h
+ * @author Mate Narh
+ *
+ * Class for the master to send MIDI messages over USB in packed bursts. The
+ * messages of one pass of the main loop are collected as 4-byte USB-MIDI event
+ * packets and handed to the USB stack together on the first pass after a USB
+ * start-of-frame, so that they leave in as few 64-byte endpoint writes as
+ * possible and their timing jitter is bounded by the 1 ms USB frame.
+ *
+ * Waiting messages are kept in two classes. Notes wait in order. Controller
+ * messages (CC, pitch bend) keep only the latest value of each controller, so
+ * a flood of them while the endpoint is congested merges down instead of
+ * delaying or pushing out notes. Every packet carries the sequence number it
+ * was queued with, and the two classes are written back in that order, so a
+ * sustain pedal or a pitch bend still lands before the notes that followed it.
+ * A value only merges into the one waiting for its controller if no note was
+ * queued in between. Only while the endpoint is congested do notes overtake
+ * the controllers, and controllers merge across notes
+ */
+
+#ifndef USB_MIDI_OUTPUT_H
+#define USB_MIDI_OUTPUT_H
+
+#include <Arduino.h>
+#include <USBMIDI.h>
+#include <MidiTransport.h>
+
+class UsbMidiOutput : public MidiTransport
+{
+    private:
+
+        static constexpr size_t PACKET_SIZE = 4;                  ///< Size of a USB-MIDI event packet
+        static constexpr size_t ENDPOINT_SIZE = 64;               ///< Size of a full-speed bulk endpoint write
+        static constexpr size_t PACKETS_PER_TRANSFER = ENDPOINT_SIZE / PACKET_SIZE;
+        static constexpr size_t NOTE_CAPACITY = 256;              ///< Notes that can wait: every key of a full keyboard, on and off
+        static constexpr size_t CONTROL_CAPACITY = 16;            ///< Distinct controllers that can wait at once
+
+        USBMIDI& mMidi;                          ///< The USB-MIDI interface the packets are written to
+
+        midiEventPacket_t mNotes[NOTE_CAPACITY];       ///< Ring buffer of notes waiting, in the order they were queued
+        uint32_t mNoteSequences[NOTE_CAPACITY];        ///< Sequence number of each waiting note
+        size_t mNoteHead = 0;                          ///< Index of the oldest waiting note
+        size_t mNoteCount = 0;                         ///< Number of notes waiting
+
+        midiEventPacket_t mControls[CONTROL_CAPACITY]; ///< Latest value of each waiting controller
+        uint32_t mControlSequences[CONTROL_CAPACITY];  ///< Sequence number of the latest value of each waiting controller
+        size_t mControlCount = 0;                      ///< Number of controllers waiting
+
+        uint32_t mNextSequence = 1;              ///< Sequence number of the next packet queued
+        uint32_t mLastNoteSequence = 0;          ///< Sequence number of the last note queued
+
+        unsigned long mFirstQueuedTime = 0;      ///< Time at which the oldest waiting packet was queued, in microseconds
+        uint32_t mLastFlushFrame = 0;            ///< USB frame count at the last flush
+        bool mCongested = false;                 ///< Did the last flush leave packets the USB stack had no room for?
+
+        // ------------------------------- Statistics ----------------------------------
+
+        uint32_t mFlushedPackets = 0;            ///< Packets written since the statistics were reset
+        uint32_t mEstimatedTransfers = 0;        ///< Endpoint writes those packets would fill if packed 16 to a write
+        unsigned long mFlushLatencyTotal = 0;    ///< Sum of the waits of the oldest packet of each flush, in microseconds
+        unsigned long mFlushLatencyMax = 0;      ///< Longest wait of the oldest packet of a flush, in microseconds
+        uint32_t mFlushes = 0;                   ///< Flushes since the statistics were reset
+
+        size_t mNoteHighWater = 0;               ///< Largest number of notes waiting at once
+        uint32_t mNoteOverflows = 0;             ///< Notes lost to a full note queue. Should stay 0
+        size_t mControlHighWater = 0;            ///< Largest number of controllers waiting at once
+        uint32_t mControlMerges = 0;             ///< Controller values replaced by a newer value before being sent
+        uint32_t mControlDrops = 0;              ///< Controller values lost because too many controllers were waiting
+        uint32_t mDisconnectedDrops = 0;         ///< Packets discarded because no host was connected
+
+        void QueueNote(const uint8_t status, const uint8_t data1, const uint8_t data2);
+        void QueueControl(const uint8_t status, const uint8_t data1, const uint8_t data2, const bool keyedOnData1);
+        void Discard();
+        size_t OldestControl() const;
+        size_t WritePackets(const bool notesFirst);
+
+    public:
+
+        UsbMidiOutput(USBMIDI& midi);
+
+        // ----------------------------------- Getters ---------------------------------
+        size_t GetPendingCount() const;
+        bool IsCongested() const;
+        float GetEstimatedEventsPerTransfer() const;
+        unsigned long GetAverageFlushLatency() const;
+        unsigned long GetMaxFlushLatency() const;
+        uint32_t GetFlushCount() const;
+        size_t GetNoteHighWater() const;
+        uint32_t GetNoteOverflowCount() const;
+        size_t GetControlHighWater() const;
+        uint32_t GetControlMergeCount() const;
+        uint32_t GetControlDropCount() const;
+        uint32_t GetDisconnectedDropCount() const;
+
+        // --------------------------------- Core Methods ------------------------------
+        void Begin();
+        void Flush();
+        void ResetStatistics();
+
+        // ------------------------------ MIDI Transport -------------------------------
+        const char* GetName() const override;
+        bool IsActive() const override;
+        bool Send(const MidiEvent& event) override;
+        void Service() override;
+
+        UsbMidiOutput() = delete;                        ///< Default constructor disabled
+        UsbMidiOutput(const UsbMidiOutput &) = delete;   ///< Copy constructor disabled
+        void operator=(const UsbMidiOutput &) = delete;  ///< Assignment operator disabled
+};
+
+#endif // USB_MIDI_OUTPUT_H
@@ -20,6 +20,31 @@
 #define HSPI_SCLK 36    // GP-SPI3  | Clock 
 #define HSPI_SS   45    // GP-SPI3  | Chip Select (CS)
 
+#define DATA_READY1 47  // <- Slave 1 DATA_READY | Slave is polled on the rising edge
+#define DATA_READY2 14  // <- Slave 2 DATA_READY
+
+// UART Communication Macros (only used when built with LINK_UART)
+
+#define UART1_TX  38    // UART1 -> Slave 1 RX
+#define UART1_RX  39    // UART1 <- Slave 1 TX
+#define UART2_TX  40    // UART2 -> Slave 2 RX
+#define UART2_RX  41    // UART2 <- Slave 2 TX
+
+// MIDI Output Macros (only used when built with MIDI_DIN, which takes UART2)
+#define MIDI_DIN_TX 42  // -> 220R -> DIN pin 5 / TRS tip. DIN pin 4 / TRS ring -> 220R -> 3V3
+
+// Direct-Scan Macros (only used when built with DIRECT_SCAN, which frees the SPI pins)
+
+#define LOCAL_KEY_1     1    // ADC1_CH0 | Multiplexer output when MUX_SELECT_COUNT > 0
+#define LOCAL_KEY_2     2    // ADC1_CH1
+#define LOCAL_DAMPER_1  6
+#define LOCAL_DAMPER_2  7
+
+#define MUX_S0  8     // Multiplexer select lines, least significant first
+#define MUX_S1  18
+#define MUX_S2  3
+#define MUX_S3  9
+
 // MIDI Constants
 #define VELOCITY_ON  0x7F // for testing purposes
 #define VELOCITY_OFF 0x00 // for testing purposes
@@ -4,6 +4,11 @@
  * @author Mate Narh
  */
 
+static constexpr const char* CALIBRATION_NAMESPACE = "wheels";  // NVS namespace of the stored centers
+static constexpr int16_t CENTER_STORE_DRIFT = 4;                 // Drift of the center, in ADC counts, before it is stored again
+static constexpr int16_t RECENTER_RANGE_DIVISOR = 4;             // The center is refined within mHysteresis / 4 of the calibrated one
+static constexpr int16_t REST_SPREAD_DIVISOR = 4;                // A rest whose samples spread over more than mHysteresis / 4 is not the spring's
+
 
 /**
  * @brief Constructor
@@ -21,9 +26,12 @@ Wheel::Wheel(const int wheelPin, const int resolution, const int16_t rangeMin, c
     mMaxAnalogValue = (1 << resolution) - 1;
 
     //
-    // Callibrate this wheel
+    // Load this wheel's stored calibration, or callibrate it on its first boot
     //
-    Callibrate();
+    if (!LoadCalibration())
+    {
+        Callibrate();
+    }
     
     //
     // Initialize digital EMA filter to smoothen out ADC noise
@@ -39,6 +47,14 @@ Wheel::~Wheel()
 
 }
 
+/**
+ * @brief Get the ADC pin of this wheel
+ */
+int Wheel::GetPin() const
+{
+    return mWheelPin;
+}
+
 /**
  * @brief Get the current bend value of this pitch wheel
  */
@@ -83,6 +99,14 @@ int16_t Wheel::GetDeadzoneMax() const
     return mDeadzoneMax;
 }
 
+/**
+ * @brief Get the ADC value of the joystick's center, as calibrated and refined at rest
+ */
+int16_t Wheel::GetCenter() const
+{
+    return mCenter;
+}
+
 /**
  * @brief Returns whether or not the bend value for this pitch wheel changed
  * @return Flag indicating whether or not the bend value for this pitch wheel changed
@@ -92,6 +116,54 @@ bool Wheel::IsReadingChanged() const
     return mReadingChanged;
 }
 
+/**
+ * @brief Get the 7 high bits (the MSB) of the last reported 14-bit reading
+ */
+uint8_t Wheel::GetMsb() const
+{
+    return mMsb;
+}
+
+/**
+ * @brief Get the 7 low bits (the LSB) of the last reported 14-bit reading
+ */
+uint8_t Wheel::GetLsb() const
+{
+    return mLsb;
+}
+
+/**
+ * @brief Returns whether the MSB of the last reported 14-bit reading should be sent
+ */
+bool Wheel::IsMsbChanged() const
+{
+    return mMsbChanged;
+}
+
+/**
+ * @brief Returns whether the LSB of the last reported 14-bit reading should be sent
+ */
+bool Wheel::IsLsbChanged() const
+{
+    return mLsbChanged;
+}
+
+/**
+ * @brief Get the number of updates since the statistics were reset
+ */
+uint32_t Wheel::GetUpdateCount() const
+{
+    return mUpdateCount;
+}
+
+/**
+ * @brief Get the number of readings reported (messages to send) since the statistics were reset
+ */
+uint32_t Wheel::GetSendCount() const
+{
+    return mSendCount;
+}
+
 /**
  * @brief Set the minimum bend value read by this pitch wheel's analog sensors
  * @param bendMin The new minimum bend value to set
@@ -129,63 +201,361 @@ void Wheel::SetDeadzoneMax(const int16_t deadzoneMax)
 }
 
 /**
- * @brief Update the pitch bend value for this pitch wheel
+ * @brief Set the smallest move of the filtered ADC value that counts as a new position
+ *
+ * Not applied to a 14-bit wheel smoothed by the One-Euro filter: a count of
+ * the ADC is already several steps of the 14-bit range there, so a threshold
+ * of a few counts would step more coarsely than a 7-bit CC, and the filter
+ * already holds still at rest
+ * @param changeThreshold The threshold, in ADC counts. 0 or 1 reports every change
+ */
+void Wheel::SetChangeThreshold(const int16_t changeThreshold)
+{
+    mChangeThreshold = changeThreshold;
+}
+
+/**
+ * @brief Set the shortest time between two reported readings
+ * @param sendInterval The interval, in milliseconds. 0 reports a change on every update
+ */
+void Wheel::SetSendInterval(const unsigned long sendInterval)
+{
+    mSendInterval = sendInterval;
+}
+
+/**
+ * @brief Set the time the wheel must rest in its deadzone before its center is refined
+ * @param recenterDelay The delay, in milliseconds. 0 keeps the calibrated center
+ */
+void Wheel::SetRecenterDelay(const unsigned long recenterDelay)
+{
+    mRecenterDelay = recenterDelay;
+}
+
+/**
+ * @brief Choose the filter used to smooth the ADC of this wheel
+ * @param filterType FILTER_EMA, FILTER_ONE_EURO or FILTER_NONE
+ */
+void Wheel::SetFilterType(const uint8_t filterType)
+{
+    mFilterType = filterType;
+    mOneEuroFilter.Reset();
+}
+
+/**
+ * @brief Choose whether the reading is reported as a 14-bit MSB/LSB controller pair
+ *
+ * The range of the wheel should then be 0 - 16383
+ * @param highResolution Report the reading as a 14-bit pair?
+ */
+void Wheel::SetHighResolution(const bool highResolution)
+{
+    mHighResolution = highResolution;
+}
+
+/**
+ * @brief Choose whether this wheel is sprung to a center or linear over its range
+ * @param centered True for a joystick-like wheel with a center deadzone, false for a pedal or a fader
+ */
+void Wheel::SetCentered(const bool centered)
+{
+    mCentered = centered;
+}
+
+/**
+ * @brief Tune the One-Euro filter of this wheel
+ * @param minCutoff The cutoff frequency at rest, in millihertz. Lower values remove more jitter
+ * @param beta The cutoff increase per unit of speed, in microhertz per count/s. Higher values remove more lag
+ * @param derivativeCutoff The cutoff frequency of the speed estimate, in millihertz
+ */
+void Wheel::SetOneEuroParameters(const uint32_t minCutoff, const uint32_t beta, const uint32_t derivativeCutoff)
+{
+    mOneEuroFilter.SetMinCutoff(minCutoff);
+    mOneEuroFilter.SetBeta(beta);
+    mOneEuroFilter.SetDerivativeCutoff(derivativeCutoff);
+}
+
+/**
+ * @brief Update the pitch bend value for this pitch wheel, reading its ADC pin
  */
 void Wheel::Update()
 {
-    int16_t value = mDigitalFilter->analogReadSmoothedWithEMA(mWheelPin);
+    Update(analogRead(mWheelPin), micros());
+}
+
+/**
+ * @brief Update the pitch bend value for this pitch wheel from a sample taken elsewhere
+ * @param sample The raw ADC value of this wheel's pin, eg. from an ADC scan
+ * @param timestamp The time at which the sample was taken, in microseconds
+ */
+void Wheel::Update(const int sample, const uint32_t timestamp)
+{
+    int value = (mFilterType == FILTER_ONE_EURO) ? mOneEuroFilter.Filter(sample, timestamp) :
+                (mFilterType == FILTER_NONE) ? sample : mDigitalFilter->smoothWithEMA(sample);
+
+    mUpdateCount++;
+    mReadingChanged = false;
+    mMsbChanged = false;
+    mLsbChanged = false;
+
+    if (mCentered && mRecenterDelay != 0)
+    {
+        Recenter(sample, value);
+    }
 
-    mReading = (value < mDeadzoneMin) ? map(value, 0, mDeadzoneMin, mRangeMin, 0) :
-               (value > mDeadzoneMax) ? map(value, mDeadzoneMax, mMaxAnalogValue, 0, mRangeMax) : 0; 
+    //
+    // The EMA filter only creeps towards the ends of the ADC range, so values
+    // within the threshold of an end are taken as the end itself, so that the
+    // full range is still reached
+    //
+    if (value <= mChangeThreshold)
+    {
+        value = 0;
+    }
+    else if (value >= mMaxAnalogValue - mChangeThreshold)
+    {
+        value = mMaxAnalogValue;
+    }
 
     //
-    // Set the mReadingChanged flag if the value read for this wheel changed
+    // Only take a new position once the value has moved by the threshold, so
+    // that ADC jitter around a resting position sends nothing
     //
-    if (mPrevReading != mReading)
+    int16_t threshold = (mHighResolution && mFilterType == FILTER_ONE_EURO) ? 1 : mChangeThreshold;
+
+    if (mHeldValue < 0 || abs(value - mHeldValue) >= threshold || 
+        value == 0 || value == mMaxAnalogValue)
     {
-        mReadingChanged = true;
-        mPrevReading = mReading;
+        mHeldValue = value;
+        mPendingReading = !mCentered ? map(value, 0, mMaxAnalogValue, mRangeMin, mRangeMax) :
+                          (value < mDeadzoneMin) ? map(value, 0, mDeadzoneMin, mRangeMin, 0) :
+                          (value > mDeadzoneMax) ? map(value, mDeadzoneMax, mMaxAnalogValue, 0, mRangeMax) : 0; 
     }
+
     //
-    // Clear the mReadingChanged flag otherwise (the current readinge is the same as the last)
+    // Report the latest position at most once per send interval. A position
+    // held back keeps differing from the last report, so it goes out as soon
+    // as the interval is over, even if the wheel has stopped moving by then
     //
-    else
+    if (mPendingReading != mPrevReading && millis() - mLastSendTime >= mSendInterval)
     {
-        mReadingChanged = false;
+        mReading = mPendingReading;
+        mPrevReading = mReading;
+        mLastSendTime = millis();
+        mReadingChanged = true;
+
+        if (mHighResolution)
+        {
+            uint8_t msb = (mReading >> 7) & 0x7F;
+            uint8_t lsb = mReading & 0x7F;
+
+            //
+            // A new MSB clears the LSB on the receiver, so the LSB only needs
+            // to follow it if it is not 0. Otherwise only a changed LSB is sent
+            //
+            mMsbChanged = (msb != mMsb);
+            mLsbChanged = mMsbChanged ? (lsb != 0) : (lsb != mLsb);
+            mMsb = msb;
+            mLsb = lsb;
+            mSendCount += mMsbChanged + mLsbChanged;
+        }
+        else
+        {
+            mSendCount++;
+        }
     }
 }
 
 /**
- * @brief Callibrate this wheel on startup to adapt to transience and noise
+ * @brief Callibrate this wheel by sampling its center, and store the result
+ *
+ * Only needed on the first boot: the center is loaded from NVS afterwards and
+ * refined at rest
  */
 void Wheel::Callibrate()
 {
     //
     // Average 100 samples to callibrate the analog joystick module and
-    // set the minimum and maximum bend values
+    // set the minimum and maximum bend values. Only the summary is printed:
+    // printing every sample holds up boot for longer than the sampling does
     //
-    int sample = 0;
     int sampleTotal = 0;
-    int16_t averageReading = 0;
 
     for (int i = 0; i < mSampleSize; i++)
     {
-        sample = analogRead(mWheelPin);
-        Serial.println(sample);
-
-        sampleTotal += sample;
+        sampleTotal += analogRead(mWheelPin);
     }
 
-    averageReading = sampleTotal / mSampleSize;
-
-    mDeadzoneMin = averageReading - mHysteresis;
-    mDeadzoneMax = averageReading + mHysteresis;
+    mCalibratedCenter = sampleTotal / mSampleSize;
+    SetCenter(mCalibratedCenter);
+    StoreCalibration(true);
 
     Serial.println("Callibration Summary");
     Serial.println("---------------------");
     Serial.print("Wheel Pin: "); Serial.print(mWheelPin);
-    Serial.print(" | Average Reading: "); Serial.print(averageReading);
+    Serial.print(" | Average Reading: "); Serial.print(mCenter);
     Serial.print(" | Deadzone Min: "); Serial.print(mDeadzoneMin);
     Serial.print(" | Deadzone Max: "); Serial.print(mDeadzoneMax);
     Serial.println(); 
 }
+
+/**
+ * @brief Clear the update and send counts
+ */
+void Wheel::ResetStatistics()
+{
+    mUpdateCount = 0;
+    mSendCount = 0;
+}
+
+/**
+ * @brief Load the calibrated and refined centers of this wheel stored in NVS by an earlier boot
+ * @return True if a calibration was stored and false otherwise
+ */
+bool Wheel::LoadCalibration()
+{
+    Preferences preferences;
+    char calibratedKey[16];
+    char centerKey[16];
+    bool stored = false;
+
+    //
+    // The keys also hold the ADC's full scale, so that a center stored at
+    // another resolution is not taken
+    //
+    snprintf(calibratedKey, sizeof(calibratedKey), "cal%d_%d", mWheelPin, mMaxAnalogValue);
+    snprintf(centerKey, sizeof(centerKey), "center%d_%d", mWheelPin, mMaxAnalogValue);
+
+    if (preferences.begin(CALIBRATION_NAMESPACE, true))
+    {
+        stored = preferences.isKey(calibratedKey);
+
+        if (stored)
+        {
+            int16_t range = mHysteresis / RECENTER_RANGE_DIVISOR;
+
+            mCalibratedCenter = preferences.getShort(calibratedKey, 0);
+            mStoredCenter = preferences.getShort(centerKey, mCalibratedCenter);
+            SetCenter(constrain(mStoredCenter, mCalibratedCenter - range, mCalibratedCenter + range));
+        }
+        preferences.end();
+    }
+
+    if (stored)
+    {
+        Serial.print("Wheel calibration loaded | Wheel Pin: "); Serial.print(mWheelPin);
+        Serial.print(" | Calibrated Center: "); Serial.print(mCalibratedCenter);
+        Serial.print(" | Center: "); Serial.print(mCenter);
+        Serial.print(" | Deadzone Min: "); Serial.print(mDeadzoneMin);
+        Serial.print(" | Deadzone Max: "); Serial.print(mDeadzoneMax);
+        Serial.println();
+    }
+    return stored;
+}
+
+/**
+ * @brief Store the center of this wheel in NVS, to be loaded on the next boots
+ * @param calibrated Also store the center as the calibrated one, eg. after Callibrate()
+ */
+void Wheel::StoreCalibration(const bool calibrated)
+{
+    Preferences preferences;
+    char key[16];
+
+    if (!preferences.begin(CALIBRATION_NAMESPACE, false))
+    {
+        return;
+    }
+
+    if (calibrated)
+    {
+        snprintf(key, sizeof(key), "cal%d_%d", mWheelPin, mMaxAnalogValue);
+        preferences.putShort(key, mCalibratedCenter);
+    }
+
+    snprintf(key, sizeof(key), "center%d_%d", mWheelPin, mMaxAnalogValue);
+
+    if (preferences.putShort(key, mCenter) != 0)
+    {
+        mStoredCenter = mCenter;
+    }
+    preferences.end();
+}
+
+/**
+ * @brief Move the center of this wheel, and its deadzone with it
+ * @param center The ADC value of the joystick's center
+ */
+void Wheel::SetCenter(const int16_t center)
+{
+    mCenter = center;
+    mDeadzoneMin = center - mHysteresis;
+    mDeadzoneMax = center + mHysteresis;
+}
+
+/**
+ * @brief Refine the center of this wheel from the samples taken while it rests in its deadzone
+ *
+ * Once the wheel has rested for the recenter delay, every mSampleSize samples
+ * are averaged into a new center. The samples are within the deadzone, so the
+ * deadzone still holds them after the move and no bend is sent. Leaving the
+ * deadzone drops the samples gathered so far.
+ *
+ * A hand holding the wheel off-center inside the deadzone would look like a
+ * rest too, so the samples of a rest must stay close together (the spring is
+ * steadier than a hand), and the new center is kept within a quarter of the
+ * deadzone of the calibrated center. The spring rest then always stays well
+ * inside the deadzone, however long the wheel is held
+ * @param sample The raw ADC value of this update
+ * @param value The filtered ADC value of this update
+ */
+void Wheel::Recenter(const int sample, const int value)
+{
+    bool resting = (value >= mDeadzoneMin && value <= mDeadzoneMax);
+
+    if (!resting || !mResting)
+    {
+        mResting = resting;
+        mRestStartTime = millis();
+        mRestSampleTotal = 0;
+        mRestSampleCount = 0;
+        return;
+    }
+
+    if (millis() - mRestStartTime < mRecenterDelay)
+    {
+        return;
+    }
+
+    mRestSampleMin = (mRestSampleCount == 0) ? sample : min(mRestSampleMin, sample);
+    mRestSampleMax = (mRestSampleCount == 0) ? sample : max(mRestSampleMax, sample);
+    mRestSampleTotal += sample;
+    mRestSampleCount++;
+
+    if (mRestSampleCount < mSampleSize)
+    {
+        return;
+    }
+
+    int spread = mRestSampleMax - mRestSampleMin;
+    int16_t range = mHysteresis / RECENTER_RANGE_DIVISOR;
+    int16_t center = mRestSampleTotal / mRestSampleCount;
+
+    mRestSampleTotal = 0;
+    mRestSampleCount = 0;
+
+    if (spread > mHysteresis / REST_SPREAD_DIVISOR)
+    {
+        return;
+    }
+
+    SetCenter(constrain(center, mCalibratedCenter - range, mCalibratedCenter + range));
+
+    //
+    // NVS is only written once the center has drifted, to spare the flash
+    //
+    if (mStoredCenter < 0 || abs(mCenter - mStoredCenter) >= CENTER_STORE_DRIFT)
+    {
+        StoreCalibration(false);
+    }
+}
@@ -4,6 +4,31 @@
  * 
  * Class to interface with a joystick module or like sensor to drive MIDI 
  * Pitch Bend messages in application
+ *
+ * A new reading is only reported once the filtered ADC value has moved by more
+ * than a small threshold (hysteresis against ADC jitter), and at most once per
+ * send interval. A change held back by the interval is reported as soon as the
+ * interval is over, so the final position of a gesture is always sent
+ *
+ * A wheel can also report its reading as a 14-bit controller pair (MSB on
+ * CC n, LSB on CC n + 32). Only the halves that changed are flagged, and an
+ * LSB of 0 is not flagged after a new MSB, since receivers clear the LSB on
+ * every MSB. A pair counts as a single report against the send interval
+ *
+ * A wheel can also be linear (a pedal or a fader): its whole ADC range is
+ * then mapped onto its range, without a center deadzone
+ *
+ * The ADC is smoothed either by a fixed EMA or by an adaptive One-Euro filter,
+ * which follows fast bends closely and still holds steady at rest
+ *
+ * The center of a sprung wheel is stored in NVS, so it is loaded at boot and
+ * the wheel is only calibrated by sampling on the first boot. Since the center
+ * of a joystick drifts with temperature, it is refined in the background from
+ * the samples taken while the wheel rests in its deadzone, and stored again
+ * once it has drifted. Refinements stay within a quarter of the deadzone of
+ * the calibrated center, and a rest whose samples spread too much (a hand
+ * holding the wheel rather than the spring) is ignored, so that a held wheel
+ * cannot walk the center away from its spring rest
  */
 
 #ifndef PITCH_WHEEL_H
@@ -11,10 +36,18 @@
 
 #include <Arduino.h>
 #include <DigitalFilter.h>
+#include <OneEuroFilter.h>
+#include <Preferences.h>
 
 
 class Wheel
 {
+    public:
+
+        static constexpr uint8_t FILTER_EMA = 0;       ///< Smooth the ADC with a fixed EMA
+        static constexpr uint8_t FILTER_ONE_EURO = 1;  ///< Smooth the ADC with a One-Euro filter, whose cutoff follows the speed of the wheel
+        static constexpr uint8_t FILTER_NONE = 2;      ///< Take the samples as they are, eg. when the ADC's hardware IIR filter already smoothed them
+
     private:
 
         const int mWheelPin = 0;   /// The ADC pin used to poll analog data for this Wheel
@@ -33,8 +66,38 @@ class Wheel
 
         int16_t mHysteresis = 100; ///< The padding used to account for deadzone at the joystick's center during callibration  
 
-        /// Debounce time to reduce the rate at which messages are sent w.r.t this wheel
-        unsigned long mDebounceTime = 10;
+        int16_t mCalibratedCenter = 0;      ///< The center sampled on the first boot, which refinements stay close to
+        int16_t mCenter = 0;                ///< The ADC value of the joystick's center, which the deadzone is padded around
+        int16_t mStoredCenter = -1;         ///< The center last stored in NVS (-1 = none)
+
+        /// Time the wheel must rest in its deadzone before its center is refined, in milliseconds (0 = never)
+        unsigned long mRecenterDelay = 2000;
+
+        bool mResting = false;              ///< Is the filtered ADC value within the deadzone?
+        unsigned long mRestStartTime = 0;   ///< Time at which the wheel came to rest, in milliseconds
+        uint32_t mRestSampleTotal = 0;      ///< Sum of the samples taken at rest towards the next center
+        int mRestSampleCount = 0;           ///< Number of samples taken at rest towards the next center
+        int mRestSampleMin = 0;             ///< Lowest sample taken at rest towards the next center
+        int mRestSampleMax = 0;             ///< Highest sample taken at rest towards the next center
+
+        /// Smallest move of the filtered ADC value that counts as a new position
+        int16_t mChangeThreshold = 4;
+
+        /// Shortest time between two reported readings, in milliseconds, to limit the rate at which messages are sent w.r.t this wheel
+        unsigned long mSendInterval = 10;
+
+        int mHeldValue = -1;                ///< The filtered ADC value of the last accepted position (-1 = none yet)
+        int16_t mPendingReading = 0;        ///< The reading of the last accepted position, reported once the send interval allows
+        unsigned long mLastSendTime = 0;    ///< Time at which a reading was last reported, in milliseconds
+
+        bool mHighResolution = false;       ///< Is the reading reported as a 14-bit MSB/LSB controller pair?
+        uint8_t mMsb = 0;                   ///< The 7 high bits of the last reported reading, if 14-bit
+        uint8_t mLsb = 0;                   ///< The 7 low bits of the last reported reading, if 14-bit
+        bool mMsbChanged = false;           ///< Should the MSB of the last reported reading be sent?
+        bool mLsbChanged = false;           ///< Should the LSB of the last reported reading be sent?
+
+        uint32_t mUpdateCount = 0;          ///< Updates since the statistics were reset
+        uint32_t mSendCount = 0;            ///< Messages to send for the reported readings since the statistics were reset
 
         /// Smoothing factor to digitally filter analog data using Exponential Moving Average (EMA) LPF
         const float mSmoothingFactor = 0.1;
@@ -42,9 +105,22 @@ class Wheel
         /// The digital EMA filter for smoothening out high frequency noise on the ADC pin of this wheel
         DigitalFilter* mDigitalFilter = nullptr;
 
+        /// The adaptive One-Euro filter, used instead of the EMA if selected
+        OneEuroFilter mOneEuroFilter {1000, 2000, 1000};
+
+        /// The filter used on the ADC pin of this wheel
+        uint8_t mFilterType = FILTER_EMA;
+
         /// Flag indicating whether the bend value for this pitch wheel changed
         bool mReadingChanged = false;
 
+        /// Is this wheel sprung to a center (deadzone around it) rather than linear over its range?
+        bool mCentered = true;
+
+        bool LoadCalibration();
+        void StoreCalibration(const bool calibrated);
+        void SetCenter(const int16_t center);
+        void Recenter(const int sample, const int value);
 
     public:
 
@@ -52,22 +128,39 @@ class Wheel
         ~Wheel();
         
         // ----------------------------------- Setters ------------------------------------
+        int GetPin() const;
         int16_t GetReading() const;
         int16_t GetRangeMin() const;
         int16_t GetRangeMax() const;
         int16_t GetDeadzoneMin() const;
         int16_t GetDeadzoneMax() const;
+        int16_t GetCenter() const;
         bool IsReadingChanged() const;
+        uint8_t GetMsb() const;
+        uint8_t GetLsb() const;
+        bool IsMsbChanged() const;
+        bool IsLsbChanged() const;
+        uint32_t GetUpdateCount() const;
+        uint32_t GetSendCount() const;
 
         // ----------------------------------- Getters ------------------------------------
         void SetRangeMin(const int16_t bendMin);
         void SetRangeMax(const int16_t bendMax);
         void SetDeadzoneMin(const int16_t deadzoneMin);
         void SetDeadzoneMax(const int16_t deadzoneMax);
+        void SetChangeThreshold(const int16_t changeThreshold);
+        void SetSendInterval(const unsigned long sendInterval);
+        void SetRecenterDelay(const unsigned long recenterDelay);
+        void SetFilterType(const uint8_t filterType);
+        void SetHighResolution(const bool highResolution);
+        void SetCentered(const bool centered);
+        void SetOneEuroParameters(const uint32_t minCutoff, const uint32_t beta, const uint32_t derivativeCutoff);
         
         // --------------------------------- Core Methods ---------------------------------
         void Update();
+        void Update(const int sample, const uint32_t timestamp);
         void Callibrate();
+        void ResetStatistics();
 
 
         Wheel() = delete;                       ///< Default constructor disabled
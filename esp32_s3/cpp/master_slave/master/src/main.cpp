@@ -1,20 +1,47 @@
 #include <Arduino.h>
 #include <USB.h>
 #include <USBMIDI.h>
-#include <SPI.h>
 
 #include <Slave.h>
+#include <SlaveBus.h>
+#include <EventMerger.h>
+#include <JitterBuffer.h>
+#include <UsbMidiOutput.h>
+#include <MidiRouter.h>
 #include <RotaryEncoder.h>
 #include <Wheel.h>
+#include <AnalogController.h>
 #include <Utility.h>
 
+#ifdef DIRECT_SCAN
+#include <KeyController.h>
+#endif
+
+#ifdef MIDI_DIN
+#include <SerialMidiOutput.h>
+
+#if defined(LINK_UART)
+#error "MIDI_DIN needs a UART that LINK_UART builds give to the slaves"
+#endif
+#endif
+
 #define CHANNEL      1 // Range: 1 - 16 channels available
 #define CABLE_NUMBER 1
 
 #define ADC_RESOLUTION 10
 
-#define KEY_COUNT1 2
-#define KEY_COUNT2 2
+//
+// Octave boards wired to the master. Boards share the two SPI buses, each on a
+// chip select of its own: up to 6 on FSPI and 3 on HSPI, enough for 88 keys.
+// UART builds have one UART per board, so only 2
+//
+#define SLAVE_COUNT        2
+#define FALLBACK_KEY_COUNT 2
+
+#define LOCAL_KEY_COUNT   2    // Keys scanned by the master itself in direct-scan mode
+#define LOCAL_START_NOTE  0x3C // Middle C: C4 | (int) 60
+#define LOCAL_THRESHOLD   5
+#define MUX_SELECT_COUNT  0    // Multiplexer select lines in direct-scan mode (0 = keys wired straight to ADC pins)
 
 #define TRANSPOSE_MAX  24
 #define TRANSPOSE_MIN -24
@@ -29,46 +56,197 @@
 
 #define MODULATION_PIN  5
 #define MODULATION_MIN  0
-#define MODULATION_MAX  127
 #define MODULATION_CC   1
 
+//
+// The modulation wheel can be sent with 14-bit resolution, as CC 1 (MSB)
+// followed by CC 33 (LSB), for smooth slow sweeps. Only the changed half of
+// the pair is sent. At ADC_RESOLUTION, only about 400 counts above the
+// deadzone span the 14-bit range, so each count is a step of about 40: the
+// change threshold is not applied to it (the One-Euro filter holds still at
+// rest), which keeps its steps finer than the 128 of a 7-bit CC
+//
+#define MODULATION_14_BIT   true
+#define MODULATION_MAX      (MODULATION_14_BIT ? 16383 : 127)
+
+//
+// All the continuous controls are sampled by one ADC1 scan, at this total rate
+// shared by their channels. DIRECT_SCAN builds read the keys one-shot on ADC1,
+// which cannot run alongside the scan, so their controls are read one-shot too
+//
+#define ANALOG_SAMPLE_RATE_HZ     20000
+
+//
+// The wheels can be smoothed by the ADC's hardware IIR filters (k = 2, 4, 8,
+// 16 or 64, ie. an EMA of 1/k per conversion) instead of in software. Only
+// two channels have one. See tests/Host/AdcIirEquivalence to pick k. Its
+// model shows k = 64 lagging and, without fractional bits, settling tens of
+// counts off the input, so keep k at 16 or less (or 0) until the filter has
+// been measured on the hardware
+//
+#define WHEEL_HARDWARE_IIR        0     // eg. 8 or 16. 0 smooths the wheels in software
+
+//
+// A wheel reports a new position once its filtered ADC value has moved by the
+// threshold, and at most once per interval. The last position of a gesture is
+// always sent, one interval after the previous report at the latest
+//
+#define WHEEL_CHANGE_THRESHOLD    4     // ADC counts, at ADC_RESOLUTION (of 1023 at 10 bits). Not used by 14-bit wheels
+#define WHEEL_SEND_INTERVAL_MS    10    // ie. at most 100 messages/s per wheel
+#define WHEEL_LOG_INTERVAL_MS     10000
+
+//
+// The One-Euro filter follows fast bends more closely than the fixed EMA and
+// holds steadier at rest (see tests/Host/WheelFilterBenchmark)
+//
+#define WHEEL_FILTER              Wheel::FILTER_ONE_EURO // or Wheel::FILTER_EMA
+#define WHEEL_MIN_CUTOFF_MHZ      1000  // Cutoff at rest
+#define WHEEL_BETA                2000  // Cutoff increase, in uHz per count/s
+#define WHEEL_D_CUTOFF_MHZ        1000  // Cutoff of the speed estimate
+
+//
+// The centers of the sprung wheels are stored in NVS and refined once a wheel
+// has rested in its deadzone for this long, to follow the drift of the joystick
+//
+#define WHEEL_RECENTER_DELAY_MS   2000  // 0 keeps the center calibrated on the first boot
+
+//
+// Playout delay for key events, in microseconds. 0 sends each note as soon as
+// it is received. Anything else holds notes in a jitter buffer and releases them
+// at their slave timestamp plus this delay, for constant latency when recording
+//
+#define PLAYOUT_DELAY_US          0 // eg. 3000
+#define JITTER_LOG_INTERVAL_MS    10000
+
+#define USB_LOG_INTERVAL_MS       10000
+
+#define DIN_NOTE_OFF_AS_NOTE_ON   true  // Stretch running status on the DIN output, at the cost of release velocity
+#define DIN_LOG_INTERVAL_MS       10000 // Only used when built with MIDI_DIN
+
+#define ROUTER_LOG_INTERVAL_MS    10000
+
+#define BENCHMARK_LOG_INTERVAL_MS 10000 // Only used when built with LINK_BENCHMARK
+
 // ------------------------ Peripheral initialization -------------------------
 Wheel *pitchWheel = nullptr;
 Wheel *modulationWheel = nullptr;
 RotaryEncoder *transposeKnob = nullptr;
+unsigned long lastWheelLogTime = 0;
 
 // ----------------------------- Set up SPI macros ----------------------------
 
-static const uint32_t spiClock = 10000000; // 10 MHz -- max: 10 MHz but choose value < 7.5 MHz
-
-SPIClass *fspi = nullptr;
-SPIClass *hspi = nullptr;
+//
+// Each slave starts out at the slowest clock. The clock it settles on is found
+// by training the link with that slave once it announces itself ready
+//
+static const uint32_t spiClock = 1000000; // 1 MHz
 
 // ----------------------------- Slave preparation ---------------------------
-Slave* slave1 = nullptr;
-Slave* slave2 = nullptr;
-
-static constexpr size_t BUFFER_SIZE1 = 8;
-static constexpr size_t BUFFER_SIZE2 = 8;
-
-const uint8_t notes1[KEY_COUNT1] {0x3C, 0x3D}; // {C4, C4#} for testing
-const uint8_t notes2[KEY_COUNT2] {0x3C, 0x3D}; // {C4, C4#} for testing
-
-uint8_t rxBuffer1[BUFFER_SIZE1] {0};
-uint8_t rxBuffer2[BUFFER_SIZE2] {0};
+Slave* slaves[SLAVE_COUNT] {nullptr};
+
+//
+// The bus, chip select and data-ready line of each board, in slave ID order.
+// Boards are spread over both buses so their polls overlap
+//
+const spi_host_device_t slaveHosts[SLAVE_COUNT] {SPI2_HOST, SPI3_HOST};
+const int slaveCsPins[SLAVE_COUNT] {FSPI_SS, HSPI_SS};
+const int slaveDataReadyPins[SLAVE_COUNT] {DATA_READY1, DATA_READY2};
+
+SlaveBus fspiBus(SPI2_HOST); // GP-SPI2
+SlaveBus hspiBus(SPI3_HOST); // GP-SPI3
+
+EventMerger eventMerger; // Orders the key events of all slaves by timestamp
+JitterBuffer jitterBuffer(PLAYOUT_DELAY_US);
+unsigned long lastJitterLogTime = 0;
+
+// ------------------------------ Link benchmark -----------------------------
+#ifdef LINK_BENCHMARK
+unsigned long linkServiceTime = 0;    // Time spent servicing the slave links since the last report (us)
+unsigned long linkServiceCount = 0;   // Number of passes of the main loop since the last report
+unsigned long eventLatencyTotal = 0;  // Sum of the key-to-USB latencies since the last report (us)
+unsigned long eventLatencyMax = 0;    // Largest key-to-USB latency since the last report (us)
+unsigned long eventLatencyCount = 0;  // Number of key events measured since the last report
+uint32_t lastPollCount = 0;           // Polls queued on both SPI buses at the last report
+unsigned long lastBenchmarkLogTime = 0;
+#endif
+
+//
+// Key counts, notes and buffer sizes are reported by each slave when its link
+// comes up. These are only used for slaves flashed before descriptors existed
+//
+const uint8_t fallbackNotes[FALLBACK_KEY_COUNT] {0x3C, 0x3D}; // {C4, C4#} for testing
+
+// ------------------------------ Direct scan --------------------------------
+#ifdef DIRECT_SCAN
+//
+// The same scan engine as the slaves, minus the link. Its events go straight
+// to USB, so the master needs no Slave, SPI or UART stage
+//
+KeyController* localKeys = nullptr;
+
+const int localKeyPins[LOCAL_KEY_COUNT] {LOCAL_KEY_1, LOCAL_KEY_2};
+const int localDamperPins[LOCAL_KEY_COUNT] {LOCAL_DAMPER_1, LOCAL_DAMPER_2};
+const uint8_t localNotes[LOCAL_KEY_COUNT] {0x3C, 0x3D}; // {C4, C4#} for testing
+
+const int muxSelectPins[] {MUX_S0, MUX_S1, MUX_S2, MUX_S3};
+const int muxChannels[LOCAL_KEY_COUNT] {0, 1}; // Multiplexer channel of each key
+#endif
 
 // Create USBMIDI instance
 USBMIDI usbMIDI;
 
+//
+// Every MIDI message of a loop pass goes through this stage, which packs them
+// into full endpoint writes on the next USB frame
+//
+UsbMidiOutput midiOut(usbMIDI);
+unsigned long lastUsbLogTime = 0;
+
+#ifdef MIDI_DIN
+//
+// The same messages, out of a 5-pin DIN/TRS socket for modules without a USB host
+//
+SerialMidiOutput dinMidiOut(UART_NUM_2, MIDI_DIN_TX, DIN_NOTE_OFF_AS_NOTE_ON);
+unsigned long lastDinLogTime = 0;
+#endif
+
+//
+// Every message is encoded once here and queued separately for each output,
+// so a congested output backs up its own queue only
+//
+MidiRouter midiRouter;
+unsigned long lastRouterLogTime = 0;
+
+//
+// The controller table: every continuous control and the MIDI message it drives.
+// A control is added by adding its row, eg. for pedals on free ADC1 pins:
+//
+//   {6, 0, 127, false, AnalogController::DESTINATION_CC, 11},   // Expression pedal
+//   {7, 0, 127, false, AnalogController::DESTINATION_CC, 64},   // Sustain pedal (half-pedaling)
+//
+const AnalogController::Route analogRoutes[] {
+  {PITCHBEND_PIN,  PITCHBEND_MIN,  PITCHBEND_MAX,  true, AnalogController::DESTINATION_PITCH_BEND, 0},
+  {MODULATION_PIN, MODULATION_MIN, MODULATION_MAX, true,
+   MODULATION_14_BIT ? AnalogController::DESTINATION_CC_14BIT : AnalogController::DESTINATION_CC, MODULATION_CC},
+};
+
+AnalogController analogController(midiRouter, CHANNEL, ADC_RESOLUTION);
+
 // --------------------------- Function Declarations -----------------------------
 void querySlaves();
 void sendMidiMsgUpdatesOverUSB();
+void sendKeyEventOverUSB(const KeyEvent& event, const uint8_t* notes, const bool synced);
+void scanLocalKeys();
+void handleConsoleCommands();
+void reportLinkBenchmark();
 
 void setup()
 {
+  unsigned long bootStart = micros();
+
   Serial.begin(115200);
 
-  // Read analog data at 12-bit resolution (Range: 0 - 4095)
+  // Read analog data at ADC_RESOLUTION (10 bits, Range: 0 - 1023)
   analogReadResolution(ADC_RESOLUTION);
 
   //
@@ -76,6 +254,13 @@ void setup()
   //
   USB.begin();
   usbMIDI.begin();
+  midiOut.Begin();
+  midiRouter.AddTransport(&midiOut);
+#ifdef MIDI_DIN
+  dinMidiOut.Begin();
+  midiRouter.AddTransport(&dinMidiOut);
+#endif
+  unsigned long usbReady = micros();
  
   //
   // Initialize indicators
@@ -84,18 +269,34 @@ void setup()
   digitalWrite(LED_BUILTIN, LOW);
 
   //
-  // ---------------------------- Pitch Bend Wheel Setup -------------------------------
+  // ------------------------ Wheel, Pedal & Fader Setup --------------------------
   //
-  // No ADC pin setup required for pitch bend wheel. Simply use values directly
+  // Each row of the controller table gets a wheel, whose stored calibration is
+  // loaded (or, on the first boot, taken while its pin can still be read
+  // one-shot), then the scan over all of them is started
   //
-  pitchWheel = new Wheel(PITCHBEND_PIN, ADC_RESOLUTION, PITCHBEND_MIN, PITCHBEND_MAX);
+  for (const AnalogController::Route& route : analogRoutes)
+  {
+    Wheel* wheel = analogController.AddController(route);
 
-  //
-  // ---------------------------- Modulation Wheel Setup -------------------------------
-  //
-  // No ADC pin setup required for modulation wheel. Simply use values directly
-  //
-  modulationWheel = new Wheel(MODULATION_PIN, ADC_RESOLUTION, MODULATION_MIN, MODULATION_MAX);
+    if (wheel != nullptr)
+    {
+      wheel->SetChangeThreshold(WHEEL_CHANGE_THRESHOLD);
+      wheel->SetSendInterval(WHEEL_SEND_INTERVAL_MS);
+      wheel->SetOneEuroParameters(WHEEL_MIN_CUTOFF_MHZ, WHEEL_BETA, WHEEL_D_CUTOFF_MHZ);
+      wheel->SetFilterType(WHEEL_FILTER);
+      wheel->SetRecenterDelay(WHEEL_RECENTER_DELAY_MS);
+    }
+  }
+  pitchWheel = analogController.GetWheel(0);
+  modulationWheel = analogController.GetWheel(1);
+
+  analogController.SetHardwareFilter(0, WHEEL_HARDWARE_IIR);
+  analogController.SetHardwareFilter(1, WHEEL_HARDWARE_IIR);
+
+#ifndef DIRECT_SCAN
+  analogController.Begin(ANALOG_SAMPLE_RATE_HZ);
+#endif
 
   //
   // ---------------------------- Transpose Setup -------------------------------
@@ -105,49 +306,84 @@ void setup()
   pinMode(TRANSPOSE_SW, INPUT_PULLUP);
 
   transposeKnob = new RotaryEncoder(TRANSPOSE_CLK, TRANSPOSE_DT, TRANSPOSE_SW, TRANSPOSE_MAX, TRANSPOSE_MIN);
+  Serial.print("Transpose knob counted by: "); Serial.println(transposeKnob->IsHardwareCounting() ? "PCNT" : "interrupts");
+  unsigned long peripheralsReady = micros();
 
+#ifdef DIRECT_SCAN
   //
-  // ------------------------------ SPI Setup ------------------------------
-  //
-  // Initialize SPI and wait 2 seconds (2000 ms) to stabilize setup
+  // ---------------------------- Direct Scan Setup -----------------------------
   //
-  fspi = new SPIClass(FSPI);
-  hspi = new SPIClass(HSPI);
+  for (int i = 0; i < LOCAL_KEY_COUNT; i++)
+  {
+    pinMode(localDamperPins[i], INPUT);
+  }
+
+  localKeys = new KeyController(LOCAL_KEY_COUNT, localKeyPins, localDamperPins, LOCAL_THRESHOLD, LOCAL_START_NOTE, ADC_RESOLUTION);
 
-  delay(2000);
+  if (MUX_SELECT_COUNT > 0)
+  {
+    localKeys->setMultiplexer(muxSelectPins, MUX_SELECT_COUNT, muxChannels);
+  }
+  Serial.println("Direct scan setup complete | No slaves");
+#endif
 
+#ifndef DIRECT_SCAN
   //
-  // GP-SPI2: FSPI -> Slave 1
+  // ---------------------------- Slave Setup -----------------------------
   //
-  pinMode(FSPI_SS, OUTPUT);
-  pinMode(FSPI_MOSI, OUTPUT);
-  digitalWrite(FSPI_SS, HIGH);
-  fspi->begin(FSPI_SCLK, FSPI_MISO, FSPI_MOSI, FSPI_SS);
-  Serial.println("SPI setup complete for slave 1 | Type: GP-SPI2 / FSPI");
-  
+  for (int i = 0; i < SLAVE_COUNT; i++)
+  {
+    slaves[i] = new Slave(i + 1, FALLBACK_KEY_COUNT, fallbackNotes);
+    eventMerger.AddSlave(slaves[i]);
+  }
+
+#ifdef LINK_UART
   //
-  // GP-SPI3: HSPI -> Slave 2
+  // The slaves push their frames over UART, so there is nothing to poll
   //
-  pinMode(HSPI_SS, OUTPUT);
-  pinMode(HSPI_MOSI, OUTPUT);
-  digitalWrite(HSPI_SS, HIGH);
-  hspi->begin(HSPI_SCLK, HSPI_MISO, HSPI_MOSI, HSPI_SS);
-  Serial.println("SPI setup complete for slave 2 | Type: GP-SPI3 / HSPI");
+  static_assert(SLAVE_COUNT == 2, "UART builds have one UART per slave");
 
+  slaves[0]->SetUartParameters(UART_NUM_1, UART1_TX, UART1_RX, UART_LINK_BAUD);
+  slaves[1]->SetUartParameters(UART_NUM_2, UART2_TX, UART2_RX, UART_LINK_BAUD);
+#else
   //
-  // ----------------------- Buffer Initizialization ----------------------
+  // The slaves of one bus are polled one after the other, while both buses run
+  // at once. There is no need to wait for the slaves here: each one is probed
+  // from loop() and polled as soon as it announces itself ready
   //
-  memset(rxBuffer1, 0, BUFFER_SIZE1);
-  memset(rxBuffer2, 0, BUFFER_SIZE2);
+  fspiBus.Initialize(FSPI_SCLK, FSPI_MISO, FSPI_MOSI);
+  hspiBus.Initialize(HSPI_SCLK, HSPI_MISO, HSPI_MOSI);
+
+  for (int i = 0; i < SLAVE_COUNT; i++)
+  {
+    SlaveBus& bus = (slaveHosts[i] == SPI2_HOST) ? fspiBus : hspiBus;
+
+    if (bus.AddSlave(slaves[i], slaveCsPins[i], spiClock, SPI_MODE0, FRAME_SIZE))
+    {
+      slaves[i]->SetDataReadyPin(slaveDataReadyPins[i]);
+      Serial.print("SPI setup complete for slave "); Serial.print(i + 1);
+      Serial.println((slaveHosts[i] == SPI2_HOST) ? " | Type: GP-SPI2 / FSPI" : " | Type: GP-SPI3 / HSPI");
+    }
+  }
 
   //
-  // ---------------------------- Slave Setup -----------------------------
+  // Boards with key events waiting are polled ahead of idle ones, and no board
+  // waits longer than its poll bound
   //
-  slave1 = new Slave(1, KEY_COUNT1, notes1);
-  slave2 = new Slave(2, KEY_COUNT2, notes2);
+  fspiBus.SetSchedule(SlaveBus::SCHEDULE_PRIORITY);
+  hspiBus.SetSchedule(SlaveBus::SCHEDULE_PRIORITY);
+#endif
+#endif
+  unsigned long spiReady = micros();
 
-  slave1->SetSpiParameters(fspi, spiClock, MSBFIRST, SPI_MODE0, BUFFER_SIZE1, rxBuffer1);
-  slave2->SetSpiParameters(hspi, spiClock, MSBFIRST, SPI_MODE0, BUFFER_SIZE2, rxBuffer2);
+  //
+  // ----------------------------- Boot Timing ------------------------------
+  //
+  Serial.print("Boot timing (us) | USB: "); Serial.print(usbReady - bootStart);
+  Serial.print(" | Peripherals: "); Serial.print(peripheralsReady - usbReady);
+  Serial.print(" | SPI: "); Serial.print(spiReady - peripheralsReady);
+  Serial.print(" | Setup total: "); Serial.print(spiReady - bootStart);
+  Serial.println();
 }
 
 void loop()
@@ -155,8 +391,7 @@ void loop()
   //
   // ------------------------- Update Peripherals -------------------------
   //
-  pitchWheel->Update();
-  modulationWheel->Update();
+  analogController.Update();
   transposeKnob->Update();
 
   //
@@ -166,8 +401,24 @@ void loop()
   //
   // Connected: Send MIDI to host over USB
   //
+#ifdef DIRECT_SCAN
+  scanLocalKeys();
+#elif defined(LINK_BENCHMARK)
+  unsigned long serviceStart = micros();
+  querySlaves();
+  linkServiceTime += micros() - serviceStart;
+  linkServiceCount++;
+#else
   querySlaves();
+#endif
   sendMidiMsgUpdatesOverUSB();
+  midiRouter.Service();
+
+  handleConsoleCommands();
+
+#ifdef LINK_BENCHMARK
+  reportLinkBenchmark();
+#endif
 }
 
 /**
@@ -181,20 +432,29 @@ void querySlaves()
 {
   //
   // Master receives data from its slaves with the following partition
-  // -----------------------------------------------------------
-  // |   1 READINESS   |    2 VELOCITIES    |    3 STATUSES    |
-  // -----------------------------------------------------------
+  // --------------------------------------------------------------------------------------------
+  // | HEADER | SEQUENCE | ACK | EVENT COUNT | SYNC MASTER TIME | SYNC SLAVE TIME | EVENTS ... |
+  // --------------------------------------------------------------------------------------------
   //
 
   //
-  // After each slave completes its query, the receive buffer corresponding to that
-  // slave is updated such that:
+  // Each query collects the frame polled on the previous pass and queues the
+  // next poll, so both buses transfer at the same time while the rest of the
+  // loop runs. The key events of each new frame are queued on its slave
   //
-  // rxBuffer1: updates for slave 1
-  // rxBuffer2: updates for slave 2
+  // A slave whose link is not up yet is probed instead. The probe is a single
+  // short poll, so a slave that is still booting (or absent) costs next to nothing.
+  // Once it answers, the slave describes itself and the link is trained
   //
-  // slave1->querySPIPeerOnOtherSide();
-  slave2->querySPIPeerOnOtherSide();
+#ifdef LINK_UART
+  for (int i = 0; i < SLAVE_COUNT; i++)
+  {
+    slaves[i]->ServiceUartLink();
+  }
+#else
+  fspiBus.Service();
+  hspiBus.Service();
+#endif
 }
 
 
@@ -207,84 +467,334 @@ void querySlaves()
  */
 void sendMidiMsgUpdatesOverUSB()
 {
-  // Serial.println(pitchWheel->GetBend());
   //
-  // ------------------------ Send Pitch Bend Message ---------------------------
+  // ---------------- Pitch Bend, Modulation & other controls -----------------
+  //
+  // Their messages are sent by the analog controller as its table routes them
   //
-  if (pitchWheel->IsReadingChanged())
+  if (millis() - lastWheelLogTime >= WHEEL_LOG_INTERVAL_MS)
   {
-    usbMIDI.pitchBend(pitchWheel->GetReading(), CHANNEL);
-  }
+    lastWheelLogTime = millis();
+
+    Serial.print("Analog controls | Scanning: "); Serial.print(analogController.IsScanning() ? "yes" : "no");
+    Serial.print(" | Samples: "); Serial.print(analogController.GetSampleCount());
+    Serial.print(" | Update avg (us): "); Serial.print(analogController.GetAverageUpdateTime());
+    Serial.print(" | Update max (us): "); Serial.print(analogController.GetMaxUpdateTime());
 
+    for (size_t i = 0; i < analogController.GetControllerCount(); i++)
+    {
+      Wheel* wheel = analogController.GetWheel(i);
+
+      Serial.print(" | Pin "); Serial.print(wheel->GetPin());
+      Serial.print(" updates/sends: "); Serial.print(wheel->GetUpdateCount());
+      Serial.print("/"); Serial.print(wheel->GetSendCount());
+      Serial.print(" center: "); Serial.print(wheel->GetCenter());
+      wheel->ResetStatistics();
+    }
+    Serial.println();
+
+    analogController.ResetStatistics();
+  }
+  
+  //
+  // ------------------------ Slave MIDI Transmission -------------------------
   //
-  // ------------------ Send Modulation (MIDI CC 1) Message -------------------
+  // Send the key events of all slaves in the order they were played, so that a
+  // chord spread across slaves is not sent in wiring order
   //
-  if (modulationWheel->IsReadingChanged())
+  KeyEvent event;
+  Slave* slave = nullptr;
+
+  while ((slave = eventMerger.NextEvent(event)) != nullptr)
   {
-    usbMIDI.controlChange(MODULATION_CC, (uint8_t)modulationWheel->GetReading(), CHANNEL);
+    if (jitterBuffer.GetDelay() == 0)
+    {
+      sendKeyEventOverUSB(event, slave->GetNotes(), slave->IsClockSynced());
+    }
+    else
+    {
+      //
+      // A full buffer hands its earliest event back, to be sent right away
+      //
+      KeyEvent released;
+      Slave* releasedSlave = jitterBuffer.Push(event, slave, micros(), released);
+
+      if (releasedSlave != nullptr)
+      {
+        sendKeyEventOverUSB(released, releasedSlave->GetNotes(), releasedSlave->IsClockSynced());
+      }
+    }
   }
-  
-  // ESP is little endian. Read buffer from LSB
 
   //
-  // ------------------------ Slave 1 MIDI Transmission -------------------------
+  // Release the held key events whose playout time has come
   //
-  // for (int i = 0; i < KEY_COUNT1; i++)
-  // {
-  //   uint8_t readiness = rxBuffer1[i + 0 * KEY_COUNT1];
+  while ((slave = jitterBuffer.Pop(event, micros())) != nullptr)
+  {
+    sendKeyEventOverUSB(event, slave->GetNotes(), slave->IsClockSynced());
+  }
 
-  //   if (readiness == 0x01)
-  //   {
-  //     uint8_t note = notes1[i];
+  if (jitterBuffer.GetDelay() > 0 && millis() - lastJitterLogTime >= JITTER_LOG_INTERVAL_MS)
+  {
+    lastJitterLogTime = millis();
+
+    Serial.print("Jitter buffer | Delay (us): "); Serial.print(jitterBuffer.GetDelay());
+    Serial.print(" | Occupancy: "); Serial.print(jitterBuffer.GetOccupancy());
+    Serial.print(" | Max occupancy: "); Serial.print(jitterBuffer.GetMaxOccupancy());
+    Serial.print(" | Late: "); Serial.print(jitterBuffer.GetLateEventCount());
+    Serial.println();
+  }
 
-  //     uint8_t velocity  = rxBuffer1[i + 1 * KEY_COUNT1];
-  //     uint8_t status    = rxBuffer1[i + 2 * KEY_COUNT1];
+  if (midiOut.GetFlushCount() > 0 && millis() - lastUsbLogTime >= USB_LOG_INTERVAL_MS)
+  {
+    lastUsbLogTime = millis();
+
+    Serial.print("USB MIDI | Events/transfer (est.): "); Serial.print(midiOut.GetEstimatedEventsPerTransfer());
+    Serial.print(" | Flush latency avg (us): "); Serial.print(midiOut.GetAverageFlushLatency());
+    Serial.print(" | Flush latency max (us): "); Serial.print(midiOut.GetMaxFlushLatency());
+    Serial.print(" | Flushes: "); Serial.print(midiOut.GetFlushCount());
+    Serial.print(" | Notes high-water: "); Serial.print(midiOut.GetNoteHighWater());
+    Serial.print(" | Note overflows: "); Serial.print(midiOut.GetNoteOverflowCount());
+    Serial.print(" | Controls high-water: "); Serial.print(midiOut.GetControlHighWater());
+    Serial.print(" | Control merges: "); Serial.print(midiOut.GetControlMergeCount());
+    Serial.print(" | Control drops: "); Serial.print(midiOut.GetControlDropCount());
+    Serial.print(" | Disconnected drops: "); Serial.print(midiOut.GetDisconnectedDropCount());
+    Serial.println();
+
+    midiOut.ResetStatistics();
+  }
+
+#ifdef MIDI_DIN
+  if (millis() - lastDinLogTime >= DIN_LOG_INTERVAL_MS)
+  {
+    lastDinLogTime = millis();
 
-  //     if (status == NOTE_ON)
-  //     {
-  //       usbMIDI.noteOn(note, velocity, CHANNEL);
-  //     } 
-  //     else
-  //     {
-  //       usbMIDI.noteOff(note, velocity, CHANNEL);
-  //     }
-  //   }
-  // }
+    Serial.print("DIN MIDI | Bytes/message: "); Serial.print(dinMidiOut.GetBytesPerMessage());
+    Serial.print(" | Pending max: "); Serial.print(dinMidiOut.GetMaxPendingCount());
+    Serial.print(" | Dropped: "); Serial.print(dinMidiOut.GetDroppedMessageCount());
+    Serial.println();
 
+    dinMidiOut.ResetStatistics();
+  }
+#endif
+
+  if (millis() - lastRouterLogTime >= ROUTER_LOG_INTERVAL_MS)
+  {
+    lastRouterLogTime = millis();
+
+    for (size_t i = 0; i < midiRouter.GetTransportCount(); i++)
+    {
+      Serial.print("MIDI router | "); Serial.print(midiRouter.GetTransportName(i));
+      Serial.print(" | Depth: "); Serial.print(midiRouter.GetQueueDepth(i));
+      Serial.print(" | Max depth: "); Serial.print(midiRouter.GetMaxQueueDepth(i));
+      Serial.print(" | Latency avg (us): "); Serial.print(midiRouter.GetAverageLatency(i));
+      Serial.print(" | Latency max (us): "); Serial.print(midiRouter.GetMaxLatency(i));
+      Serial.print(" | Dropped: "); Serial.print(midiRouter.GetDroppedCount(i));
+      Serial.print(" | Merged: "); Serial.print(midiRouter.GetMergedCount(i));
+      Serial.println();
+    }
+
+    midiRouter.ResetStatistics();
+  }
+}
+
+/**
+ * @brief Send a key event as a MIDI note
+ * @param event The key event
+ * @param notes The MIDI notes of the keys of the slave (or the master) that reported the key event
+ * @param synced Is the event's timestamp on the master's clock?
+ */
+void sendKeyEventOverUSB(const KeyEvent& event, const uint8_t* notes, const bool synced)
+{
   //
-  // ------------------------ Slave 2 MIDI Transmission -------------------------
+  // Transpose NOTE before sending it. 
   //
-  for (int i = 0; i < KEY_COUNT2; i++)
+  // If the current transpose counter is 0, the note is sent unaltered
+  // Otherwise, note + counter is sent. eg. C4 becomes C4# for a count
+  // value of 1, meaning transpose by 1 semitone
+  //
+  uint8_t note = notes[event.key] + transposeKnob->GetCounter();
+
+#ifdef LINK_BENCHMARK
+  //
+  // Timestamps are only comparable with the master's clock once synced
+  //
+  if (synced)
   {
-    uint8_t readiness = rxBuffer2[i + 0 * KEY_COUNT2];
+    unsigned long latency = micros() - event.timestamp;
+
+    eventLatencyTotal += latency;
+    eventLatencyMax = max(eventLatencyMax, latency);
+    eventLatencyCount++;
+  }
+#endif
 
-    if (readiness == 0x01)
+  if (event.status == NOTE_ON)
+  {
+    midiRouter.NoteOn(note, event.velocity, CHANNEL);
+  } 
+  else
+  {
+    midiRouter.NoteOff(note, event.velocity, CHANNEL);
+  }
+}
+
+/**
+ * @brief Push link commands typed on the serial console down to the slaves
+ *
+ * Lets a slave be tuned while it is playing, without reflashing it. Commands
+ * take the form "<slave> <command> <key|all> <value>", for example:
+ *
+ *   2 threshold all 12   -> NOTE ON threshold of every key on slave 2
+ *   2 filter 0 0.4       -> EMA smoothing factor of key 0 on slave 2
+ *   1 rate all 2000      -> 2000 key scans per second on slave 1 (0 = free running)
+ *   1 pattern all 1      -> synthetic notes on slave 1 (0 to stop)
+ *   1 sync all 0         -> re-synchronize the clock of slave 1 with the master
+ *   0 threshold all 12   -> NOTE ON threshold of the master's own keys (DIRECT_SCAN builds only)
+ */
+void handleConsoleCommands()
+{
+  static char line[48];
+  static size_t length = 0;
+
+  while (Serial.available() > 0)
+  {
+    char c = Serial.read();
+
+    if (c != '\n' && c != '\r')
     {
-      //
-      // Only send a PITCH BEND after a NOTE
-      // 
-      // Transpose NOTE before sending it. 
-      //
-      // If the current transpose counter is 0, the note is sent unaltered
-      // Otherwise, note + counter is sent. eg. C4 becomes C4# for a count
-      // value of 1, meaning transpose by 1 semitone
-      //
-      uint8_t note = notes2[i] + transposeKnob->GetCounter();
+      if (length < sizeof(line) - 1)
+      {
+        line[length++] = c;
+      }
+      continue;
+    }
+
+    if (length == 0)
+    {
+      continue;
+    }
+    line[length] = '\0';
+    length = 0;
+
+    int id = 0;
+    char name[12] {0};
+    char target[8] {0};
+    float value = 0;
 
-      uint8_t velocity  = rxBuffer2[i + 1 * KEY_COUNT2];
-      uint8_t status    = rxBuffer2[i + 2 * KEY_COUNT2];
+    if (sscanf(line, "%d %11s %7s %f", &id, name, target, &value) != 4)
+    {
+      Serial.println("Usage: <slave> <threshold|filter|rate|pattern|sync> <key|all> <value>");
+      continue;
+    }
 
-      if (status == NOTE_ON)
+#ifdef DIRECT_SCAN
+    //
+    // Slave 0 is the master's own keys, which take the command straight away
+    //
+    if (id == 0)
+    {
+      if (strcmp(name, "filter") == 0)
       {
-        usbMIDI.noteOn(note, velocity, CHANNEL);
-      } 
-      else
+        value *= 65536.0f;
+      }
+
+      uint8_t command = (strcmp(name, "threshold") == 0) ? CMD_SET_THRESHOLD :
+                        (strcmp(name, "filter") == 0)    ? CMD_SET_FILTER :
+                        (strcmp(name, "rate") == 0)      ? CMD_SET_SCAN_RATE :
+                        (strcmp(name, "pattern") == 0)   ? CMD_TEST_PATTERN : CMD_NONE;
+
+      if (command == CMD_NONE)
       {
-        usbMIDI.noteOff(note, velocity, CHANNEL);
+        Serial.print("Unknown command: "); Serial.println(line);
+        continue;
       }
+      localKeys->applyCommand(command, (strcmp(target, "all") == 0) ? CMD_ALL_KEYS : atoi(target), static_cast<uint32_t>(value));
+      continue;
+    }
+#endif
+
+    Slave* slave = (id >= 1 && id <= SLAVE_COUNT) ? slaves[id - 1] : nullptr;
+    uint8_t key = (strcmp(target, "all") == 0) ? CMD_ALL_KEYS : static_cast<uint8_t>(atoi(target));
+
+    uint8_t command = CMD_NONE;
+    uint32_t argument = static_cast<uint32_t>(value);
+
+    if (strcmp(name, "threshold") == 0)    { command = CMD_SET_THRESHOLD; }
+    else if (strcmp(name, "filter") == 0)  { command = CMD_SET_FILTER; argument = static_cast<uint32_t>(value * 65536.0f); }
+    else if (strcmp(name, "rate") == 0)    { command = CMD_SET_SCAN_RATE; }
+    else if (strcmp(name, "pattern") == 0) { command = CMD_TEST_PATTERN; }
+    else if (strcmp(name, "sync") == 0)    { command = CMD_TIME_SYNC; argument = micros(); }
+
+    if (slave == nullptr || command == CMD_NONE)
+    {
+      Serial.print("Unknown slave or command: "); Serial.println(line);
+    }
+    else if (!slave->SendCommand(command, key, argument))
+    {
+      Serial.print("Command queue full for slave "); Serial.println(id);
     }
   }
+}
+
+#ifdef LINK_BENCHMARK
+/**
+ * @brief Log the CPU time spent on the slave links and the key-to-USB latency
+ *
+ * Build once with LINK_UART and once without, and compare the reports to weigh
+ * the UART link against SPI polling. The service time is the CPU time the main
+ * loop spends on the links per pass. The latency runs from the slave scanning a
+ * key to the master handing the note to USB, jitter buffer delay included. Over
+ * SPI, the number of polls shows the bus traffic saved by the data-ready lines
+ */
+void reportLinkBenchmark()
+{
+  if (millis() - lastBenchmarkLogTime < BENCHMARK_LOG_INTERVAL_MS)
+  {
+    return;
+  }
+  lastBenchmarkLogTime = millis();
+
+#ifdef LINK_UART
+  Serial.print("Link benchmark | Link: UART");
+#else
+  Serial.print("Link benchmark | Link: SPI");
+#endif
+  Serial.print(" | Service (us/loop): "); Serial.print(linkServiceCount ? (float)linkServiceTime / linkServiceCount : 0.0f);
+  Serial.print(" | Latency avg (us): "); Serial.print(eventLatencyCount ? eventLatencyTotal / eventLatencyCount : 0);
+  Serial.print(" | Latency max (us): "); Serial.print(eventLatencyMax);
+  Serial.print(" | Events: "); Serial.print(eventLatencyCount);
+#ifndef LINK_UART
+  uint32_t pollCount = fspiBus.GetPollCount() + hspiBus.GetPollCount();
+  Serial.print(" | Polls: "); Serial.print(pollCount - lastPollCount);
+  lastPollCount = pollCount;
+#endif
+  Serial.println();
+
+  linkServiceTime = 0;
+  linkServiceCount = 0;
+  eventLatencyTotal = 0;
+  eventLatencyMax = 0;
+  eventLatencyCount = 0;
+}
+#endif
 
-  // memset(rxBuffer1, 0, BUFFER_SIZE1);
-  // memset(rxBuffer2, 0, BUFFER_SIZE2);
-}
\ No newline at end of file
+#ifdef DIRECT_SCAN
+/**
+ * @brief Scan the keys wired to the master and send their events straight over USB
+ *
+ * The events are stamped by the master's own clock as the keys are read, so
+ * they skip the merger and the jitter buffer
+ */
+void scanLocalKeys()
+{
+  localKeys->run();
+
+  KeyEvent event;
+
+  while (localKeys->popEvent(event))
+  {
+    sendKeyEventOverUSB(event, localNotes, true);
+  }
+}
+#endif
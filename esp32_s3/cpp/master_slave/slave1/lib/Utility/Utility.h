@@ -20,6 +20,13 @@
 #define HSPI_SCLK 36    // GP-SPI3  | Clock 
 #define HSPI_SS   45    // GP-SPI3  | Chip Select (CS)
 
+#define DATA_READY 21   // High while key events wait for the master. Wired to the master's DATA_READY input
+
+// ------------------------ UART Communication Macros ----------------------
+// Only used when built with LINK_UART. TX goes to the master's RX and vice versa
+#define LINK_UART_TX  38
+#define LINK_UART_RX  39
+
 // ---------------------------- MIDI Constants -----------------------------
 #define NOTE_ON   0x90
 #define NOTE_OFF  0x80
@@ -23,8 +23,8 @@
 
 #define THRESHOLD   5
 
-static constexpr size_t BUFFER_SIZE = 8; // Size of buffer to hold tx rx data | should be at least key count
-static constexpr size_t QUEUE_SIZE = 1;  // Num of transaction b/n slave & master
+static constexpr size_t BUFFER_SIZE = FRAME_SIZE; // Size of buffer to hold tx rx data | shared with the master
+static constexpr size_t QUEUE_SIZE = 2;  // Num of transactions kept pre-loaded for the master | at least 2
 
 KeyController* octave = nullptr;
 
@@ -33,6 +33,7 @@ const int damperPins[KEY_COUNT] {DAMPER_1, DAMPER_2};
 
 void setup()
 {
+  unsigned long bootStart = micros();
 
   // Sample analog pins at 12-bit resolution: 0-4095
   analogSetAttenuation(ADC_11db);
@@ -57,11 +58,29 @@ void setup()
   // Create new key controller
   //
   octave = new KeyController(KEY_COUNT, keyPins, damperPins, THRESHOLD, START_NOTE, RESOLUTION);
+  unsigned long keysReady = micros();
   
-  // initiate spi instance
+#ifdef LINK_UART
+  //
+  // Push frames to the master over UART instead of waiting to be polled
+  //
+  octave->initializeUart(UART_NUM_1, LINK_UART_TX, LINK_UART_RX, UART_LINK_BAUD);
+#else
+  //
+  // Initiate spi instance. No settling delay is needed: the master keeps probing
+  // until the first frame carrying the ready header is clocked out
+  //
   pinMode(SPI_MISO, OUTPUT);
   octave->initializeSpi(SPI_BUS, SPI_MODE, BUFFER_SIZE, QUEUE_SIZE);
+  octave->setDataReadyPin(DATA_READY);
+#endif
+  unsigned long spiReady = micros();
+
   Serial.println("Setup complete!...");
+  Serial.print("Boot timing (us) | Keys: "); Serial.print(keysReady - bootStart);
+  Serial.print(" | Link: "); Serial.print(spiReady - keysReady);
+  Serial.print(" | Total: "); Serial.print(spiReady - bootStart);
+  Serial.println();
 }
 
 void loop()
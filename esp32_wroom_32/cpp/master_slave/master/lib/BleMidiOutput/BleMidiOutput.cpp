@@ -0,0 +1,403 @@
+/**
+ * @file BleMidiOutput.cpp
+ * @author Mate Narh
+ */
+
+#include "BleMidiOutput.h"
+
+#include <Utility.h>
+
+//
+// Connection parameters requested from the central, in BLE units. 6 x 1.25 ms
+// is the shortest interval the spec allows. Centrals round it up to what they
+// accept (eg. 11.25 ms or 15 ms on iOS)
+//
+static constexpr uint16_t MIN_CONNECTION_INTERVAL = 6;   ///< 7.5 ms
+static constexpr uint16_t MAX_CONNECTION_INTERVAL = 12;  ///< 15 ms
+static constexpr uint16_t SLAVE_LATENCY = 0;             ///< Connection events the peripheral may skip
+static constexpr uint16_t SUPERVISION_TIMEOUT = 200;     ///< 2 s, in 10 ms units
+
+static constexpr uint16_t MAX_MTU = 247;                 ///< MTU requested so that a packet fits one link-layer frame
+
+/**
+ * @brief Constructor
+ * @param name The name advertised to centrals
+ */
+BleMidiOutput::BleMidiOutput(const char* name) : mName(name)
+{
+}
+
+/**
+ * @brief Set the functions called when a central connects and disconnects
+ *
+ * The functions are called from the NimBLE host task, so they must be short
+ * @param onConnect Called when a central connects, or nullptr
+ * @param onDisconnect Called when the central disconnects, or nullptr
+ */
+void BleMidiOutput::SetConnectionHandlers(void (*onConnect)(), void (*onDisconnect)())
+{
+    mOnConnect = onConnect;
+    mOnDisconnect = onDisconnect;
+}
+
+/**
+ * @brief Returns whether a central is connected
+ */
+bool BleMidiOutput::IsConnected() const
+{
+    return mConnected;
+}
+
+/**
+ * @brief Get the connection interval in use, in microseconds (0 when not connected)
+ */
+unsigned long BleMidiOutput::GetConnectionInterval() const
+{
+    return mConnectionInterval;
+}
+
+/**
+ * @brief Get the number of packets notified per second since the statistics were reset
+ */
+float BleMidiOutput::GetPacketsPerSecond() const
+{
+    unsigned long elapsed = millis() - mStatisticsStart;
+
+    return elapsed ? mPackets * 1000.0f / elapsed : 0.0f;
+}
+
+/**
+ * @brief Get the average number of MIDI messages carried by one packet
+ */
+float BleMidiOutput::GetMessagesPerPacket() const
+{
+    return mPackets ? static_cast<float>(mPackedMessages) / mPackets : 0.0f;
+}
+
+/**
+ * @brief Get the average time from a message being queued to its packet being notified, in microseconds
+ */
+unsigned long BleMidiOutput::GetAverageLatency() const
+{
+    return mPackedMessages ? mLatencyTotal / mPackedMessages : 0;
+}
+
+/**
+ * @brief Get the longest time from a message being queued to its packet being notified, in microseconds
+ */
+unsigned long BleMidiOutput::GetMaxLatency() const
+{
+    return mLatencyMax;
+}
+
+/**
+ * @brief Get the number of messages lost to a full queue or to a missing central
+ */
+uint32_t BleMidiOutput::GetDroppedMessageCount() const
+{
+    return mDroppedMessages;
+}
+
+/**
+ * @brief Start the BLE-MIDI service and advertise it
+ */
+void BleMidiOutput::Begin()
+{
+    NimBLEDevice::init(mName);
+    NimBLEDevice::setMTU(MAX_MTU);
+
+    mServer = NimBLEDevice::createServer();
+    mServer->setCallbacks(this, false);
+
+    NimBLEService* service = mServer->createService(SERVICE_UUID);
+    mCharacteristic = service->createCharacteristic(CHARACTERISTIC_UUID,
+                                                    NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::WRITE_NR | NIMBLE_PROPERTY::NOTIFY);
+    mCharacteristic->setCallbacks(this);
+    service->start();
+
+    NimBLEAdvertising* advertising = NimBLEDevice::getAdvertising();
+    advertising->addServiceUUID(service->getUUID());
+    advertising->setScanResponse(true);
+    advertising->start();
+
+    ResetStatistics();
+}
+
+/**
+ * @brief Get the name of this transport, for logs
+ */
+const char* BleMidiOutput::GetName() const
+{
+    return "BLE";
+}
+
+/**
+ * @brief Returns whether a central is connected to receive messages
+ */
+bool BleMidiOutput::IsActive() const
+{
+    return mConnected;
+}
+
+/**
+ * @brief Queue a message for the next packet
+ * @param event The message to send
+ * @return True if the message was queued and false if it should be offered again later
+ */
+bool BleMidiOutput::Send(const MidiEvent& event)
+{
+    return Queue(event.status, event.data1, event.data2);
+}
+
+/**
+ * @brief Notify the waiting messages as soon as the stack takes a notification
+ *
+ * A message is never held back on a timer. While the stack is out of buffers
+ * (the radio has not yet carried the previous notifications out at a
+ * connection event), the messages queued meanwhile wait and are packed
+ * together into the next packet rather than notified one by one. Call once
+ * per pass of the main loop
+ */
+void BleMidiOutput::Service()
+{
+    if (!mConnected)
+    {
+        mDroppedMessages += mMessageCount;
+        mMessageCount = 0;
+        return;
+    }
+
+    if (mMessageCount == 0)
+    {
+        return;
+    }
+
+    //
+    // The central may have settled on other connection parameters than the
+    // ones requested
+    //
+    mConnectionInterval = mServer->getPeerIDInfo(mConnectionHandle).getConnInterval() * 1250UL;
+
+    while (mMessageCount > 0 && SendPacket())
+    {
+    }
+}
+
+/**
+ * @brief Clear the packet rate and latency statistics
+ */
+void BleMidiOutput::ResetStatistics()
+{
+    mStatisticsStart = millis();
+    mPackets = 0;
+    mPackedMessages = 0;
+    mLatencyTotal = 0;
+    mLatencyMax = 0;
+}
+
+/**
+ * @brief Record the connection and ask for the shortest connection interval
+ * @param server The GATT server the central connected to
+ * @param desc The description of the new connection
+ */
+void BleMidiOutput::onConnect(NimBLEServer* server, ble_gap_conn_desc* desc)
+{
+    mConnectionHandle = desc->conn_handle;
+    mConnectionInterval = desc->conn_itvl * 1250UL;
+    mMtu = 23;
+    mConnected = true;
+
+    server->updateConnParams(desc->conn_handle, MIN_CONNECTION_INTERVAL, MAX_CONNECTION_INTERVAL, SLAVE_LATENCY, SUPERVISION_TIMEOUT);
+
+    if (mOnConnect != nullptr)
+    {
+        mOnConnect();
+    }
+}
+
+/**
+ * @brief Record the disconnection. NimBLE advertises again on its own
+ * @param server The GATT server the central disconnected from
+ */
+void BleMidiOutput::onDisconnect(NimBLEServer* server)
+{
+    (void)server;
+
+    mConnected = false;
+    mConnectionInterval = 0;
+
+    if (mOnDisconnect != nullptr)
+    {
+        mOnDisconnect();
+    }
+}
+
+/**
+ * @brief Record the MTU negotiated with the central, which bounds the packet size
+ * @param mtu The new ATT MTU
+ * @param desc The description of the connection
+ */
+void BleMidiOutput::onMTUChange(uint16_t mtu, ble_gap_conn_desc* desc)
+{
+    (void)desc;
+    mMtu = mtu;
+}
+
+/**
+ * @brief Record whether the stack took the last notification
+ *
+ * NimBLE reports the outcome of a notification from within notify(), so the
+ * flags are read right after it returns
+ * @param characteristic The characteristic notified
+ * @param status The outcome of the notification
+ * @param code The NimBLE return code
+ */
+void BleMidiOutput::onStatus(NimBLECharacteristic* characteristic, Status status, int code)
+{
+    (void)characteristic;
+
+    bool sent = (status == SUCCESS_NOTIFY || status == SUCCESS_INDICATE);
+
+    mNotifyRefused = (status == ERROR_GATT && code == BLE_HS_ENOMEM);
+    mNotifyFailed = !sent && !mNotifyRefused;
+}
+
+/**
+ * @brief Queue a channel message for the next packet
+ * @param status The status byte of the message
+ * @param data1 The first data byte
+ * @param data2 The second data byte
+ * @return True if the message was queued and false if the queue is full
+ */
+bool BleMidiOutput::Queue(const uint8_t status, const uint8_t data1, const uint8_t data2)
+{
+    if (mMessageCount == QUEUE_CAPACITY)
+    {
+        return false;
+    }
+
+    Message& message = mMessages[mMessageCount++];
+    message.status = status;
+    message.data1 = data1;
+    message.data2 = data2;
+    message.queuedAt = micros();
+    message.timestamp = millis();
+    return true;
+}
+
+/**
+ * @brief Pack as many waiting messages as fit into one BLE-MIDI packet
+ *
+ * Packet layout:
+ * ----------------------------------------------------------------------------
+ * | HEADER | TIMESTAMP | STATUS | DATA | DATA | [TIMESTAMP] | [STATUS] | ... |
+ * ----------------------------------------------------------------------------
+ * The header holds the high 6 bits of the 13-bit millisecond timestamp and each
+ * timestamp byte the low 7 bits. A message with the status of the previous one
+ * drops its status byte (running status), and also its timestamp byte when that
+ * repeats too. The receiver handles the low bits wrapping within a packet. The
+ * timestamp comes from millis(), which wraps on a multiple of 2^13 ms, so the
+ * receiver never sees it jump
+ * @param packet The buffer to pack the messages into
+ * @param maxSize The size of the buffer
+ * @param packedCount Set to the number of messages packed, oldest first
+ * @return The size of the packet
+ */
+size_t BleMidiOutput::EncodePacket(uint8_t* packet, const size_t maxSize, size_t& packedCount) const
+{
+    size_t size = 0;
+    uint8_t lastStatus = 0;
+    int lastTimestamp = -1;
+
+    packedCount = 0;
+    packet[size++] = 0x80 | ((mMessages[0].timestamp >> 7) & 0x3F);
+
+    for (size_t i = 0; i < mMessageCount; i++)
+    {
+        const Message& message = mMessages[i];
+        uint8_t timestamp = 0x80 | (message.timestamp & 0x7F);
+
+        bool runningStatus = message.status == lastStatus;
+        bool sameTimestamp = runningStatus && timestamp == lastTimestamp;
+        size_t needed = 2 + (runningStatus ? 0 : 1) + (sameTimestamp ? 0 : 1);
+
+        if (size + needed > maxSize)
+        {
+            break;
+        }
+
+        if (!sameTimestamp)
+        {
+            packet[size++] = timestamp;
+        }
+
+        if (!runningStatus)
+        {
+            packet[size++] = message.status;
+        }
+        packet[size++] = message.data1;
+        packet[size++] = message.data2;
+
+        lastStatus = message.status;
+        lastTimestamp = timestamp;
+        packedCount++;
+    }
+    return size;
+}
+
+/**
+ * @brief Notify one packet holding the oldest waiting messages
+ * @return True if the packet was taken by the stack and false if its messages must wait
+ */
+bool BleMidiOutput::SendPacket()
+{
+    uint8_t packet[MAX_PACKET_SIZE];
+    size_t maxSize = min(static_cast<size_t>(mMtu - ATT_HEADER_SIZE), MAX_PACKET_SIZE);
+    size_t packedCount = 0;
+    size_t size = EncodePacket(packet, maxSize, packedCount);
+
+    if (packedCount == 0)
+    {
+        mDroppedMessages += mMessageCount;
+        mMessageCount = 0;
+        return false;
+    }
+
+    mNotifyRefused = false;
+    mNotifyFailed = false;
+    mCharacteristic->setValue(packet, size);
+    mCharacteristic->notify();
+
+    if (mNotifyRefused)
+    {
+        return false;
+    }
+
+    //
+    // A central that has not subscribed yet cannot receive the packet, and
+    // neither is any other failure worth trying again
+    //
+    if (mNotifyFailed)
+    {
+        mDroppedMessages += packedCount;
+        mMessageCount -= packedCount;
+        memmove(mMessages, mMessages + packedCount, mMessageCount * sizeof(Message));
+        return true;
+    }
+
+    unsigned long now = micros();
+
+    for (size_t i = 0; i < packedCount; i++)
+    {
+        unsigned long latency = now - mMessages[i].queuedAt;
+
+        mLatencyTotal += latency;
+        mLatencyMax = max(mLatencyMax, latency);
+    }
+    mPackets++;
+    mPackedMessages += packedCount;
+
+    mMessageCount -= packedCount;
+    memmove(mMessages, mMessages + packedCount, mMessageCount * sizeof(Message));
+    return true;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file BleMidiOutput.h
+ * @author Mate Narh
+ *
+ * Class for the master to send MIDI messages over BLE-MIDI in batches. Messages
+ * are notified as soon as the stack takes a notification, and every message
+ * that waited while it could not is packed into a single BLE-MIDI packet: one
+ * shared header byte, a timestamp byte per message (dropped when it repeats)
+ * and running status. The shortest connection interval the central will accept
+ * is requested at connection, so that a packet waits as little as possible for
+ * the radio
+ */
+
+#ifndef BLE_MIDI_OUTPUT_H
+#define BLE_MIDI_OUTPUT_H
+
+#include <Arduino.h>
+#include <NimBLEDevice.h>
+#include <MidiTransport.h>
+
+class BleMidiOutput : public NimBLEServerCallbacks, public NimBLECharacteristicCallbacks, public MidiTransport
+{
+    private:
+
+        static constexpr size_t QUEUE_CAPACITY = 64;     ///< Number of messages that can wait for a packet
+        static constexpr size_t MAX_PACKET_SIZE = 244;   ///< Largest packet built: a notification at the 247-byte MTU requested
+        static constexpr uint16_t ATT_HEADER_SIZE = 3;   ///< Bytes of the MTU taken by the notification header
+
+        /// A MIDI channel message waiting to be packed
+        struct Message
+        {
+            uint8_t status;
+            uint8_t data1;
+            uint8_t data2;
+            unsigned long queuedAt;  ///< Time at which the message was queued, in microseconds
+            unsigned long timestamp; ///< Time at which the message was queued, in milliseconds, for the packet
+        };
+
+        const char* mName = nullptr;                       ///< The name advertised to centrals
+        NimBLEServer* mServer = nullptr;                   ///< The GATT server hosting the BLE-MIDI service
+        NimBLECharacteristic* mCharacteristic = nullptr;   ///< The BLE-MIDI I/O characteristic notified with packets
+
+        volatile bool mConnected = false;       ///< Is a central connected?
+        uint16_t mConnectionHandle = 0;         ///< The handle of the connection with the central
+        volatile uint16_t mMtu = 23;            ///< The ATT MTU negotiated with the central
+        unsigned long mConnectionInterval = 0;  ///< The connection interval in use, in microseconds
+
+        void (*mOnConnect)() = nullptr;         ///< Called when a central connects
+        void (*mOnDisconnect)() = nullptr;      ///< Called when the central disconnects
+
+        Message mMessages[QUEUE_CAPACITY];      ///< Messages waiting to be packed, in the order they were queued
+        size_t mMessageCount = 0;               ///< Number of messages waiting
+        bool mNotifyRefused = false;            ///< Did the stack refuse the last notification for want of buffers?
+        bool mNotifyFailed = false;             ///< Did the last notification fail for another reason, eg. no subscribed central?
+
+        // ------------------------------- Statistics ----------------------------------
+
+        unsigned long mStatisticsStart = 0;     ///< Time at which the statistics were last reset, in milliseconds
+        uint32_t mPackets = 0;                  ///< Packets notified since the statistics were reset
+        uint32_t mPackedMessages = 0;           ///< Messages carried by those packets
+        unsigned long mLatencyTotal = 0;        ///< Sum of the queue-to-notify times of those messages, in microseconds
+        unsigned long mLatencyMax = 0;          ///< Longest queue-to-notify time, in microseconds
+        uint32_t mDroppedMessages = 0;          ///< Messages lost to a full queue or to a missing central
+
+        bool Queue(const uint8_t status, const uint8_t data1, const uint8_t data2);
+        size_t EncodePacket(uint8_t* packet, const size_t maxSize, size_t& packedCount) const;
+        bool SendPacket();
+
+    public:
+
+        BleMidiOutput(const char* name);
+
+        // ----------------------------------- Setters ---------------------------------
+        void SetConnectionHandlers(void (*onConnect)(), void (*onDisconnect)());
+
+        // ----------------------------------- Getters ---------------------------------
+        bool IsConnected() const;
+        unsigned long GetConnectionInterval() const;
+        float GetPacketsPerSecond() const;
+        float GetMessagesPerPacket() const;
+        unsigned long GetAverageLatency() const;
+        unsigned long GetMaxLatency() const;
+        uint32_t GetDroppedMessageCount() const;
+
+        // --------------------------------- Core Methods ------------------------------
+        void Begin();
+        void ResetStatistics();
+
+        // ------------------------------ MIDI Transport -------------------------------
+        const char* GetName() const override;
+        bool IsActive() const override;
+        bool Send(const MidiEvent& event) override;
+        void Service() override;
+
+        // ----------------------------- NimBLE Callbacks ------------------------------
+        void onConnect(NimBLEServer* server, ble_gap_conn_desc* desc) override;
+        void onDisconnect(NimBLEServer* server) override;
+        void onMTUChange(uint16_t mtu, ble_gap_conn_desc* desc) override;
+        void onStatus(NimBLECharacteristic* characteristic, Status status, int code) override;
+
+        BleMidiOutput() = delete;                        ///< Default constructor disabled
+        BleMidiOutput(const BleMidiOutput &) = delete;   ///< Copy constructor disabled
+        void operator=(const BleMidiOutput &) = delete;  ///< Assignment operator disabled
+};
+
+#endif // BLE_MIDI_OUTPUT_H
@@ -1,8 +1,8 @@
 #include <Arduino.h>
-#include <BLEMIDI_Transport.h>
-#include <hardware/BLEMIDI_ESP32_NimBLE.h>
 #include <SPI.h>
 
+#include <BleMidiOutput.h>
+#include <MidiRouter.h>
 #include <Utility.h>
 
 // Indicators
@@ -11,6 +11,8 @@
 // MIDI macros
 #define CHANNEL 1 // Range: 1 - 16 channels available
 
+#define BLE_LOG_INTERVAL_MS 10000
+
 // Set up SPI macros and buffers
 #define SLAVE1_KEY_COUNT 2
 
@@ -23,23 +25,25 @@ static const uint8_t slave1Notes[SLAVE1_KEY_COUNT] {0x3C, 0x3D}; // {C4, C4#}for
 
 uint8_t slave1RxBuffer[SLAVE1_BUFFER_SIZE] {0};
 
-// Create BLE Server and Characteristic
-BLEMIDI_CREATE_INSTANCE("Octavio MIDI", MIDI);
+// Create BLE Server and Characteristic. Messages that wait for the stack are batched into one packet
+BleMidiOutput bleMidi("Octavio MIDI");
 bool deviceConnected = false;
+unsigned long lastBleLogTime = 0;
+
+// Every message is encoded once here and queued for each output
+MidiRouter midiRouter;
 
 // ------------------------- Function Declarations ---------------------------
 void OnConnect();
 void OnDisconnect();
 void sendMidiMsgUpdatesOverBLE();
+void reportBleStatistics();
 void querySlave(SPIClass *spi, const int ss, uint8_t *receiveBuffer, const size_t bufferSize);
 
 
 void setup()
 {
-  //
-  // Initiate BLE MIDI instance
-  //
-  MIDI.begin(CHANNEL);
+  Serial.begin(115200);
 
   //
   // Initialize indicators
@@ -51,11 +55,10 @@ void setup()
   // ------------------------------ SPI Setup -----------------------------
   //
 
-  // Initialize SPI and wait 2 seconds (2000 ms) to guarantee robust setup
+  // Initialize SPI. Frames polled before the slave is up carry no readiness
+  // flags (0x01), so they are ignored and no settling delay is needed
   hspi = new SPIClass(HSPI);
 
-  delay(2000);
-
   pinMode(HSPI_SS, OUTPUT);
   pinMode(HSPI_MOSI, OUTPUT);
   digitalWrite(HSPI_SS, HIGH);
@@ -64,14 +67,13 @@ void setup()
   //
   // ----------------------------- BLE Setup -----------------------------
   //
-  BLEMIDI.setHandleConnected(OnConnect);
-  BLEMIDI.setHandleDisconnected(OnDisconnect);
+  bleMidi.SetConnectionHandlers(OnConnect, OnDisconnect);
+  bleMidi.Begin();
+  midiRouter.AddTransport(&bleMidi);
 }
 
 void loop()
 {
-  MIDI.read();
-
   //
   //--- Handle MIDI message transmission based on connection status ---
   //
@@ -84,6 +86,9 @@ void loop()
     querySlave(hspi, HSPI_SS, slave1RxBuffer, SLAVE1_BUFFER_SIZE);
     sendMidiMsgUpdatesOverBLE();
   }
+  midiRouter.Service();
+
+  reportBleStatistics();
 }
 
 /**
@@ -168,12 +173,42 @@ void sendMidiMsgUpdatesOverBLE()
 
       if (status == NOTE_ON)
       {
-        MIDI.sendNoteOn(note, velocity, CHANNEL);
+        midiRouter.NoteOn(note, velocity, CHANNEL);
       } 
       else
       {
-        MIDI.sendNoteOff(note, velocity, CHANNEL);
+        midiRouter.NoteOff(note, velocity, CHANNEL);
       }
     }
   }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Log the BLE-MIDI packet rate and latency
+ *
+ * The latency runs from a note being queued to its packet being taken by the
+ * stack. The packet then leaves at the next connection event, so the end-to-end
+ * latency is at most the logged maximum plus one connection interval
+ */
+void reportBleStatistics()
+{
+  if (millis() - lastBleLogTime < BLE_LOG_INTERVAL_MS)
+  {
+    return;
+  }
+  lastBleLogTime = millis();
+
+  Serial.print("BLE MIDI | Packets/s: "); Serial.print(bleMidi.GetPacketsPerSecond());
+  Serial.print(" | Messages/packet: "); Serial.print(bleMidi.GetMessagesPerPacket());
+  Serial.print(" | Latency avg (us): "); Serial.print(bleMidi.GetAverageLatency());
+  Serial.print(" | Latency max (us): "); Serial.print(bleMidi.GetMaxLatency());
+  Serial.print(" | Interval (us): "); Serial.print(bleMidi.GetConnectionInterval());
+  Serial.print(" | End-to-end max (us): "); Serial.print(bleMidi.GetMaxLatency() + bleMidi.GetConnectionInterval());
+  Serial.print(" | Dropped: "); Serial.print(bleMidi.GetDroppedMessageCount() + midiRouter.GetDroppedCount(0));
+  Serial.print(" | Router depth max: "); Serial.print(midiRouter.GetMaxQueueDepth(0));
+  Serial.print(" | Router latency max (us): "); Serial.print(midiRouter.GetMaxLatency(0));
+  Serial.println();
+
+  bleMidi.ResetStatistics();
+  midiRouter.ResetStatistics();
+}
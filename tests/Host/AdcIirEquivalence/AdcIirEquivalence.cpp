@@ -0,0 +1,238 @@
+/*
+ * @file AdcIirEquivalence.cpp
+ * @author Mate Narh
+ *
+ * This host program checks the hardware smoothing path of the wheels against
+ * the software one, to pick the k of the ADC's hardware IIR filters.
+ *
+ *     Hardware path : every conversion goes through the IIR model, and the
+ *                     filtered conversions of a pass are averaged
+ *     Software path : the raw conversions of a pass are averaged, then go
+ *                     through a software filter once per pass
+ *
+ * For each k, the hardware path is compared with a software EMA whose smoothing
+ * factor per pass is the equivalent of the IIR filter's (Equivalence: RMS and
+ * largest difference, in counts). If these stay within a count or two, the
+ * software filter can be swapped for the hardware one. The lag on moving
+ * gestures and the jitter at rest of every path are reported as well (see
+ * ../Common/WheelGestures.h), next to the software filters of the wheels
+ * (EMA α = 0.1 per pass, One-Euro).
+ *
+ * Build and run from this directory:
+ *
+ *     g++ -std=c++17 -O2 -I../Common -I../../../common/OneEuroFilter AdcIirEquivalence.cpp \
+ *         ../../../common/OneEuroFilter/OneEuroFilter.cpp -o AdcIirEquivalence
+ *     ./AdcIirEquivalence
+ *
+ * The scan rate and loop period can be changed with eg. -DCONVERSION_RATE_HZ=5000,
+ * and the precision assumed for the hardware with eg. -DIIR_FRACTION_BITS=4
+ */
+
+#include "AdcIirModel.h"
+#include <OneEuroFilter.h>
+#include <WheelGestures.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#ifndef CONVERSION_RATE_HZ
+#define CONVERSION_RATE_HZ      10000  // Per channel: ANALOG_SAMPLE_RATE_HZ shared by the two wheels
+#endif
+#ifndef PASS_PERIOD_US
+#define PASS_PERIOD_US          1000   // Time between two passes of the main loop
+#endif
+#ifndef IIR_FRACTION_BITS
+#define IIR_FRACTION_BITS       0      // Fractional bits the hardware is assumed to keep
+#endif
+
+#define ADC_MAX                 4095
+#define DURATION_MS             2000
+
+struct Pass
+{
+    uint32_t time;               // us
+    std::vector<int> raw;        // The conversions of the pass
+    double reference;            // The clean position at the end of the pass
+};
+
+struct Comparison
+{
+    double rms = 0;
+    double max = 0;
+};
+
+// ---------------------------------- Gestures ----------------------------------
+
+/**
+ * @brief Sample a clean gesture the way the scan does, with ADC-like noise, pass by pass
+ */
+static std::vector<Pass> Sample(const std::function<double(double)>& shape)
+{
+    std::vector<Pass> passes;
+    uint32_t seed = 12345;
+    double conversionPeriod = 1e6 / CONVERSION_RATE_HZ;
+    double nextConversion = 0;
+
+    for (uint32_t time = PASS_PERIOD_US; time <= DURATION_MS * 1000u; time += PASS_PERIOD_US)
+    {
+        Pass pass;
+
+        for (; nextConversion < time; nextConversion += conversionPeriod)
+        {
+            double read = shape(nextConversion / 1e6) + Noise(seed, 6.0);
+            pass.raw.push_back(int(std::lround(std::fmin(std::fmax(read, 0.0), ADC_MAX))));
+        }
+        pass.time = time;
+        pass.reference = shape(time / 1e6);
+        passes.push_back(pass);
+    }
+    return passes;
+}
+
+// ---------------------------------- Paths -------------------------------------
+
+static std::vector<double> HardwarePath(const std::vector<Pass>& passes, const uint32_t k)
+{
+    std::vector<double> output;
+    AdcIirModel filter(k, IIR_FRACTION_BITS);
+
+    for (const Pass& pass : passes)
+    {
+        long total = 0;
+
+        for (int raw : pass.raw)
+        {
+            total += filter.Filter(raw);
+        }
+        output.push_back(pass.raw.empty() ? (output.empty() ? 0 : output.back()) : int(total / long(pass.raw.size())));
+    }
+    return output;
+}
+
+static std::vector<double> SoftwareEmaPath(const std::vector<Pass>& passes, const double alpha, const bool seeded)
+{
+    std::vector<double> output;
+    double smoothed = 0;
+    bool first = true;
+
+    for (const Pass& pass : passes)
+    {
+        long total = 0;
+
+        for (int raw : pass.raw)
+        {
+            total += raw;
+        }
+        int average = pass.raw.empty() ? 0 : int(total / long(pass.raw.size()));
+
+        //
+        // DigitalFilter starts from 0. The equivalent EMA starts from the first
+        // sample, like the hardware filter, so that only the filtering differs
+        //
+        smoothed = (first && seeded) ? average : alpha * average + (1 - alpha) * smoothed;
+        first = false;
+        output.push_back(seeded ? smoothed : int(smoothed));
+    }
+    return output;
+}
+
+static std::vector<double> SoftwareOneEuroPath(const std::vector<Pass>& passes)
+{
+    std::vector<double> output;
+    OneEuroFilter filter(1000, 2000, 1000);
+
+    for (const Pass& pass : passes)
+    {
+        long total = 0;
+
+        for (int raw : pass.raw)
+        {
+            total += raw;
+        }
+        output.push_back(filter.Filter(pass.raw.empty() ? 0 : int(total / long(pass.raw.size())), pass.time));
+    }
+    return output;
+}
+
+// ---------------------------------- Metrics -----------------------------------
+
+static Comparison Compare(const std::vector<double>& a, const std::vector<double>& b)
+{
+    Comparison comparison;
+    double sumSquares = 0;
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        double difference = std::fabs(a[i] - b[i]);
+
+        sumSquares += difference * difference;
+        comparison.max = std::fmax(comparison.max, difference);
+    }
+    comparison.rms = a.empty() ? 0 : std::sqrt(sumSquares / a.size());
+    return comparison;
+}
+
+/**
+ * @brief Measure the lag and jitter of a path against the clean gesture, pass by pass
+ */
+static Result Measure(const std::vector<Pass>& passes, const std::vector<double>& output)
+{
+    std::vector<uint32_t> time;
+    std::vector<double> reference;
+
+    for (const Pass& pass : passes)
+    {
+        time.push_back(pass.time);
+        reference.push_back(pass.reference);
+    }
+    return Measure(time, reference, output);
+}
+
+int main()
+{
+    const double center = 2048;
+    const uint32_t coefficients[] {2, 4, 8, 16, 64};
+    const double conversionsPerPass = double(CONVERSION_RATE_HZ) * PASS_PERIOD_US / 1e6;
+
+    struct Gesture { const char* name; std::vector<Pass> passes; };
+
+    Gesture gestures[] {
+        {"Rest at center", Sample([=](double) { return center; })},
+        {"Fast bend and release (40 ms)", Sample([=](double t) {
+            return Move(t, 0.5, 0.04, center, ADC_MAX) + Move(t, 1.2, 0.04, 0, center - ADC_MAX); })},
+        {"Vibrato (6 Hz)", Sample([=](double t) {
+            return (t > 0.5 && t < 1.5) ? 3000 + 300 * std::sin(2 * M_PI * 6 * (t - 0.5)) : 3000; })},
+    };
+
+    std::printf("ADC IIR equivalence | Conversions/s per channel: %d | Pass period (us): %d | Fraction bits: %d\n",
+                CONVERSION_RATE_HZ, PASS_PERIOD_US, IIR_FRACTION_BITS);
+
+    for (const Gesture& gesture : gestures)
+    {
+        std::printf("%s\n", gesture.name);
+
+        for (uint32_t k : coefficients)
+        {
+            AdcIirModel model(k, IIR_FRACTION_BITS);
+            double alpha = model.GetEquivalentSmoothingFactor(conversionsPerPass);
+            std::vector<double> hardware = HardwarePath(gesture.passes, k);
+            Comparison equivalence = Compare(hardware, SoftwareEmaPath(gesture.passes, alpha, true));
+            Result result = Measure(gesture.passes, hardware);
+
+            std::printf("  IIR k = %-2u  | Equivalent α/pass: %.3f | Equivalence RMS: %5.2f | max: %5.1f | Lag (ms): %5.1f | Jitter RMS: %5.2f\n",
+                        k, alpha, equivalence.rms, equivalence.max, result.lag, result.jitterRms);
+        }
+
+        Result ema = Measure(gesture.passes, SoftwareEmaPath(gesture.passes, 0.1, false));
+        Result oneEuro = Measure(gesture.passes, SoftwareOneEuroPath(gesture.passes));
+
+        std::printf("  EMA α = 0.1 (software)                                                    | Lag (ms): %5.1f | Jitter RMS: %5.2f\n",
+                    ema.lag, ema.jitterRms);
+        std::printf("  One-Euro (software)                                                       | Lag (ms): %5.1f | Jitter RMS: %5.2f\n",
+                    oneEuro.lag, oneEuro.jitterRms);
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file AdcIirModel.h
+ * @author Mate Narh
+ *
+ * Host model of an IIR filter of the ESP32-S3 ADC digital controller. On every
+ * conversion of its channel, the filter computes
+ *
+ *     out = ((k - 1) * out + in) / k,   k = 2, 4, 8, 16 or 64
+ *
+ * ie. an EMA with a smoothing factor of 1/k at the conversion rate of the
+ * channel. The number of fractional bits the hardware keeps on out is not
+ * documented, so it is a parameter: 0 models a filter that truncates to whole
+ * counts on every conversion, which is the worst case
+ */
+
+#ifndef ADC_IIR_MODEL_H
+#define ADC_IIR_MODEL_H
+
+#include <stdint.h>
+#include <cmath>
+
+class AdcIirModel
+{
+    private:
+
+        uint32_t mCoefficient = 64;   ///< k
+        int mFractionBits = 0;        ///< Fractional bits kept on the output
+        bool mInitialized = false;    ///< Has a first conversion been taken?
+        int64_t mOutput = 0;          ///< The filtered value, with mFractionBits fractional bits
+
+    public:
+
+        AdcIirModel(const uint32_t coefficient, const int fractionBits)
+            : mCoefficient(coefficient), mFractionBits(fractionBits)
+        {
+        }
+
+        /**
+         * @brief Filter one conversion of the channel
+         * @param sample The raw conversion result
+         * @return The filtered result, in whole counts
+         */
+        int Filter(const int sample)
+        {
+            int64_t in = static_cast<int64_t>(sample) << mFractionBits;
+
+            if (!mInitialized)
+            {
+                mInitialized = true;
+                mOutput = in;
+            }
+            else
+            {
+                mOutput = ((mCoefficient - 1) * mOutput + in) / mCoefficient;
+            }
+            return static_cast<int>(mOutput >> mFractionBits);
+        }
+
+        /**
+         * @brief Get the smoothing factor of a software EMA run once per pass that matches this filter
+         * @param conversionsPerPass The conversions of the channel between two passes of the main loop
+         */
+        double GetEquivalentSmoothingFactor(const double conversionsPerPass) const
+        {
+            return 1.0 - std::pow(1.0 - 1.0 / mCoefficient, conversionsPerPass);
+        }
+};
+
+#endif // ADC_IIR_MODEL_H
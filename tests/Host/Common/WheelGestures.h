@@ -0,0 +1,142 @@
+/*
+ * @file WheelGestures.h
+ * @author Mate Narh
+ *
+ * The pieces the wheel benchmarks on the host share: the ADC-like noise and the
+ * move profile the synthetic gestures are built from, and the measurement of a
+ * filter's lag and jitter against the reference of a gesture.
+ *
+ *     Lag    : the delay that best aligns the filtered signal with the reference
+ *              while the wheel moves, in milliseconds
+ *     Jitter : the RMS and peak-to-peak deviation from the reference while the
+ *              wheel rests, in ADC counts
+ *
+ * Header only. Add -I../Common when building a benchmark that includes it
+ */
+
+#ifndef WHEEL_GESTURES_H
+#define WHEEL_GESTURES_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#define MAX_LAG_MS              100
+#define REST_HOLD_MS            300    // Time the reference must stay put for a sample to count as rest
+#define MOVING_SPEED            200.0  // Reference speed above which the wheel counts as moving, in counts/s
+
+struct Result
+{
+    double lag = 0;           // ms
+    double jitterRms = 0;     // counts
+    double jitterPeak = 0;    // counts, peak to peak
+};
+
+/**
+ * @brief Approximately gaussian ADC noise from a fixed seed, so runs are repeatable
+ */
+static inline double Noise(uint32_t& seed, const double sigma)
+{
+    double sum = 0;
+
+    for (int i = 0; i < 12; i++)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        sum += (seed >> 8) / double(1 << 24);
+    }
+    return (sum - 6.0) * sigma;
+}
+
+/**
+ * @brief A move between two positions with a smooth (raised cosine) profile
+ */
+static inline double Move(const double t, const double start, const double duration, const double from, const double to)
+{
+    if (t <= start) return from;
+    if (t >= start + duration) return to;
+    return from + (to - from) * 0.5 * (1 - std::cos(M_PI * (t - start) / duration));
+}
+
+/**
+ * @brief Measure the lag and jitter of a filter's output against a gesture's reference
+ * @param time The time of each sample, in microseconds
+ * @param reference What the filter should output at each sample, in ADC counts
+ * @param output What the filter did output at each sample, in ADC counts
+ */
+static inline Result Measure(const std::vector<uint32_t>& time, const std::vector<double>& reference, const std::vector<double>& output)
+{
+    Result result;
+    size_t count = output.size();
+    std::vector<bool> moving(count, false), resting(count, false);
+    uint32_t lastMoveTime = 0;
+    bool moved = false;
+
+    for (size_t i = 1; i < count; i++)
+    {
+        double period = (time[i] - time[i - 1]) / 1e6;
+        double speed = (period > 0) ? std::fabs(reference[i] - reference[i - 1]) / period : 0;
+
+        moving[i] = speed > MOVING_SPEED;
+        if (moving[i] || !moved)
+        {
+            lastMoveTime = time[i];
+            moved = true;
+        }
+        resting[i] = !moving[i] && time[i] - lastMoveTime >= REST_HOLD_MS * 1000u;
+    }
+
+    //
+    // Lag: the shift of the reference that the output follows most closely
+    // while moving. Samples are taken as evenly spaced for the shift
+    //
+    double period = (count > 1) ? (time[count - 1] - time[0]) / 1e3 / (count - 1) : 1;
+    int maxShift = int(MAX_LAG_MS / period);
+    double bestError = INFINITY;
+
+    for (int shift = 0; shift <= maxShift; shift++)
+    {
+        double error = 0;
+        size_t samples = 0;
+
+        for (size_t i = shift; i < count; i++)
+        {
+            if (moving[i - shift])
+            {
+                error += std::fabs(output[i] - reference[i - shift]);
+                samples++;
+            }
+        }
+        if (samples > 0 && error / samples < bestError)
+        {
+            bestError = error / samples;
+            result.lag = shift * period;
+        }
+    }
+
+    //
+    // Jitter: what is left of the noise once the wheel has settled
+    //
+    double sumSquares = 0, low = INFINITY, high = -INFINITY;
+    size_t samples = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (resting[i])
+        {
+            double deviation = output[i] - reference[i];
+
+            sumSquares += deviation * deviation;
+            low = std::fmin(low, deviation);
+            high = std::fmax(high, deviation);
+            samples++;
+        }
+    }
+    if (samples > 0)
+    {
+        result.jitterRms = std::sqrt(sumSquares / samples);
+        result.jitterPeak = high - low;
+    }
+    return result;
+}
+
+#endif // WHEEL_GESTURES_H
@@ -0,0 +1,258 @@
+/*
+ * @file MidiEncoderTest.cpp
+ * @author Mate Narh
+ *
+ * This host program checks the MidiEncoder of the master's DIN/TRS output:
+ *
+ *     Running status : a message with the status of the previous one is sent
+ *                      without it, and the status comes back after
+ *                      ResetRunningStatus()
+ *     Note offs      : sent as note ons with velocity 0 when asked to
+ *     1-byte messages: program change (0xC0) and channel pressure (0xD0)
+ *                      carry a single data byte
+ *     Ring buffer    : Peek()/Consume() hand out every byte in order, across
+ *                      the wrap of the ring
+ *     Full buffer    : a message is encoded whole or not at all, and counted
+ *                      as dropped when it does not fit
+ *
+ * Each check prints PASS or FAIL, and the program exits with 1 if any failed
+ *
+ * Build and run from this directory:
+ *
+ *     g++ -std=c++17 -O2 -I../../../esp32_s3/cpp/master_slave/master/lib/MidiEncoder MidiEncoderTest.cpp \
+ *         ../../../esp32_s3/cpp/master_slave/master/lib/MidiEncoder/MidiEncoder.cpp -o MidiEncoderTest
+ *     ./MidiEncoderTest
+ */
+
+#include <MidiEncoder.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#define CAPACITY                512    // MidiEncoder::CAPACITY
+
+typedef std::vector<uint8_t> Bytes;
+
+// ---------------------------------- Helpers -----------------------------------
+
+/**
+ * @brief Take every waiting byte the way the transport does, a contiguous run at a time
+ * @param maxRun The most bytes taken per Peek(), like a transport with little room
+ */
+static Bytes Drain(MidiEncoder& encoder, const size_t maxRun = CAPACITY)
+{
+    Bytes bytes;
+    const uint8_t* run = nullptr;
+    size_t count = 0;
+
+    while ((count = encoder.Peek(run)) > 0)
+    {
+        count = (count < maxRun) ? count : maxRun;
+        bytes.insert(bytes.end(), run, run + count);
+        encoder.Consume(count);
+    }
+    return bytes;
+}
+
+static bool Check(const char* name, const bool passed)
+{
+    std::printf("  %-62s | %s\n", name, passed ? "PASS" : "FAIL");
+    return passed;
+}
+
+static void Print(const char* name, const Bytes& bytes)
+{
+    std::printf("  %-62s |", name);
+
+    for (uint8_t byte : bytes)
+    {
+        std::printf(" %02X", byte);
+    }
+    std::printf("\n");
+}
+
+// ---------------------------------- Checks ------------------------------------
+
+static bool RunningStatus()
+{
+    MidiEncoder encoder(false);
+    bool passed = true;
+
+    std::printf("Running status\n");
+
+    encoder.Encode(0x90, 60, 100);
+    encoder.Encode(0x90, 62, 90);
+    encoder.Encode(0x90, 64, 80);
+    Bytes bytes = Drain(encoder);
+    Print("Three note ons", bytes);
+    passed &= Check("Status sent once for the run", bytes == Bytes {0x90, 60, 100, 62, 90, 64, 80});
+
+    encoder.Encode(0x91, 60, 100);
+    encoder.Encode(0xB0, 1, 5);
+    encoder.Encode(0xB0, 1, 6);
+    bytes = Drain(encoder);
+    Print("Another channel, then two CCs", bytes);
+    passed &= Check("Status sent again when it changes", bytes == Bytes {0x91, 60, 100, 0xB0, 1, 5, 1, 6});
+
+    encoder.ResetRunningStatus();
+    encoder.Encode(0xB0, 1, 7);
+    encoder.Encode(0xB0, 1, 8);
+    bytes = Drain(encoder);
+    Print("Same CC after ResetRunningStatus()", bytes);
+    passed &= Check("Status sent again after ResetRunningStatus()", bytes == Bytes {0xB0, 1, 7, 1, 8});
+
+    encoder.Encode(0xB0, 1, 9);
+    encoder.Clear();
+    encoder.Encode(0xB0, 1, 10);
+    bytes = Drain(encoder);
+    passed &= Check("Status sent again after Clear()", bytes == Bytes {0xB0, 1, 10});
+
+    //
+    // 25 bytes for the 10 messages above
+    //
+    passed &= Check("Bytes per message counts the omitted status bytes", std::fabs(encoder.GetBytesPerMessage() - 2.5f) < 0.01f);
+    return passed;
+}
+
+static bool NoteOffAsNoteOn()
+{
+    MidiEncoder encoder(true);
+    bool passed = true;
+
+    std::printf("Note offs as note ons\n");
+
+    encoder.Encode(0x90, 60, 100);
+    encoder.Encode(0x80, 60, 64);
+    encoder.Encode(0x83, 62, 64);
+    Bytes bytes = Drain(encoder);
+    Print("Note on, note off, note off on channel 4", bytes);
+    passed &= Check("Note off sent as note on with velocity 0, in running status",
+                    bytes == Bytes {0x90, 60, 100, 60, 0, 0x93, 62, 0});
+
+    encoder.SetNoteOffAsNoteOn(false);
+    encoder.Encode(0x80, 60, 64);
+    bytes = Drain(encoder);
+    passed &= Check("Note off kept, with its release velocity, when not asked", bytes == Bytes {0x80, 60, 64});
+    return passed;
+}
+
+static bool OneByteMessages()
+{
+    MidiEncoder encoder(false);
+    bool passed = true;
+
+    std::printf("1-byte messages\n");
+
+    encoder.Encode(0xC0, 5, 99);
+    encoder.Encode(0xC0, 6, 99);
+    encoder.Encode(0xD0, 100, 99);
+    encoder.Encode(0xD0, 101, 99);
+    encoder.Encode(0x90, 60, 100);
+    Bytes bytes = Drain(encoder);
+    Print("Program changes, channel pressures, note on", bytes);
+    passed &= Check("A single data byte, data2 ignored, running status kept",
+                    bytes == Bytes {0xC0, 5, 6, 0xD0, 100, 101, 0x90, 60, 100});
+
+    encoder.Encode(0xC1, 0x85, 0);
+    bytes = Drain(encoder);
+    passed &= Check("Data bytes masked to 7 bits", bytes == Bytes {0xC1, 0x05});
+    return passed;
+}
+
+static bool RingWrap()
+{
+    MidiEncoder encoder(false);
+    Bytes expected;
+    Bytes bytes;
+    bool passed = true;
+
+    std::printf("Ring buffer\n");
+
+    //
+    // Move the head close to the end of the ring, then encode across the wrap
+    // with a message per controller value, each with its status byte
+    //
+    for (int i = 0; i < 166; i++)
+    {
+        encoder.Encode((i % 2) ? 0xB0 : 0xB1, 1, i & 0x7F);
+    }
+    Drain(encoder);
+
+    for (int i = 0; i < 100; i++)
+    {
+        uint8_t status = (i % 2) ? 0xB0 : 0xB1;
+
+        encoder.Encode(status, 7, i);
+        expected.insert(expected.end(), {status, 7, uint8_t(i)});
+    }
+
+    const uint8_t* run = nullptr;
+    size_t first = encoder.Peek(run);
+    passed &= Check("Peek() stops at the end of the ring", first == CAPACITY - (166 * 3) % CAPACITY && first < encoder.GetCount());
+
+    bytes = Drain(encoder, 5);
+    passed &= Check("Every byte handed out in order across the wrap", bytes == expected);
+    passed &= Check("Nothing left once consumed", encoder.GetCount() == 0 && encoder.Peek(run) == 0);
+
+    encoder.Encode(0x90, 60, 100);
+    encoder.Consume(10);
+    passed &= Check("Consume() never takes more than is waiting", encoder.GetCount() == 0 && encoder.GetFree() == CAPACITY);
+    return passed;
+}
+
+static bool FullBuffer()
+{
+    MidiEncoder encoder(false);
+    bool passed = true;
+
+    std::printf("Full buffer\n");
+
+    //
+    // 170 messages with their status bytes fill 510 of the 512 bytes
+    //
+    for (int i = 0; i < 170; i++)
+    {
+        encoder.Encode((i % 2) ? 0xB0 : 0xB1, 1, 0);
+    }
+    passed &= Check("Filled to 2 free bytes", encoder.GetFree() == 2 && encoder.GetDroppedMessageCount() == 0);
+
+    bool encoded = encoder.Encode(0x90, 60, 100);
+    passed &= Check("A 3-byte message is refused whole", !encoded && encoder.GetFree() == 2);
+    passed &= Check("and counted as dropped", encoder.GetDroppedMessageCount() == 1);
+
+    encoded = encoder.Encode(0xB0, 1, 1);
+    passed &= Check("A 2-byte message in running status still fits", encoded && encoder.GetFree() == 0);
+
+    encoded = encoder.Encode(0xC0, 5, 0);
+    passed &= Check("Nothing fits a full buffer", !encoded && encoder.GetDroppedMessageCount() == 2);
+
+    //
+    // The refused note on must not have changed the running status: the next
+    // message after draining still runs on the last CC sent
+    //
+    Bytes bytes = Drain(encoder);
+    encoder.Encode(0xB0, 1, 2);
+    bytes = Drain(encoder);
+    passed &= Check("A refused message leaves the running status alone", bytes == Bytes {1, 2});
+    passed &= Check("High-water mark is the full buffer", encoder.GetMaxCount() == CAPACITY);
+    return passed;
+}
+
+int main()
+{
+    bool passed = true;
+
+    std::printf("MIDI encoder test | Buffer (bytes): %d\n", CAPACITY);
+
+    passed &= RunningStatus();
+    passed &= NoteOffAsNoteOn();
+    passed &= OneByteMessages();
+    passed &= RingWrap();
+    passed &= FullBuffer();
+
+    std::printf("%s\n", passed ? "PASS" : "FAIL");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
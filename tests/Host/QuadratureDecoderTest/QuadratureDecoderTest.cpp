@@ -0,0 +1,234 @@
+/*
+ * @file QuadratureDecoderTest.cpp
+ * @author Mate Narh
+ *
+ * This host program checks the table-driven QuadratureDecoder, the fallback of
+ * the rotary encoder when no PCNT unit is available, on synthetic quadrature.
+ * Each gesture spins the knob clockwise, then back counter-clockwise past its
+ * start, at a constant edge rate (edges of CLK and DT per second). The signals
+ * are fed to the decoder the way the firmware does:
+ *
+ *     Interrupts : on every edge of either signal, reading both levels a
+ *                  little later (the interrupt latency)
+ *     Bounce     : the same, with every edge followed by contact bounce
+ *     Polled     : once per pass of a loop running at a fixed rate
+ *
+ * next to the previous algorithm of the encoder (one step per detent on the
+ * rising edges of CLK, polled once per pass). Each row reports the count
+ * decoded against the true position of the knob, and the transitions the
+ * decoder flagged as invalid.
+ *
+ * The decoder must be exact whenever it sees every edge: from interrupts, or
+ * from a loop faster than the edges. The program exits with 1 otherwise
+ *
+ * Build and run from this directory:
+ *
+ *     g++ -std=c++17 -O2 -I../../../common/QuadratureDecoder QuadratureDecoderTest.cpp \
+ *         ../../../common/QuadratureDecoder/QuadratureDecoder.cpp -o QuadratureDecoderTest
+ *     ./QuadratureDecoderTest
+ *
+ * The interrupt latency can be changed with eg. -DISR_LATENCY_US=5
+ */
+
+#include <QuadratureDecoder.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#ifndef ISR_LATENCY_US
+#define ISR_LATENCY_US          2.0    // Time from an edge to the interrupt reading the levels
+#endif
+
+#define COUNTS_PER_DETENT       4
+#define FORWARD_EDGES           4000   // Edges spun clockwise, then FORWARD_EDGES + BACKWARD_OVERSHOOT back
+#define BACKWARD_OVERSHOOT      1000
+#define BOUNCES_PER_EDGE        3      // Extra toggles of the signal that changed, within BOUNCE_SHARE of the edge interval
+#define BOUNCE_SHARE            0.2
+
+struct Transition
+{
+    double time;                 // us
+    uint8_t state;               // (CLK << 1) | DT
+};
+
+struct Signals
+{
+    std::vector<Transition> transitions;
+    int position = 0;            // The true position at the end, in quadrature counts
+    double duration = 0;         // us
+};
+
+// ---------------------------------- Gestures ----------------------------------
+
+//
+// The states of the signals clockwise: CLK leads DT by 90 degrees
+//
+static const uint8_t SEQUENCE[4] = {0b00, 0b10, 0b11, 0b01};
+
+static uint8_t StateAt(const int position)
+{
+    return SEQUENCE[((position % 4) + 4) % 4];
+}
+
+/**
+ * @brief Spin the knob forwards then backwards at a constant edge rate
+ */
+static Signals Spin(const double edgeRate, const bool bounce)
+{
+    Signals signals;
+    double interval = 1e6 / edgeRate;
+    double time = interval;
+    int position = 0;
+    int steps[] {+1, -1};
+    int counts[] {FORWARD_EDGES, FORWARD_EDGES + BACKWARD_OVERSHOOT};
+
+    signals.transitions.push_back({0, StateAt(0)});
+
+    for (int leg = 0; leg < 2; leg++)
+    {
+        for (int i = 0; i < counts[leg]; i++, time += interval)
+        {
+            uint8_t previous = StateAt(position);
+
+            position += steps[leg];
+            signals.transitions.push_back({time, StateAt(position)});
+
+            if (bounce)
+            {
+                double bounceInterval = interval * BOUNCE_SHARE / (2 * BOUNCES_PER_EDGE);
+
+                for (int j = 1; j <= 2 * BOUNCES_PER_EDGE; j++)
+                {
+                    signals.transitions.push_back({time + j * bounceInterval, (j % 2) ? previous : StateAt(position)});
+                }
+            }
+        }
+    }
+    signals.position = position;
+    signals.duration = time + interval;
+    return signals;
+}
+
+/**
+ * @brief Get the state of the signals at a time
+ */
+static uint8_t Read(const Signals& signals, const double time)
+{
+    size_t low = 0, high = signals.transitions.size();
+
+    while (high - low > 1)
+    {
+        size_t middle = (low + high) / 2;
+        (signals.transitions[middle].time <= time) ? low = middle : high = middle;
+    }
+    return signals.transitions[low].state;
+}
+
+// ---------------------------------- Decoding ----------------------------------
+
+struct Result
+{
+    int count = 0;
+    uint32_t invalid = 0;
+};
+
+static Result DecodeInInterrupts(const Signals& signals)
+{
+    QuadratureDecoder decoder;
+    uint8_t state = signals.transitions[0].state;
+
+    decoder.SetState(state >> 1, state & 1);
+
+    for (size_t i = 1; i < signals.transitions.size(); i++)
+    {
+        state = Read(signals, signals.transitions[i].time + ISR_LATENCY_US);
+        decoder.Decode(state >> 1, state & 1);
+    }
+    return {decoder.GetCount(), decoder.GetInvalidCount()};
+}
+
+static Result DecodePolled(const Signals& signals, const double pollRate)
+{
+    QuadratureDecoder decoder;
+    uint8_t state = signals.transitions[0].state;
+
+    decoder.SetState(state >> 1, state & 1);
+
+    for (double time = 0; time <= signals.duration; time += 1e6 / pollRate)
+    {
+        state = Read(signals, time);
+        decoder.Decode(state >> 1, state & 1);
+    }
+    return {decoder.GetCount(), decoder.GetInvalidCount()};
+}
+
+/**
+ * @brief The previous algorithm of the encoder: a detent per rising edge of CLK, polled
+ * @return The count, in quadrature counts, for comparison
+ */
+static Result DecodeRisingClock(const Signals& signals, const double pollRate)
+{
+    Result result;
+    int previousClock = signals.transitions[0].state >> 1;
+
+    for (double time = 0; time <= signals.duration; time += 1e6 / pollRate)
+    {
+        uint8_t state = Read(signals, time);
+        int clock = state >> 1;
+        int data = state & 1;
+
+        if (clock != previousClock && clock == 1)
+        {
+            result.count += (clock != data) ? COUNTS_PER_DETENT : -COUNTS_PER_DETENT;
+        }
+        previousClock = clock;
+    }
+    return result;
+}
+
+static bool Report(const char* source, const Signals& signals, const Result& result, const bool mustBeExact)
+{
+    bool exact = (result.count == signals.position);
+    bool passed = exact || !mustBeExact;
+
+    std::printf("  %-26s | Expected: %6d | Decoded: %6d | Invalid: %6u | %s\n",
+                source, signals.position, result.count, result.invalid,
+                !mustBeExact ? (exact ? "exact" : "lost steps") : (passed ? "PASS" : "FAIL"));
+    return passed;
+}
+
+int main()
+{
+    const double edgeRates[] {1000, 10000, 50000, 200000};
+    const double pollRates[] {1000, 20000};
+    bool passed = true;
+
+    std::printf("Quadrature decoder test | Interrupt latency (us): %.1f | Counts per detent: %d\n",
+                ISR_LATENCY_US, COUNTS_PER_DETENT);
+
+    for (double edgeRate : edgeRates)
+    {
+        Signals clean = Spin(edgeRate, false);
+        Signals bouncing = Spin(edgeRate, true);
+        bool seesEveryEdge = 1e6 / edgeRate > ISR_LATENCY_US;
+        char source[64];
+
+        std::printf("Edge rate: %.0f edges/s\n", edgeRate);
+
+        passed &= Report("Interrupts", clean, DecodeInInterrupts(clean), seesEveryEdge);
+        passed &= Report("Interrupts, bounce", bouncing, DecodeInInterrupts(bouncing), seesEveryEdge);
+
+        for (double pollRate : pollRates)
+        {
+            std::snprintf(source, sizeof(source), "Polled at %.0f Hz", pollRate);
+            passed &= Report(source, clean, DecodePolled(clean, pollRate), pollRate > edgeRate);
+        }
+        std::snprintf(source, sizeof(source), "Rising CLK at %.0f Hz", pollRates[0]);
+        Report(source, clean, DecodeRisingClock(clean, pollRates[0]), false);
+    }
+
+    std::printf("%s\n", passed ? "PASS" : "FAIL");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
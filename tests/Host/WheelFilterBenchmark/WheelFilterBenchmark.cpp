@@ -0,0 +1,221 @@
+/*
+ * @file WheelFilterBenchmark.cpp
+ * @author Mate Narh
+ *
+ * This host program compares the fixed EMA of the wheels (DigitalFilter, α = 0.1
+ * per sample) with the One-Euro filter on wheel gestures, and reports the lag
+ * and jitter of each (see ../Common/WheelGestures.h).
+ *
+ * Without arguments, it runs on synthetic gestures of a joystick wheel sampled
+ * at 1 kHz with ESP32-S3 ADC-like noise, where the reference is the clean
+ * gesture. Recorded gestures can be given as CSV files of "time_us,raw" lines
+ * (eg. logged from analogRead() and micros() in the main loop), in which case
+ * the reference is a centered (zero-lag) moving average of the recording.
+ *
+ * Build and run from this directory:
+ *
+ *     g++ -std=c++17 -O2 -I../Common -I../../../common/OneEuroFilter WheelFilterBenchmark.cpp \
+ *         ../../../common/OneEuroFilter/OneEuroFilter.cpp -o WheelFilterBenchmark
+ *     ./WheelFilterBenchmark [gesture.csv ...]
+ *
+ * Other One-Euro parameters can be tried by adding eg. -DONE_EURO_BETA=4000
+ */
+
+#include <OneEuroFilter.h>
+#include <WheelGestures.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The defaults of the wheels on the master
+#define EMA_SMOOTHING_FACTOR    0.1f
+#ifndef ONE_EURO_MIN_CUTOFF
+#define ONE_EURO_MIN_CUTOFF     1000   // mHz
+#endif
+#ifndef ONE_EURO_BETA
+#define ONE_EURO_BETA           2000   // uHz per count/s
+#endif
+#ifndef ONE_EURO_D_CUTOFF
+#define ONE_EURO_D_CUTOFF       1000   // mHz
+#endif
+
+#define ADC_MAX                 4095
+#define SAMPLE_PERIOD_US        1000
+#define REFERENCE_WINDOW        15     // Samples on each side of the centered average of a recording
+
+struct Gesture
+{
+    std::string name;
+    std::vector<uint32_t> time;   // us
+    std::vector<int> raw;         // ADC counts, as read
+    std::vector<double> reference; // ADC counts, what the filter should output
+};
+
+// ---------------------------------- Gestures ----------------------------------
+
+/**
+ * @brief Build a synthetic gesture from its clean shape
+ * @param name The name of the gesture
+ * @param durationMs The length of the gesture
+ * @param shape The clean wheel position at a time in seconds, in ADC counts
+ */
+template <typename Shape>
+static Gesture Synthesize(const char* name, const int durationMs, Shape shape)
+{
+    Gesture gesture;
+    uint32_t seed = 12345;
+
+    gesture.name = name;
+    for (int i = 0; i < durationMs * 1000 / SAMPLE_PERIOD_US; i++)
+    {
+        double t = i * SAMPLE_PERIOD_US / 1e6;
+        double clean = shape(t);
+        double read = clean + Noise(seed, 6.0) + ((seed >> 28) == 0 ? Noise(seed, 30.0) : 0.0);
+
+        gesture.time.push_back(i * SAMPLE_PERIOD_US);
+        gesture.raw.push_back(int(std::lround(std::fmin(std::fmax(read, 0.0), ADC_MAX))));
+        gesture.reference.push_back(clean);
+    }
+    return gesture;
+}
+
+static std::vector<Gesture> SyntheticGestures()
+{
+    const double center = 2048;
+    std::vector<Gesture> gestures;
+
+    gestures.push_back(Synthesize("Rest at center", 2000, [=](double) { return center; }));
+    gestures.push_back(Synthesize("Slow bend (500 ms)", 2000, [=](double t) {
+        return Move(t, 0.5, 0.5, center, ADC_MAX); }));
+    gestures.push_back(Synthesize("Fast bend and release (40 ms)", 2000, [=](double t) {
+        return Move(t, 0.5, 0.04, center, ADC_MAX) + Move(t, 1.2, 0.04, 0, center - ADC_MAX); }));
+    gestures.push_back(Synthesize("Vibrato (6 Hz)", 2000, [=](double t) {
+        return (t > 0.5 && t < 1.5) ? 3000 + 300 * std::sin(2 * M_PI * 6 * (t - 0.5)) : 3000; }));
+    gestures.push_back(Synthesize("Modulation sweep", 3000, [=](double t) {
+        return Move(t, 0.5, 1.0, 0, ADC_MAX) + Move(t, 2.0, 0.3, 0, -ADC_MAX); }));
+    return gestures;
+}
+
+/**
+ * @brief Load a recorded gesture from a CSV file of "time_us,raw" lines
+ * @return True if at least one sample was read
+ */
+static bool LoadGesture(const char* path, Gesture& gesture)
+{
+    FILE* file = std::fopen(path, "r");
+    unsigned long time = 0;
+    int raw = 0;
+    char line[128];
+
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    gesture.name = path;
+    while (std::fgets(line, sizeof(line), file) != nullptr)
+    {
+        if (std::sscanf(line, "%lu,%d", &time, &raw) == 2)
+        {
+            gesture.time.push_back(uint32_t(time));
+            gesture.raw.push_back(raw);
+        }
+    }
+    std::fclose(file);
+
+    //
+    // No clean signal is known, so the reference is a centered moving average,
+    // which smooths the noise without delaying the gesture
+    //
+    size_t count = gesture.raw.size();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t first = (i < REFERENCE_WINDOW) ? 0 : i - REFERENCE_WINDOW;
+        size_t last = std::min(count - 1, i + REFERENCE_WINDOW);
+        double sum = 0;
+
+        for (size_t j = first; j <= last; j++)
+        {
+            sum += gesture.raw[j];
+        }
+        gesture.reference.push_back(sum / (last - first + 1));
+    }
+    return count > 0;
+}
+
+// ---------------------------------- Filters -----------------------------------
+
+/**
+ * @brief Run the EMA of DigitalFilter (float, one step per sample, from 0)
+ */
+static std::vector<double> RunEma(const Gesture& gesture)
+{
+    std::vector<double> output;
+    float smoothed = 0;
+
+    for (int raw : gesture.raw)
+    {
+        smoothed = EMA_SMOOTHING_FACTOR * raw + (1 - EMA_SMOOTHING_FACTOR) * smoothed;
+        output.push_back(int(smoothed));
+    }
+    return output;
+}
+
+/**
+ * @brief Run the One-Euro filter with the defaults of the wheels
+ */
+static std::vector<double> RunOneEuro(const Gesture& gesture)
+{
+    std::vector<double> output;
+    OneEuroFilter filter(ONE_EURO_MIN_CUTOFF, ONE_EURO_BETA, ONE_EURO_D_CUTOFF);
+
+    for (size_t i = 0; i < gesture.raw.size(); i++)
+    {
+        output.push_back(filter.Filter(gesture.raw[i], gesture.time[i]));
+    }
+    return output;
+}
+
+static void Report(const char* filter, const Result& result)
+{
+    std::printf("  %-9s | Lag (ms): %6.1f | Jitter RMS: %6.2f | Jitter p-p: %6.1f\n",
+                filter, result.lag, result.jitterRms, result.jitterPeak);
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<Gesture> gestures;
+
+    for (int i = 1; i < argc; i++)
+    {
+        Gesture gesture;
+
+        if (LoadGesture(argv[i], gesture))
+        {
+            gestures.push_back(gesture);
+        }
+        else
+        {
+            std::fprintf(stderr, "Could not read a gesture from %s\n", argv[i]);
+        }
+    }
+    if (argc == 1)
+    {
+        gestures = SyntheticGestures();
+    }
+
+    std::printf("Wheel filter benchmark | EMA α: %.2f | One-Euro min cutoff (mHz): %d | Beta (uHz/count/s): %d | D cutoff (mHz): %d\n",
+                EMA_SMOOTHING_FACTOR, ONE_EURO_MIN_CUTOFF, ONE_EURO_BETA, ONE_EURO_D_CUTOFF);
+
+    for (const Gesture& gesture : gestures)
+    {
+        std::printf("%s (%zu samples)\n", gesture.name.c_str(), gesture.raw.size());
+        Report("EMA", Measure(gesture.time, gesture.reference, RunEma(gesture)));
+        Report("One-Euro", Measure(gesture.time, gesture.reference, RunOneEuro(gesture)));
+    }
+    return 0;
+}